@@ -28,15 +28,11 @@
 typedef struct _EGLPixmapBuffer EGLPixmapBuffer;
 typedef struct _EGLShimSurface EGLShimSurface;
 typedef struct _EGLShimDisplay EGLShimDisplay;
+typedef struct _EGLShimScreen EGLShimScreen;
+typedef struct _EGLShimFormat EGLShimFormat;
+typedef struct _EGLShmBuffer EGLShmBuffer;
+typedef struct _EGLShimHud EGLShimHud;
 typedef void * EGLShimSurfaceList;
 typedef void * EGLShimPixmapBufferList;
 
-// #define DBG 1
-
-#ifdef DBG
-#define DEBUG(format, ...) printf (format, ##__VA_ARGS__)
-#else
-#define DEBUG(format, ...)
-#endif
-
 #endif // DEFS_H
@@ -0,0 +1,630 @@
+/*
+ * egl_convert.c
+ *
+ * Copyright (C) 2020 Ivaylo Dimitrov <ivo.g.dimitrov.75@gmail.com>
+ *
+ * This library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON)
+#define HAVE_NEON 1
+#include <arm_neon.h>
+#endif
+
+#include "egl_convert.h"
+
+#define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
+
+/*
+ * Scalar reference implementations, also used for the tails the vector
+ * versions do not handle. All formats are little endian, so i.e. RGB888 is
+ * B, G, R in memory and XRGB8888 is B, G, R, X.
+ */
+static void
+rgb888_to_xrgb8888_c(void *dst, const void *src, uint32_t pixels)
+{
+  const uint8_t *s = src;
+  uint32_t *d = dst;
+
+  while (pixels--)
+  {
+    *d++ = 0xff000000 | s[2] << 16 | s[1] << 8 | s[0];
+    s += 3;
+  }
+}
+
+static void
+bgr888_to_xrgb8888_c(void *dst, const void *src, uint32_t pixels)
+{
+  const uint8_t *s = src;
+  uint32_t *d = dst;
+
+  while (pixels--)
+  {
+    *d++ = 0xff000000 | s[0] << 16 | s[1] << 8 | s[2];
+    s += 3;
+  }
+}
+
+static void
+swap_rb_8888_c(void *dst, const void *src, uint32_t pixels)
+{
+  const uint32_t *s = src;
+  uint32_t *d = dst;
+
+  while (pixels--)
+  {
+    uint32_t p = *s++;
+
+    *d++ = (p & 0xff00ff00) | ((p >> 16) & 0xff) | ((p & 0xff) << 16);
+  }
+}
+
+static void
+swap_rb_x8888_c(void *dst, const void *src, uint32_t pixels)
+{
+  const uint32_t *s = src;
+  uint32_t *d = dst;
+
+  while (pixels--)
+  {
+    uint32_t p = *s++;
+
+    *d++ = (p & 0x00ff00ff) | ((p >> 16) & 0xff00) | ((p & 0xff00) << 16);
+  }
+}
+
+static void
+xrgb8888_to_rgb565_c(void *dst, const void *src, uint32_t pixels)
+{
+  const uint32_t *s = src;
+  uint16_t *d = dst;
+
+  while (pixels--)
+  {
+    uint32_t p = *s++;
+
+    *d++ = ((p >> 8) & 0xf800) | ((p >> 5) & 0x07e0) | ((p >> 3) & 0x001f);
+  }
+}
+
+static void
+set_alpha_8888_c(void *dst, const void *src, uint32_t pixels)
+{
+  const uint32_t *s = src;
+  uint32_t *d = dst;
+
+  while (pixels--)
+    *d++ = *s++ | 0xff000000;
+}
+
+static Bool
+supported_always(void)
+{
+  return True;
+}
+
+#ifdef HAVE_X86
+static Bool
+supported_sse2(void)
+{
+  return __builtin_cpu_supports("sse2");
+}
+
+static Bool
+supported_ssse3(void)
+{
+  return __builtin_cpu_supports("ssse3");
+}
+
+static Bool
+supported_avx2(void)
+{
+  return __builtin_cpu_supports("avx2");
+}
+
+/* packs 32 bit lanes holding 16 bit values without signed saturation */
+#define PACK_U16_SSE2(a, b) \
+  _mm_xor_si128( \
+    _mm_packs_epi32(_mm_sub_epi32((a), _mm_set1_epi32(0x8000)), \
+                    _mm_sub_epi32((b), _mm_set1_epi32(0x8000))), \
+    _mm_set1_epi16((short)0x8000))
+
+__attribute__((target("sse2"))) static inline __m128i
+rgb565_sse2(__m128i p)
+{
+  __m128i r = _mm_and_si128(_mm_srli_epi32(p, 8), _mm_set1_epi32(0xf800));
+  __m128i g = _mm_and_si128(_mm_srli_epi32(p, 5), _mm_set1_epi32(0x07e0));
+  __m128i b = _mm_and_si128(_mm_srli_epi32(p, 3), _mm_set1_epi32(0x001f));
+
+  return _mm_or_si128(_mm_or_si128(r, g), b);
+}
+
+__attribute__((target("sse2"))) static void
+swap_rb_8888_sse2(void *dst, const void *src, uint32_t pixels)
+{
+  const uint8_t *s = src;
+  uint8_t *d = dst;
+  const __m128i ag_mask = _mm_set1_epi32(0xff00ff00);
+  const __m128i rb_mask = _mm_set1_epi32(0x00ff00ff);
+
+  for (; pixels >= 4; pixels -= 4, s += 16, d += 16)
+  {
+    __m128i p = _mm_loadu_si128((const __m128i *)s);
+    __m128i rb = _mm_and_si128(p, rb_mask);
+
+    rb = _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16));
+    _mm_storeu_si128((__m128i *)d,
+                     _mm_or_si128(_mm_and_si128(p, ag_mask), rb));
+  }
+
+  swap_rb_8888_c(d, s, pixels);
+}
+
+__attribute__((target("sse2"))) static void
+swap_rb_x8888_sse2(void *dst, const void *src, uint32_t pixels)
+{
+  const uint8_t *s = src;
+  uint8_t *d = dst;
+  const __m128i xg_mask = _mm_set1_epi32(0x00ff00ff);
+  const __m128i rb_mask = _mm_set1_epi32(0xff00ff00);
+
+  for (; pixels >= 4; pixels -= 4, s += 16, d += 16)
+  {
+    __m128i p = _mm_loadu_si128((const __m128i *)s);
+    __m128i rb = _mm_and_si128(p, rb_mask);
+
+    rb = _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16));
+    _mm_storeu_si128((__m128i *)d,
+                     _mm_or_si128(_mm_and_si128(p, xg_mask), rb));
+  }
+
+  swap_rb_x8888_c(d, s, pixels);
+}
+
+__attribute__((target("sse2"))) static void
+xrgb8888_to_rgb565_sse2(void *dst, const void *src, uint32_t pixels)
+{
+  const uint8_t *s = src;
+  uint8_t *d = dst;
+
+  for (; pixels >= 8; pixels -= 8, s += 32, d += 16)
+  {
+    __m128i a = rgb565_sse2(_mm_loadu_si128((const __m128i *)s));
+    __m128i b = rgb565_sse2(_mm_loadu_si128((const __m128i *)(s + 16)));
+
+    _mm_storeu_si128((__m128i *)d, PACK_U16_SSE2(a, b));
+  }
+
+  xrgb8888_to_rgb565_c(d, s, pixels);
+}
+
+__attribute__((target("sse2"))) static void
+set_alpha_8888_sse2(void *dst, const void *src, uint32_t pixels)
+{
+  const uint8_t *s = src;
+  uint8_t *d = dst;
+  const __m128i alpha = _mm_set1_epi32(0xff000000);
+
+  for (; pixels >= 4; pixels -= 4, s += 16, d += 16)
+  {
+    __m128i p = _mm_loadu_si128((const __m128i *)s);
+
+    _mm_storeu_si128((__m128i *)d, _mm_or_si128(p, alpha));
+  }
+
+  set_alpha_8888_c(d, s, pixels);
+}
+
+/*
+ * 24 -> 32 bpp expansion needs a byte shuffle, which SSE2 does not have.
+ * Every 16 byte load consumes 12 bytes, so stop early enough to never read
+ * past the end of the source row.
+ */
+#define SHUF_RGB888 \
+  0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1
+#define SHUF_BGR888 \
+  2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1
+
+__attribute__((target("ssse3"))) static uint32_t
+expand_888_ssse3(uint8_t **d, const uint8_t **s, uint32_t pixels,
+                 __m128i shuf)
+{
+  const __m128i alpha = _mm_set1_epi32(0xff000000);
+
+  for (; pixels >= 6; pixels -= 4, *s += 12, *d += 16)
+  {
+    __m128i p = _mm_loadu_si128((const __m128i *)*s);
+
+    p = _mm_or_si128(_mm_shuffle_epi8(p, shuf), alpha);
+    _mm_storeu_si128((__m128i *)*d, p);
+  }
+
+  return pixels;
+}
+
+__attribute__((target("ssse3"))) static void
+rgb888_to_xrgb8888_ssse3(void *dst, const void *src, uint32_t pixels)
+{
+  const uint8_t *s = src;
+  uint8_t *d = dst;
+
+  pixels = expand_888_ssse3(&d, &s, pixels, _mm_setr_epi8(SHUF_RGB888));
+  rgb888_to_xrgb8888_c(d, s, pixels);
+}
+
+__attribute__((target("ssse3"))) static void
+bgr888_to_xrgb8888_ssse3(void *dst, const void *src, uint32_t pixels)
+{
+  const uint8_t *s = src;
+  uint8_t *d = dst;
+
+  pixels = expand_888_ssse3(&d, &s, pixels, _mm_setr_epi8(SHUF_BGR888));
+  bgr888_to_xrgb8888_c(d, s, pixels);
+}
+
+/* two 12 byte groups per iteration, one in each 128 bit lane */
+__attribute__((target("avx2"))) static uint32_t
+expand_888_avx2(uint8_t **d, const uint8_t **s, uint32_t pixels,
+                __m256i shuf)
+{
+  const __m256i alpha = _mm256_set1_epi32(0xff000000);
+
+  for (; pixels >= 10; pixels -= 8, *s += 24, *d += 32)
+  {
+    __m128i lo = _mm_loadu_si128((const __m128i *)*s);
+    __m128i hi = _mm_loadu_si128((const __m128i *)(*s + 12));
+    __m256i p = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+
+    p = _mm256_or_si256(_mm256_shuffle_epi8(p, shuf), alpha);
+    _mm256_storeu_si256((__m256i *)*d, p);
+  }
+
+  return pixels;
+}
+
+__attribute__((target("avx2"))) static void
+rgb888_to_xrgb8888_avx2(void *dst, const void *src, uint32_t pixels)
+{
+  const uint8_t *s = src;
+  uint8_t *d = dst;
+
+  pixels = expand_888_avx2(&d, &s, pixels,
+                           _mm256_setr_epi8(SHUF_RGB888, SHUF_RGB888));
+  rgb888_to_xrgb8888_c(d, s, pixels);
+}
+
+__attribute__((target("avx2"))) static void
+bgr888_to_xrgb8888_avx2(void *dst, const void *src, uint32_t pixels)
+{
+  const uint8_t *s = src;
+  uint8_t *d = dst;
+
+  pixels = expand_888_avx2(&d, &s, pixels,
+                           _mm256_setr_epi8(SHUF_BGR888, SHUF_BGR888));
+  bgr888_to_xrgb8888_c(d, s, pixels);
+}
+
+__attribute__((target("avx2"))) static void
+swap_rb_8888_avx2(void *dst, const void *src, uint32_t pixels)
+{
+  const uint8_t *s = src;
+  uint8_t *d = dst;
+  const __m256i shuf = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7,
+                                        10, 9, 8, 11, 14, 13, 12, 15,
+                                        2, 1, 0, 3, 6, 5, 4, 7,
+                                        10, 9, 8, 11, 14, 13, 12, 15);
+
+  for (; pixels >= 8; pixels -= 8, s += 32, d += 32)
+  {
+    __m256i p = _mm256_loadu_si256((const __m256i *)s);
+
+    _mm256_storeu_si256((__m256i *)d, _mm256_shuffle_epi8(p, shuf));
+  }
+
+  swap_rb_8888_c(d, s, pixels);
+}
+
+__attribute__((target("avx2"))) static void
+swap_rb_x8888_avx2(void *dst, const void *src, uint32_t pixels)
+{
+  const uint8_t *s = src;
+  uint8_t *d = dst;
+  const __m256i shuf = _mm256_setr_epi8(0, 3, 2, 1, 4, 7, 6, 5,
+                                        8, 11, 10, 9, 12, 15, 14, 13,
+                                        0, 3, 2, 1, 4, 7, 6, 5,
+                                        8, 11, 10, 9, 12, 15, 14, 13);
+
+  for (; pixels >= 8; pixels -= 8, s += 32, d += 32)
+  {
+    __m256i p = _mm256_loadu_si256((const __m256i *)s);
+
+    _mm256_storeu_si256((__m256i *)d, _mm256_shuffle_epi8(p, shuf));
+  }
+
+  swap_rb_x8888_c(d, s, pixels);
+}
+
+__attribute__((target("avx2"))) static inline __m256i
+rgb565_avx2(__m256i p)
+{
+  __m256i r = _mm256_and_si256(_mm256_srli_epi32(p, 8),
+                               _mm256_set1_epi32(0xf800));
+  __m256i g = _mm256_and_si256(_mm256_srli_epi32(p, 5),
+                               _mm256_set1_epi32(0x07e0));
+  __m256i b = _mm256_and_si256(_mm256_srli_epi32(p, 3),
+                               _mm256_set1_epi32(0x001f));
+
+  return _mm256_or_si256(_mm256_or_si256(r, g), b);
+}
+
+__attribute__((target("avx2"))) static void
+xrgb8888_to_rgb565_avx2(void *dst, const void *src, uint32_t pixels)
+{
+  const uint8_t *s = src;
+  uint8_t *d = dst;
+
+  for (; pixels >= 16; pixels -= 16, s += 64, d += 32)
+  {
+    __m256i a = rgb565_avx2(_mm256_loadu_si256((const __m256i *)s));
+    __m256i b = rgb565_avx2(_mm256_loadu_si256((const __m256i *)(s + 32)));
+    __m256i p;
+
+    /* _mm256_packus_epi32 saturates unsigned, values fit in 16 bits */
+    p = _mm256_packus_epi32(a, b);
+    /* packs work per 128 bit lane, put the quadwords back in order */
+    p = _mm256_permute4x64_epi64(p, 0xd8);
+    _mm256_storeu_si256((__m256i *)d, p);
+  }
+
+  xrgb8888_to_rgb565_c(d, s, pixels);
+}
+
+__attribute__((target("avx2"))) static void
+set_alpha_8888_avx2(void *dst, const void *src, uint32_t pixels)
+{
+  const uint8_t *s = src;
+  uint8_t *d = dst;
+  const __m256i alpha = _mm256_set1_epi32(0xff000000);
+
+  for (; pixels >= 8; pixels -= 8, s += 32, d += 32)
+  {
+    __m256i p = _mm256_loadu_si256((const __m256i *)s);
+
+    _mm256_storeu_si256((__m256i *)d, _mm256_or_si256(p, alpha));
+  }
+
+  set_alpha_8888_c(d, s, pixels);
+}
+#endif /* HAVE_X86 */
+
+#ifdef HAVE_NEON
+static void
+rgb888_to_xrgb8888_neon(void *dst, const void *src, uint32_t pixels)
+{
+  const uint8_t *s = src;
+  uint8_t *d = dst;
+
+  for (; pixels >= 16; pixels -= 16, s += 48, d += 64)
+  {
+    uint8x16x3_t p = vld3q_u8(s);
+    uint8x16x4_t q = {{p.val[0], p.val[1], p.val[2], vdupq_n_u8(0xff)}};
+
+    vst4q_u8(d, q);
+  }
+
+  rgb888_to_xrgb8888_c(d, s, pixels);
+}
+
+static void
+bgr888_to_xrgb8888_neon(void *dst, const void *src, uint32_t pixels)
+{
+  const uint8_t *s = src;
+  uint8_t *d = dst;
+
+  for (; pixels >= 16; pixels -= 16, s += 48, d += 64)
+  {
+    uint8x16x3_t p = vld3q_u8(s);
+    uint8x16x4_t q = {{p.val[2], p.val[1], p.val[0], vdupq_n_u8(0xff)}};
+
+    vst4q_u8(d, q);
+  }
+
+  bgr888_to_xrgb8888_c(d, s, pixels);
+}
+
+static void
+swap_rb_8888_neon(void *dst, const void *src, uint32_t pixels)
+{
+  const uint8_t *s = src;
+  uint8_t *d = dst;
+
+  for (; pixels >= 16; pixels -= 16, s += 64, d += 64)
+  {
+    uint8x16x4_t p = vld4q_u8(s);
+    uint8x16_t tmp = p.val[0];
+
+    p.val[0] = p.val[2];
+    p.val[2] = tmp;
+    vst4q_u8(d, p);
+  }
+
+  swap_rb_8888_c(d, s, pixels);
+}
+
+static void
+swap_rb_x8888_neon(void *dst, const void *src, uint32_t pixels)
+{
+  const uint8_t *s = src;
+  uint8_t *d = dst;
+
+  for (; pixels >= 16; pixels -= 16, s += 64, d += 64)
+  {
+    uint8x16x4_t p = vld4q_u8(s);
+    uint8x16_t tmp = p.val[1];
+
+    p.val[1] = p.val[3];
+    p.val[3] = tmp;
+    vst4q_u8(d, p);
+  }
+
+  swap_rb_x8888_c(d, s, pixels);
+}
+
+static inline uint16x8_t
+rgb565_neon(uint8x8_t r, uint8x8_t g, uint8x8_t b)
+{
+  uint16x8_t p = vshll_n_u8(r, 8);
+
+  p = vsriq_n_u16(p, vshll_n_u8(g, 8), 5);
+  p = vsriq_n_u16(p, vshll_n_u8(b, 8), 11);
+
+  return p;
+}
+
+static void
+xrgb8888_to_rgb565_neon(void *dst, const void *src, uint32_t pixels)
+{
+  const uint8_t *s = src;
+  uint16_t *d = dst;
+
+  for (; pixels >= 16; pixels -= 16, s += 64, d += 16)
+  {
+    uint8x16x4_t p = vld4q_u8(s);
+
+    vst1q_u16(d, rgb565_neon(vget_low_u8(p.val[2]), vget_low_u8(p.val[1]),
+                             vget_low_u8(p.val[0])));
+    vst1q_u16(d + 8, rgb565_neon(vget_high_u8(p.val[2]),
+                                 vget_high_u8(p.val[1]),
+                                 vget_high_u8(p.val[0])));
+  }
+
+  xrgb8888_to_rgb565_c(d, s, pixels);
+}
+
+static void
+set_alpha_8888_neon(void *dst, const void *src, uint32_t pixels)
+{
+  const uint32_t *s = src;
+  uint32_t *d = dst;
+  const uint32x4_t alpha = vdupq_n_u32(0xff000000);
+
+  for (; pixels >= 4; pixels -= 4, s += 4, d += 4)
+    vst1q_u32(d, vorrq_u32(vld1q_u32(s), alpha));
+
+  set_alpha_8888_c(d, s, pixels);
+}
+#endif /* HAVE_NEON */
+
+/* best first, the scalar versions must come last */
+static const EGLConvertImpl impls[] =
+{
+#ifdef HAVE_X86
+  {"avx2", EGL_CONVERT_RGB888_TO_XRGB8888, rgb888_to_xrgb8888_avx2,
+   24, 32, supported_avx2},
+  {"avx2", EGL_CONVERT_BGR888_TO_XRGB8888, bgr888_to_xrgb8888_avx2,
+   24, 32, supported_avx2},
+  {"avx2", EGL_CONVERT_SWAP_RB_8888, swap_rb_8888_avx2,
+   32, 32, supported_avx2},
+  {"avx2", EGL_CONVERT_XRGB8888_TO_RGB565, xrgb8888_to_rgb565_avx2,
+   32, 16, supported_avx2},
+  {"avx2", EGL_CONVERT_SET_ALPHA_8888, set_alpha_8888_avx2,
+   32, 32, supported_avx2},
+  {"avx2", EGL_CONVERT_SWAP_RB_X8888, swap_rb_x8888_avx2,
+   32, 32, supported_avx2},
+  {"ssse3", EGL_CONVERT_RGB888_TO_XRGB8888, rgb888_to_xrgb8888_ssse3,
+   24, 32, supported_ssse3},
+  {"ssse3", EGL_CONVERT_BGR888_TO_XRGB8888, bgr888_to_xrgb8888_ssse3,
+   24, 32, supported_ssse3},
+  {"sse2", EGL_CONVERT_SWAP_RB_8888, swap_rb_8888_sse2,
+   32, 32, supported_sse2},
+  {"sse2", EGL_CONVERT_XRGB8888_TO_RGB565, xrgb8888_to_rgb565_sse2,
+   32, 16, supported_sse2},
+  {"sse2", EGL_CONVERT_SET_ALPHA_8888, set_alpha_8888_sse2,
+   32, 32, supported_sse2},
+  {"sse2", EGL_CONVERT_SWAP_RB_X8888, swap_rb_x8888_sse2,
+   32, 32, supported_sse2},
+#endif
+#ifdef HAVE_NEON
+  {"neon", EGL_CONVERT_RGB888_TO_XRGB8888, rgb888_to_xrgb8888_neon,
+   24, 32, supported_always},
+  {"neon", EGL_CONVERT_BGR888_TO_XRGB8888, bgr888_to_xrgb8888_neon,
+   24, 32, supported_always},
+  {"neon", EGL_CONVERT_SWAP_RB_8888, swap_rb_8888_neon,
+   32, 32, supported_always},
+  {"neon", EGL_CONVERT_XRGB8888_TO_RGB565, xrgb8888_to_rgb565_neon,
+   32, 16, supported_always},
+  {"neon", EGL_CONVERT_SET_ALPHA_8888, set_alpha_8888_neon,
+   32, 32, supported_always},
+  {"neon", EGL_CONVERT_SWAP_RB_X8888, swap_rb_x8888_neon,
+   32, 32, supported_always},
+#endif
+  {"c", EGL_CONVERT_RGB888_TO_XRGB8888, rgb888_to_xrgb8888_c,
+   24, 32, supported_always},
+  {"c", EGL_CONVERT_BGR888_TO_XRGB8888, bgr888_to_xrgb8888_c,
+   24, 32, supported_always},
+  {"c", EGL_CONVERT_SWAP_RB_8888, swap_rb_8888_c,
+   32, 32, supported_always},
+  {"c", EGL_CONVERT_XRGB8888_TO_RGB565, xrgb8888_to_rgb565_c,
+   32, 16, supported_always},
+  {"c", EGL_CONVERT_SET_ALPHA_8888, set_alpha_8888_c,
+   32, 32, supported_always},
+  {"c", EGL_CONVERT_SWAP_RB_X8888, swap_rb_x8888_c,
+   32, 32, supported_always},
+};
+
+const EGLConvertImpl *
+egl_convert_get(EGLConvertKernel kernel)
+{
+  static const EGLConvertImpl *best[EGL_CONVERT_KERNEL_COUNT];
+  int i;
+
+  if (best[kernel])
+    return best[kernel];
+
+#ifdef HAVE_X86
+  __builtin_cpu_init();
+#endif
+
+  for (i = 0; i < ARRAY_SIZE(impls); i++)
+  {
+    if (impls[i].kernel == kernel && impls[i].supported())
+    {
+      best[kernel] = &impls[i];
+      break;
+    }
+  }
+
+  return best[kernel];
+}
+
+const EGLConvertImpl *
+egl_convert_impls(int *count)
+{
+#ifdef HAVE_X86
+  __builtin_cpu_init();
+#endif
+
+  *count = ARRAY_SIZE(impls);
+
+  return impls;
+}
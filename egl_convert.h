@@ -0,0 +1,60 @@
+/*
+ * egl_convert.h
+ *
+ * Copyright (C) 2020 Ivaylo Dimitrov <ivo.g.dimitrov.75@gmail.com>
+ *
+ * This library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef EGL_CONVERT_H
+#define EGL_CONVERT_H
+
+#include <stdint.h>
+
+#include "defs.h"
+
+/* pixel format conversion kernels, used when moving pixels on the CPU */
+typedef enum
+{
+  EGL_CONVERT_RGB888_TO_XRGB8888,
+  EGL_CONVERT_BGR888_TO_XRGB8888,
+  EGL_CONVERT_SWAP_RB_8888,       /* XRGB <-> XBGR, bytes 0 and 2 */
+  EGL_CONVERT_XRGB8888_TO_RGB565,
+  EGL_CONVERT_SET_ALPHA_8888,     /* XRGB -> ARGB with opaque alpha */
+  EGL_CONVERT_SWAP_RB_X8888,      /* BGRX <-> RGBX, bytes 1 and 3 */
+  EGL_CONVERT_KERNEL_COUNT
+} EGLConvertKernel;
+
+/* converts one row of pixels, dst and src must not overlap */
+typedef void (*EGLConvertFn)(void *dst, const void *src, uint32_t pixels);
+
+typedef struct
+{
+  const char *name;
+  EGLConvertKernel kernel;
+  EGLConvertFn fn;
+  int src_bpp;
+  int dst_bpp;
+  Bool (*supported)(void);
+} EGLConvertImpl;
+
+/* fastest implementation the CPU supports */
+const EGLConvertImpl *
+egl_convert_get(EGLConvertKernel kernel);
+
+/* all implementations, for testing and benchmarking */
+const EGLConvertImpl *
+egl_convert_impls(int *count);
+
+#endif // EGL_CONVERT_H
@@ -0,0 +1,164 @@
+/*
+ * egl_convert_bench.c
+ *
+ * Copyright (C) 2020 Ivaylo Dimitrov <ivo.g.dimitrov.75@gmail.com>
+ *
+ * This library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Checks every conversion kernel the CPU supports against the scalar
+ * reference and reports its throughput in GB/s (source + destination bytes).
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "egl_convert.h"
+
+#define WIDTH 1920
+#define HEIGHT 1080
+#define MIN_TIME_NS 500000000ULL
+
+static const char *kernel_names[EGL_CONVERT_KERNEL_COUNT] =
+{
+  "rgb888->xrgb8888",
+  "bgr888->xrgb8888",
+  "swap r/b 8888",
+  "xrgb8888->rgb565",
+  "set alpha 8888",
+  "swap r/b x8888",
+};
+
+static uint64_t
+time_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static const EGLConvertImpl *
+find_reference(const EGLConvertImpl *impls, int count, EGLConvertKernel kernel)
+{
+  int i;
+
+  for (i = 0; i < count; i++)
+  {
+    if (impls[i].kernel == kernel && !strcmp(impls[i].name, "c"))
+      return &impls[i];
+  }
+
+  return NULL;
+}
+
+/* odd lengths and offsets, so the scalar tails get exercised too */
+static Bool
+verify(const EGLConvertImpl *impl, const EGLConvertImpl *ref,
+       const uint8_t *src)
+{
+  static const uint32_t lengths[] = {0, 1, 3, 7, 15, 17, 33, 63, 1023};
+  size_t size = 1024 * 4 + 64;
+  uint8_t *a = malloc(size);
+  uint8_t *b = malloc(size);
+  Bool ok = True;
+  int i;
+
+  for (i = 0; i < sizeof(lengths) / sizeof(lengths[0]) && ok; i++)
+  {
+    memset(a, 0x5a, size);
+    memset(b, 0x5a, size);
+    impl->fn(a + 1, src + 3, lengths[i]);
+    ref->fn(b + 1, src + 3, lengths[i]);
+
+    if (memcmp(a, b, size))
+    {
+      fprintf(stderr, "%s %s differs from reference for %u pixels\n",
+              impl->name, kernel_names[impl->kernel], lengths[i]);
+      ok = False;
+    }
+  }
+
+  free(a);
+  free(b);
+
+  return ok;
+}
+
+int
+main(int argc, char *argv[])
+{
+  const EGLConvertImpl *impls;
+  uint8_t *src, *dst;
+  int count, i, failed = 0;
+
+  impls = egl_convert_impls(&count);
+
+  src = malloc(WIDTH * HEIGHT * 4);
+  dst = malloc(WIDTH * HEIGHT * 4);
+
+  srand(1);
+
+  for (i = 0; i < WIDTH * HEIGHT * 4; i++)
+    src[i] = rand();
+
+  printf("%-18s %-6s %10s\n", "kernel", "impl", "GB/s");
+
+  for (i = 0; i < count; i++)
+  {
+    const EGLConvertImpl *impl = &impls[i];
+    const EGLConvertImpl *ref = find_reference(impls, count, impl->kernel);
+    uint64_t start, elapsed;
+    uint64_t bytes = 0;
+    int y;
+
+    if (!impl->supported())
+      continue;
+
+    if (!verify(impl, ref, src))
+    {
+      failed++;
+      continue;
+    }
+
+    start = time_ns();
+
+    do
+    {
+      for (y = 0; y < HEIGHT; y++)
+      {
+        impl->fn(dst + y * WIDTH * impl->dst_bpp / 8,
+                 src + y * WIDTH * impl->src_bpp / 8, WIDTH);
+      }
+
+      bytes += (uint64_t)WIDTH * HEIGHT * (impl->src_bpp + impl->dst_bpp) / 8;
+      elapsed = time_ns() - start;
+    }
+    while (elapsed < MIN_TIME_NS);
+
+    printf("%-18s %-6s %10.2f%s\n", kernel_names[impl->kernel], impl->name,
+           (double)bytes / elapsed,
+           egl_convert_get(impl->kernel) == impl ? " *" : "");
+  }
+
+  free(src);
+  free(dst);
+
+  return failed ? 1 : 0;
+}
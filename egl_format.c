@@ -0,0 +1,86 @@
+/*
+ * egl_format.c
+ *
+ * Copyright (C) 2020 Ivaylo Dimitrov <ivo.g.dimitrov.75@gmail.com>
+ *
+ * This library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <X11/X.h>
+#include <gbm.h>
+
+#include "egl_format.h"
+
+#define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
+
+static const EGLShimFormat formats[] =
+{
+  /* 16 bpp */
+  {GBM_FORMAT_RGB565, 16, 16,
+   0x0000f800, 0x000007e0, 0x0000001f, 0x00000000, TrueColor},
+  {GBM_FORMAT_BGR565, 16, 16,
+   0x0000001f, 0x000007e0, 0x0000f800, 0x00000000, TrueColor},
+  {GBM_FORMAT_XRGB1555, 15, 16,
+   0x00007c00, 0x000003e0, 0x0000001f, 0x00000000, TrueColor},
+  {GBM_FORMAT_ARGB1555, 16, 16,
+   0x00007c00, 0x000003e0, 0x0000001f, 0x00008000, TrueColor},
+
+  /* 24 bpp */
+  {GBM_FORMAT_RGB888, 24, 24,
+   0x00ff0000, 0x0000ff00, 0x000000ff, 0x00000000, TrueColor},
+  {GBM_FORMAT_BGR888, 24, 24,
+   0x000000ff, 0x0000ff00, 0x00ff0000, 0x00000000, TrueColor},
+
+  /* 32 bpp */
+  {GBM_FORMAT_XRGB8888, 24, 32,
+   0x00ff0000, 0x0000ff00, 0x000000ff, 0x00000000, TrueColor},
+  {GBM_FORMAT_XBGR8888, 24, 32,
+   0x000000ff, 0x0000ff00, 0x00ff0000, 0x00000000, TrueColor},
+  {GBM_FORMAT_RGBX8888, 24, 32,
+   0xff000000, 0x00ff0000, 0x0000ff00, 0x00000000, TrueColor},
+  {GBM_FORMAT_BGRX8888, 24, 32,
+   0x0000ff00, 0x00ff0000, 0xff000000, 0x00000000, TrueColor},
+  {GBM_FORMAT_ARGB8888, 32, 32,
+   0x00ff0000, 0x0000ff00, 0x000000ff, 0xff000000, TrueColor},
+  {GBM_FORMAT_ABGR8888, 32, 32,
+   0x000000ff, 0x0000ff00, 0x00ff0000, 0xff000000, TrueColor},
+  {GBM_FORMAT_RGBA8888, 32, 32,
+   0xff000000, 0x00ff0000, 0x0000ff00, 0x000000ff, TrueColor},
+  {GBM_FORMAT_BGRA8888, 32, 32,
+   0x0000ff00, 0x00ff0000, 0xff000000, 0x000000ff, TrueColor},
+
+  /* 30 bit depth */
+  {GBM_FORMAT_XRGB2101010, 30, 32,
+   0x3ff00000, 0x000ffc00, 0x000003ff, 0x00000000, TrueColor},
+  {GBM_FORMAT_XBGR2101010, 30, 32,
+   0x000003ff, 0x000ffc00, 0x3ff00000, 0x00000000, TrueColor},
+  {GBM_FORMAT_ARGB2101010, 32, 32,
+   0x3ff00000, 0x000ffc00, 0x000003ff, 0xc0000000, TrueColor},
+  {GBM_FORMAT_ABGR2101010, 32, 32,
+   0x000003ff, 0x000ffc00, 0x3ff00000, 0xc0000000, TrueColor},
+};
+
+const EGLShimFormat *
+egl_format_find(uint32_t gbm_fourcc)
+{
+  int i;
+
+  for (i = 0; i < ARRAY_SIZE(formats); i++)
+  {
+    if (formats[i].gbm_fourcc == gbm_fourcc)
+      return &formats[i];
+  }
+
+  return NULL;
+}
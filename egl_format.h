@@ -0,0 +1,43 @@
+/*
+ * egl_format.h
+ *
+ * Copyright (C) 2020 Ivaylo Dimitrov <ivo.g.dimitrov.75@gmail.com>
+ *
+ * This library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef EGL_FORMAT_H
+#define EGL_FORMAT_H
+
+#include <stdint.h>
+
+#include "defs.h"
+
+/* masks are in X visual terms, that is - within a little endian pixel */
+struct _EGLShimFormat
+{
+  uint32_t gbm_fourcc;
+  int depth;
+  int bpp;
+  uint32_t red_mask;
+  uint32_t green_mask;
+  uint32_t blue_mask;
+  uint32_t alpha_mask;
+  int visual_class;
+};
+
+const EGLShimFormat *
+egl_format_find(uint32_t gbm_fourcc);
+
+#endif // EGL_FORMAT_H
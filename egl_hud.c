@@ -0,0 +1,873 @@
+/*
+ * egl_hud.c
+ *
+ * Copyright (C) 2020 Ivaylo Dimitrov <ivo.g.dimitrov.75@gmail.com>
+ *
+ * This library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <GLES2/gl2.h>
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "egl_hud.h"
+#include "egl_log.h"
+#include "list.h"
+
+#define HUD_FPS (1 << 0)
+#define HUD_FRAMETIME (1 << 1)
+#define HUD_BUFFERS (1 << 2)
+#define HUD_STALLS (1 << 3)
+#define HUD_ALL (HUD_FPS | HUD_FRAMETIME | HUD_BUFFERS | HUD_STALLS)
+
+/* 5x7 glyphs in 6x8 cells, drawn at twice the size */
+#define GLYPH_W 5
+#define GLYPH_H 7
+#define CELL_W 6
+#define CELL_H 8
+#define SCALE 2
+#define ATLAS_W 256
+#define ATLAS_H CELL_H
+
+#define MARGIN 8
+#define LINE_H ((CELL_H + 2) * SCALE)
+#define GRAPH_FRAMES 120
+#define GRAPH_BAR_W 2
+#define GRAPH_H 48
+#define GRAPH_FULL_SCALE_NS 50000000ULL
+#define FPS_INTERVAL_NS 500000000ULL
+#define MAX_QUADS 512
+
+#define ATTRIB_POS 0
+#define ATTRIB_UV 1
+#define ATTRIB_COLOR 2
+
+/*
+ * ES3 and GL_OES_vertex_array_object enums. Only the GLES2 headers are used
+ * and the entry points are looked up, libGLESv2 may well be ES2 only.
+ */
+#define HUD_VERTEX_ARRAY_BINDING 0x85B5
+#define HUD_SAMPLER_BINDING 0x8919
+#define HUD_PIXEL_UNPACK_BUFFER 0x88EC
+#define HUD_PIXEL_UNPACK_BUFFER_BINDING 0x88EF
+#define HUD_UNPACK_ROW_LENGTH 0x0CF2
+#define HUD_UNPACK_SKIP_ROWS 0x0CF3
+#define HUD_UNPACK_SKIP_PIXELS 0x0CF4
+
+typedef void (*HudGenVertexArrays)(GLsizei n, GLuint *arrays);
+typedef void (*HudBindVertexArray)(GLuint array);
+typedef void (*HudBindSampler)(GLuint unit, GLuint sampler);
+
+typedef enum
+{
+  HUD_GL_ES2,
+  HUD_GL_ES2_OES_VAO,   /* the app's VAO binding is saved, we draw on 0 */
+  HUD_GL_ES3            /* we draw with our own VAO, samplers exist */
+} HudGLMode;
+
+static struct
+{
+  Bool looked_up;
+  HudGenVertexArrays gen_vertex_arrays;
+  HudBindVertexArray bind_vertex_array;
+  HudBindSampler bind_sampler;
+  HudBindVertexArray bind_vertex_array_oes;
+} procs;
+
+typedef struct
+{
+  GLfloat x, y;
+  GLfloat u, v;
+  GLubyte rgba[4];
+} HudVertex;
+
+/* names are per context, so are the objects made from them */
+typedef struct
+{
+  EGLContext ctx;
+  HudGLMode mode;
+  GLuint program;
+  GLuint vbo;
+  GLuint vao;
+  GLuint atlas;
+  GLint scale_loc;
+  Bool broken;
+} HudContext;
+
+struct _EGLShimHud
+{
+  uint32_t width;
+  uint32_t height;
+  slist *contexts;
+  uint64_t last_ns;
+  uint64_t fps_start_ns;
+  uint32_t fps_frames;
+  float fps;
+  uint64_t frame_ns[GRAPH_FRAMES];
+  uint32_t frame;
+  HudVertex vertices[MAX_QUADS * 6];
+  int nvertices;
+};
+
+typedef struct
+{
+  GLint program;
+  GLint array_buffer;
+  GLint active_texture;
+  GLint texture;
+  GLint framebuffer;
+  GLint viewport[4];
+  GLboolean blend;
+  GLboolean depth_test;
+  GLboolean stencil_test;
+  GLboolean scissor_test;
+  GLboolean cull_face;
+  GLboolean color_mask[4];
+  GLint blend_src_rgb, blend_dst_rgb, blend_src_alpha, blend_dst_alpha;
+  GLint blend_eq_rgb, blend_eq_alpha;
+  /* ES3 or GL_OES_vertex_array_object only */
+  GLint vao;
+  GLint sampler;
+  struct
+  {
+    GLint enabled, size, type, normalized, stride, buffer;
+    GLvoid *pointer;
+  } attribs[3];
+} HudGLState;
+
+static const char glyph_chars[] = " 0123456789.:/ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+/* one byte per row, bit 4 is the leftmost pixel */
+static const uint8_t glyphs[][GLYPH_H] =
+{
+  {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, /*   */
+  {0x0e, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0e}, /* 0 */
+  {0x04, 0x0c, 0x04, 0x04, 0x04, 0x04, 0x0e}, /* 1 */
+  {0x0e, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1f}, /* 2 */
+  {0x1f, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0e}, /* 3 */
+  {0x02, 0x06, 0x0a, 0x12, 0x1f, 0x02, 0x02}, /* 4 */
+  {0x1f, 0x10, 0x1e, 0x01, 0x01, 0x11, 0x0e}, /* 5 */
+  {0x06, 0x08, 0x10, 0x1e, 0x11, 0x11, 0x0e}, /* 6 */
+  {0x1f, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08}, /* 7 */
+  {0x0e, 0x11, 0x11, 0x0e, 0x11, 0x11, 0x0e}, /* 8 */
+  {0x0e, 0x11, 0x11, 0x0f, 0x01, 0x02, 0x0c}, /* 9 */
+  {0x00, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x0c}, /* . */
+  {0x00, 0x0c, 0x0c, 0x00, 0x0c, 0x0c, 0x00}, /* : */
+  {0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00}, /* / */
+  {0x0e, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11}, /* A */
+  {0x1e, 0x11, 0x11, 0x1e, 0x11, 0x11, 0x1e}, /* B */
+  {0x0e, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0e}, /* C */
+  {0x1c, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1c}, /* D */
+  {0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x1f}, /* E */
+  {0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x10}, /* F */
+  {0x0e, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0f}, /* G */
+  {0x11, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11}, /* H */
+  {0x0e, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0e}, /* I */
+  {0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0c}, /* J */
+  {0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11}, /* K */
+  {0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1f}, /* L */
+  {0x11, 0x1b, 0x15, 0x15, 0x11, 0x11, 0x11}, /* M */
+  {0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11}, /* N */
+  {0x0e, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e}, /* O */
+  {0x1e, 0x11, 0x11, 0x1e, 0x10, 0x10, 0x10}, /* P */
+  {0x0e, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0d}, /* Q */
+  {0x1e, 0x11, 0x11, 0x1e, 0x14, 0x12, 0x11}, /* R */
+  {0x0f, 0x10, 0x10, 0x0e, 0x01, 0x01, 0x1e}, /* S */
+  {0x1f, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04}, /* T */
+  {0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e}, /* U */
+  {0x11, 0x11, 0x11, 0x11, 0x11, 0x0a, 0x04}, /* V */
+  {0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0a}, /* W */
+  {0x11, 0x11, 0x0a, 0x04, 0x0a, 0x11, 0x11}, /* X */
+  {0x11, 0x11, 0x11, 0x0a, 0x04, 0x04, 0x04}, /* Y */
+  {0x1f, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1f}, /* Z */
+};
+
+/* the cell after the glyphs is solid, for untextured quads */
+#define SOLID_CELL (sizeof(glyphs) / sizeof(glyphs[0]))
+
+static const char *vertex_shader =
+  "attribute vec2 pos;\n"
+  "attribute vec2 uv;\n"
+  "attribute vec4 color;\n"
+  "uniform vec2 scale;\n"
+  "varying vec2 v_uv;\n"
+  "varying vec4 v_color;\n"
+  "void main()\n"
+  "{\n"
+  "  v_uv = uv;\n"
+  "  v_color = color;\n"
+  "  gl_Position = vec4(pos * scale + vec2(-1.0, 1.0), 0.0, 1.0);\n"
+  "}\n";
+
+static const char *fragment_shader =
+  "precision mediump float;\n"
+  "uniform sampler2D atlas;\n"
+  "varying vec2 v_uv;\n"
+  "varying vec4 v_color;\n"
+  "void main()\n"
+  "{\n"
+  "  gl_FragColor = vec4(v_color.rgb,\n"
+  "                      v_color.a * texture2D(atlas, v_uv).a);\n"
+  "}\n";
+
+static const GLubyte white[4] = {255, 255, 255, 255};
+static const GLubyte green[4] = {64, 255, 64, 255};
+static const GLubyte yellow[4] = {255, 220, 64, 255};
+static const GLubyte red[4] = {255, 64, 64, 255};
+static const GLubyte shade[4] = {0, 0, 0, 160};
+
+static int hud_items = -1;
+
+static uint64_t
+get_time_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int
+parse_items(const char *spec)
+{
+  static const char *names[] = {"fps", "frametime", "buffers", "stalls"};
+  int items = 0;
+
+  if (!spec || !*spec || !strcmp(spec, "0"))
+    return 0;
+
+  if (!strcmp(spec, "1"))
+    return HUD_ALL;
+
+  while (*spec)
+  {
+    size_t len = strcspn(spec, ",");
+    int i;
+
+    for (i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+    {
+      if (strlen(names[i]) == len && !strncmp(spec, names[i], len))
+        items |= 1 << i;
+    }
+
+    spec += len;
+
+    if (*spec)
+      spec++;
+  }
+
+  return items;
+}
+
+EGLShimHud *
+egl_hud_create(uint32_t width, uint32_t height)
+{
+  EGLShimHud *hud;
+
+  if (hud_items == -1)
+    hud_items = parse_items(getenv("EGL_SHIM_HUD"));
+
+  if (!hud_items)
+    return NULL;
+
+  hud = calloc(sizeof(EGLShimHud), 1);
+  hud->width = width;
+  hud->height = height;
+
+  return hud;
+}
+
+void
+egl_hud_destroy(EGLShimHud *hud)
+{
+  slist *l = hud->contexts;
+
+  while (l)
+  {
+    slist *next = l->next;
+
+    free(l->data);
+    free(l);
+    l = next;
+  }
+
+  free(hud);
+}
+
+static int
+match_context(const void *data, const void *user_data)
+{
+  const HudContext *hc = data;
+
+  return hc->ctx == (EGLContext)user_data;
+}
+
+void
+egl_hud_forget_context(EGLShimHud *hud, EGLContext ctx)
+{
+  slist *l = slist_find(hud->contexts, match_context, ctx);
+
+  if (l)
+    hud->contexts = slist_remove(hud->contexts, l->data, free);
+}
+
+static void
+lookup_procs(void)
+{
+  if (procs.looked_up)
+    return;
+
+  procs.gen_vertex_arrays =
+      (HudGenVertexArrays)eglGetProcAddress("glGenVertexArrays");
+  procs.bind_vertex_array =
+      (HudBindVertexArray)eglGetProcAddress("glBindVertexArray");
+  procs.bind_sampler = (HudBindSampler)eglGetProcAddress("glBindSampler");
+  procs.bind_vertex_array_oes =
+      (HudBindVertexArray)eglGetProcAddress("glBindVertexArrayOES");
+  procs.looked_up = True;
+}
+
+/* what the current context can do, lookups may succeed for any name */
+static HudGLMode
+get_mode(void)
+{
+  const char *version = (const char *)glGetString(GL_VERSION);
+  const char *extensions = (const char *)glGetString(GL_EXTENSIONS);
+
+  if (version && !strncmp(version, "OpenGL ES ", 10) &&
+      version[10] >= '3' && version[10] <= '9' && procs.gen_vertex_arrays &&
+      procs.bind_vertex_array && procs.bind_sampler)
+  {
+    return HUD_GL_ES3;
+  }
+
+  if (extensions && strstr(extensions, "GL_OES_vertex_array_object") &&
+      procs.bind_vertex_array_oes)
+  {
+    return HUD_GL_ES2_OES_VAO;
+  }
+
+  return HUD_GL_ES2;
+}
+
+static HudContext *
+get_context(EGLShimHud *hud, EGLContext ctx)
+{
+  slist *l = slist_find(hud->contexts, match_context, ctx);
+  HudContext *hc;
+
+  if (l)
+    return l->data;
+
+  lookup_procs();
+  hc = calloc(sizeof(HudContext), 1);
+  hc->ctx = ctx;
+  hc->mode = get_mode();
+  hud->contexts = slist_append(hud->contexts, hc);
+
+  return hc;
+}
+
+static GLuint
+compile_shader(GLenum type, const char *source)
+{
+  GLuint shader = glCreateShader(type);
+  GLint ok = 0;
+
+  glShaderSource(shader, 1, &source, NULL);
+  glCompileShader(shader);
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+
+  if (!ok)
+  {
+    char log[256];
+
+    glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+    LOG_ERROR(SURFACE, "HUD shader: %s", log);
+    glDeleteShader(shader);
+
+    return 0;
+  }
+
+  return shader;
+}
+
+static void
+upload_atlas(Bool es3)
+{
+  GLubyte pixels[ATLAS_H][ATLAS_W];
+  GLint alignment, unpack_buffer = 0, row_length = 0, skip_rows = 0;
+  GLint skip_pixels = 0;
+  int i, x, y;
+
+  memset(pixels, 0, sizeof(pixels));
+
+  for (i = 0; i < SOLID_CELL; i++)
+  {
+    for (y = 0; y < GLYPH_H; y++)
+    {
+      for (x = 0; x < GLYPH_W; x++)
+      {
+        if (glyphs[i][y] & (0x10 >> x))
+          pixels[y][i * CELL_W + x] = 255;
+      }
+    }
+  }
+
+  for (y = 0; y < CELL_H; y++)
+    memset(&pixels[y][SOLID_CELL * CELL_W], 255, CELL_W);
+
+  glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+  /* a bound unpack buffer would turn pixels into an offset into it */
+  if (es3)
+  {
+    glGetIntegerv(HUD_PIXEL_UNPACK_BUFFER_BINDING, &unpack_buffer);
+    glGetIntegerv(HUD_UNPACK_ROW_LENGTH, &row_length);
+    glGetIntegerv(HUD_UNPACK_SKIP_ROWS, &skip_rows);
+    glGetIntegerv(HUD_UNPACK_SKIP_PIXELS, &skip_pixels);
+    glBindBuffer(HUD_PIXEL_UNPACK_BUFFER, 0);
+    glPixelStorei(HUD_UNPACK_ROW_LENGTH, 0);
+    glPixelStorei(HUD_UNPACK_SKIP_ROWS, 0);
+    glPixelStorei(HUD_UNPACK_SKIP_PIXELS, 0);
+  }
+
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, ATLAS_W, ATLAS_H, 0, GL_ALPHA,
+               GL_UNSIGNED_BYTE, pixels);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+
+  if (es3)
+  {
+    glBindBuffer(HUD_PIXEL_UNPACK_BUFFER, unpack_buffer);
+    glPixelStorei(HUD_UNPACK_ROW_LENGTH, row_length);
+    glPixelStorei(HUD_UNPACK_SKIP_ROWS, skip_rows);
+    glPixelStorei(HUD_UNPACK_SKIP_PIXELS, skip_pixels);
+  }
+
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+/* for the vertex buffer bound to GL_ARRAY_BUFFER */
+static void
+setup_attribs(void)
+{
+  int i;
+
+  for (i = 0; i < 3; i++)
+    glEnableVertexAttribArray(i);
+
+  glVertexAttribPointer(ATTRIB_POS, 2, GL_FLOAT, GL_FALSE, sizeof(HudVertex),
+                        (void *)offsetof(HudVertex, x));
+  glVertexAttribPointer(ATTRIB_UV, 2, GL_FLOAT, GL_FALSE, sizeof(HudVertex),
+                        (void *)offsetof(HudVertex, u));
+  glVertexAttribPointer(ATTRIB_COLOR, 4, GL_UNSIGNED_BYTE, GL_TRUE,
+                        sizeof(HudVertex), (void *)offsetof(HudVertex, rgba));
+}
+
+/* called with the state saved, so it can change bindings freely */
+static Bool
+init_gl(HudContext *hc)
+{
+  GLuint vs = compile_shader(GL_VERTEX_SHADER, vertex_shader);
+  GLuint fs = compile_shader(GL_FRAGMENT_SHADER, fragment_shader);
+  GLint ok = 0;
+
+  if (vs && fs)
+  {
+    hc->program = glCreateProgram();
+    glAttachShader(hc->program, vs);
+    glAttachShader(hc->program, fs);
+    glBindAttribLocation(hc->program, ATTRIB_POS, "pos");
+    glBindAttribLocation(hc->program, ATTRIB_UV, "uv");
+    glBindAttribLocation(hc->program, ATTRIB_COLOR, "color");
+    glLinkProgram(hc->program);
+    glGetProgramiv(hc->program, GL_LINK_STATUS, &ok);
+  }
+
+  glDeleteShader(vs);
+  glDeleteShader(fs);
+
+  if (!ok)
+  {
+    LOG_ERROR(SURFACE, "failed to build the HUD program");
+    glDeleteProgram(hc->program);
+    hc->program = 0;
+
+    return False;
+  }
+
+  glUseProgram(hc->program);
+  glUniform1i(glGetUniformLocation(hc->program, "atlas"), 0);
+  hc->scale_loc = glGetUniformLocation(hc->program, "scale");
+
+  glGenBuffers(1, &hc->vbo);
+  glGenTextures(1, &hc->atlas);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, hc->atlas);
+  upload_atlas(hc->mode == HUD_GL_ES3);
+
+  /* our own vertex array leaves the app's VAOs alone */
+  if (hc->mode == HUD_GL_ES3)
+  {
+    procs.gen_vertex_arrays(1, &hc->vao);
+    procs.bind_vertex_array(hc->vao);
+    glBindBuffer(GL_ARRAY_BUFFER, hc->vbo);
+    setup_attribs();
+  }
+
+  return True;
+}
+
+static void
+save_state(HudGLState *st, HudGLMode mode)
+{
+  int i;
+
+  glGetIntegerv(GL_CURRENT_PROGRAM, &st->program);
+  glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &st->array_buffer);
+  glGetIntegerv(GL_ACTIVE_TEXTURE, &st->active_texture);
+  glActiveTexture(GL_TEXTURE0);
+  glGetIntegerv(GL_TEXTURE_BINDING_2D, &st->texture);
+
+  if (mode != HUD_GL_ES2)
+    glGetIntegerv(HUD_VERTEX_ARRAY_BINDING, &st->vao);
+
+  if (mode == HUD_GL_ES3)
+    glGetIntegerv(HUD_SAMPLER_BINDING, &st->sampler);
+
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &st->framebuffer);
+  glGetIntegerv(GL_VIEWPORT, st->viewport);
+  st->blend = glIsEnabled(GL_BLEND);
+  st->depth_test = glIsEnabled(GL_DEPTH_TEST);
+  st->stencil_test = glIsEnabled(GL_STENCIL_TEST);
+  st->scissor_test = glIsEnabled(GL_SCISSOR_TEST);
+  st->cull_face = glIsEnabled(GL_CULL_FACE);
+  glGetBooleanv(GL_COLOR_WRITEMASK, st->color_mask);
+  glGetIntegerv(GL_BLEND_SRC_RGB, &st->blend_src_rgb);
+  glGetIntegerv(GL_BLEND_DST_RGB, &st->blend_dst_rgb);
+  glGetIntegerv(GL_BLEND_SRC_ALPHA, &st->blend_src_alpha);
+  glGetIntegerv(GL_BLEND_DST_ALPHA, &st->blend_dst_alpha);
+  glGetIntegerv(GL_BLEND_EQUATION_RGB, &st->blend_eq_rgb);
+  glGetIntegerv(GL_BLEND_EQUATION_ALPHA, &st->blend_eq_alpha);
+
+  if (mode == HUD_GL_ES3)
+    return;
+
+  /* the attributes we change are those of the default vertex array */
+  if (mode == HUD_GL_ES2_OES_VAO)
+    procs.bind_vertex_array_oes(0);
+
+  for (i = 0; i < 3; i++)
+  {
+    glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_ENABLED,
+                        &st->attribs[i].enabled);
+    glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_SIZE, &st->attribs[i].size);
+    glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_TYPE, &st->attribs[i].type);
+    glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_NORMALIZED,
+                        &st->attribs[i].normalized);
+    glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_STRIDE,
+                        &st->attribs[i].stride);
+    glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_BUFFER_BINDING,
+                        &st->attribs[i].buffer);
+    glGetVertexAttribPointerv(i, GL_VERTEX_ATTRIB_ARRAY_POINTER,
+                              &st->attribs[i].pointer);
+  }
+}
+
+static void
+set_enabled(GLenum cap, GLboolean enabled)
+{
+  if (enabled)
+    glEnable(cap);
+  else
+    glDisable(cap);
+}
+
+static void
+restore_state(const HudGLState *st, HudGLMode mode)
+{
+  int i;
+
+  if (mode == HUD_GL_ES3)
+  {
+    procs.bind_vertex_array(st->vao);
+    procs.bind_sampler(0, st->sampler);
+  }
+  else
+  {
+    for (i = 0; i < 3; i++)
+    {
+      glBindBuffer(GL_ARRAY_BUFFER, st->attribs[i].buffer);
+      glVertexAttribPointer(i, st->attribs[i].size, st->attribs[i].type,
+                            st->attribs[i].normalized, st->attribs[i].stride,
+                            st->attribs[i].pointer);
+
+      if (st->attribs[i].enabled)
+        glEnableVertexAttribArray(i);
+      else
+        glDisableVertexAttribArray(i);
+    }
+
+    if (mode == HUD_GL_ES2_OES_VAO)
+      procs.bind_vertex_array_oes(st->vao);
+  }
+
+  glUseProgram(st->program);
+  glBindBuffer(GL_ARRAY_BUFFER, st->array_buffer);
+  glBindTexture(GL_TEXTURE_2D, st->texture);
+  glActiveTexture(st->active_texture);
+  glBindFramebuffer(GL_FRAMEBUFFER, st->framebuffer);
+  glViewport(st->viewport[0], st->viewport[1], st->viewport[2],
+             st->viewport[3]);
+  set_enabled(GL_BLEND, st->blend);
+  set_enabled(GL_DEPTH_TEST, st->depth_test);
+  set_enabled(GL_STENCIL_TEST, st->stencil_test);
+  set_enabled(GL_SCISSOR_TEST, st->scissor_test);
+  set_enabled(GL_CULL_FACE, st->cull_face);
+  glColorMask(st->color_mask[0], st->color_mask[1], st->color_mask[2],
+              st->color_mask[3]);
+  glBlendFuncSeparate(st->blend_src_rgb, st->blend_dst_rgb,
+                      st->blend_src_alpha, st->blend_dst_alpha);
+  glBlendEquationSeparate(st->blend_eq_rgb, st->blend_eq_alpha);
+}
+
+static void
+add_quad(EGLShimHud *hud, float x, float y, float w, float h, int cell,
+         const GLubyte *rgba)
+{
+  float u0 = (float)(cell * CELL_W) / ATLAS_W;
+  float u1 = (float)(cell * CELL_W + GLYPH_W) / ATLAS_W;
+  float v1 = (float)GLYPH_H / ATLAS_H;
+  HudVertex quad[4] =
+  {
+    {x, y, u0, 0},
+    {x + w, y, u1, 0},
+    {x, y + h, u0, v1},
+    {x + w, y + h, u1, v1}
+  };
+  static const int order[6] = {0, 1, 2, 2, 1, 3};
+  int i;
+
+  if (hud->nvertices + 6 > MAX_QUADS * 6)
+    return;
+
+  /* sample the middle of the solid cell, nowhere near the glyphs */
+  if (cell == SOLID_CELL)
+  {
+    for (i = 0; i < 4; i++)
+    {
+      quad[i].u = (SOLID_CELL * CELL_W + CELL_W / 2.0f) / ATLAS_W;
+      quad[i].v = 0.5f;
+    }
+  }
+
+  for (i = 0; i < 6; i++)
+  {
+    HudVertex *v = &hud->vertices[hud->nvertices++];
+
+    *v = quad[order[i]];
+    memcpy(v->rgba, rgba, 4);
+  }
+}
+
+static void
+add_text(EGLShimHud *hud, float x, float y, const char *text,
+         const GLubyte *rgba)
+{
+  for (; *text; text++, x += CELL_W * SCALE)
+  {
+    const char *c = strchr(glyph_chars, *text);
+
+    if (c && *c != ' ')
+    {
+      add_quad(hud, x, y, GLYPH_W * SCALE, GLYPH_H * SCALE, c - glyph_chars,
+               rgba);
+    }
+  }
+}
+
+static void
+add_graph(EGLShimHud *hud, float x, float y)
+{
+  int i;
+
+  add_quad(hud, x, y, GRAPH_FRAMES * GRAPH_BAR_W, GRAPH_H, SOLID_CELL, shade);
+
+  for (i = 0; i < GRAPH_FRAMES; i++)
+  {
+    uint64_t ns = hud->frame_ns[(hud->frame + i) % GRAPH_FRAMES];
+    const GLubyte *rgba = ns > 33000000 ? red : ns > 17000000 ? yellow : green;
+    float h;
+
+    if (ns > GRAPH_FULL_SCALE_NS)
+      ns = GRAPH_FULL_SCALE_NS;
+
+    h = (float)GRAPH_H * ns / GRAPH_FULL_SCALE_NS;
+
+    if (h > 0)
+    {
+      add_quad(hud, x + i * GRAPH_BAR_W, y + GRAPH_H - h, GRAPH_BAR_W - 1, h,
+               SOLID_CELL, rgba);
+    }
+  }
+}
+
+static void
+update_stats(EGLShimHud *hud)
+{
+  uint64_t now = get_time_ns();
+
+  if (hud->last_ns)
+  {
+    hud->frame_ns[hud->frame % GRAPH_FRAMES] = now - hud->last_ns;
+    hud->frame++;
+  }
+  else
+    hud->fps_start_ns = now;
+
+  hud->last_ns = now;
+  hud->fps_frames++;
+
+  if (now - hud->fps_start_ns >= FPS_INTERVAL_NS)
+  {
+    hud->fps = hud->fps_frames * 1e9f / (now - hud->fps_start_ns);
+    hud->fps_start_ns = now;
+    hud->fps_frames = 0;
+  }
+}
+
+static void
+build(EGLShimHud *hud, uint32_t buffers, uint64_t stalls)
+{
+  float x = MARGIN, y = MARGIN;
+  char line[32];
+  int lines = 0;
+
+  hud->nvertices = 0;
+
+  lines += !!(hud_items & HUD_FPS);
+  lines += !!(hud_items & HUD_FRAMETIME);
+  lines += !!(hud_items & HUD_BUFFERS);
+  lines += !!(hud_items & HUD_STALLS);
+
+  /* backdrop for the text, the graph brings its own */
+  if (lines - !!(hud_items & HUD_FRAMETIME))
+  {
+    add_quad(hud, x - 4, y - 4, 15 * CELL_W * SCALE + 8,
+             (lines - !!(hud_items & HUD_FRAMETIME)) * LINE_H + 4,
+             SOLID_CELL, shade);
+  }
+
+  if (hud_items & HUD_FPS)
+  {
+    snprintf(line, sizeof(line), "FPS %.1f", hud->fps);
+    add_text(hud, x, y, line, white);
+    y += LINE_H;
+  }
+
+  if (hud_items & HUD_BUFFERS)
+  {
+    snprintf(line, sizeof(line), "BUFFERS %u", buffers);
+    add_text(hud, x, y, line, white);
+    y += LINE_H;
+  }
+
+  if (hud_items & HUD_STALLS)
+  {
+    snprintf(line, sizeof(line), "STALLS %llu", (unsigned long long)stalls);
+    add_text(hud, x, y, line, stalls ? red : white);
+    y += LINE_H;
+  }
+
+  if (hud_items & HUD_FRAMETIME)
+  {
+    uint64_t last = hud->frame_ns[(hud->frame + GRAPH_FRAMES - 1) %
+        GRAPH_FRAMES];
+
+    snprintf(line, sizeof(line), "FRAME %.1f MS", last / 1e6);
+    add_text(hud, x, y + 4, line, white);
+    add_graph(hud, x, y + LINE_H + 4);
+  }
+}
+
+void
+egl_hud_draw(EGLShimHud *hud, EGLContext ctx, uint32_t buffers,
+             uint64_t stalls)
+{
+  HudContext *hc = get_context(hud, ctx);
+  HudGLState st;
+
+  if (hc->broken)
+    return;
+
+  update_stats(hud);
+  build(hud, buffers, stalls);
+
+  if (!hud->nvertices)
+    return;
+
+  save_state(&st, hc->mode);
+
+  if (!hc->program)
+  {
+    if (!init_gl(hc))
+    {
+      /* no point in failing the same way every frame */
+      hc->broken = True;
+      restore_state(&st, hc->mode);
+      return;
+    }
+  }
+
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glViewport(0, 0, hud->width, hud->height);
+  glDisable(GL_DEPTH_TEST);
+  glDisable(GL_STENCIL_TEST);
+  glDisable(GL_SCISSOR_TEST);
+  glDisable(GL_CULL_FACE);
+  glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+  glEnable(GL_BLEND);
+  glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ZERO, GL_ONE);
+  glBlendEquation(GL_FUNC_ADD);
+
+  glUseProgram(hc->program);
+  glUniform2f(hc->scale_loc, 2.0f / hud->width, -2.0f / hud->height);
+  glBindTexture(GL_TEXTURE_2D, hc->atlas);
+
+  /* everything in one upload and one draw */
+  glBindBuffer(GL_ARRAY_BUFFER, hc->vbo);
+  glBufferData(GL_ARRAY_BUFFER, hud->nvertices * sizeof(HudVertex),
+               hud->vertices, GL_STREAM_DRAW);
+
+  if (hc->mode == HUD_GL_ES3)
+  {
+    procs.bind_vertex_array(hc->vao);
+    procs.bind_sampler(0, 0);
+  }
+  else
+    setup_attribs();
+
+  glDrawArrays(GL_TRIANGLES, 0, hud->nvertices);
+
+  restore_state(&st, hc->mode);
+}
@@ -0,0 +1,67 @@
+/*
+ * egl_hud.h
+ *
+ * Copyright (C) 2020 Ivaylo Dimitrov <ivo.g.dimitrov.75@gmail.com>
+ *
+ * This library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Diagnostics overlay drawn into the frame the application is about to swap,
+ * enabled with EGL_SHIM_HUD, a comma separated list of
+ *
+ *   fps         frames per second, averaged over half a second
+ *   frametime   graph of the last frame times, 50 ms full scale
+ *   buffers     buffers held by the shim (on screen or queued)
+ *   stalls      buffers taken back after the server did not return them
+ *
+ * or 1 for all of them. Drawn with GLES2 in the application's context, with
+ * the GL state the overlay touches saved and restored around it. On ES3
+ * contexts the overlay has a vertex array of its own, and the VAO, sampler and
+ * pixel unpack bindings are restored as well, with GL_OES_vertex_array_object
+ * the VAO binding. ES3 entry points are looked up at run time, the shim links
+ * against ES2 only libraries too. GL objects are created once per context the
+ * surface is drawn with.
+ */
+
+#ifndef EGL_HUD_H
+#define EGL_HUD_H
+
+#include <stdint.h>
+
+#include <EGL/egl.h>
+
+#include "defs.h"
+
+/* NULL if EGL_SHIM_HUD is not set */
+EGLShimHud *
+egl_hud_create(uint32_t width, uint32_t height);
+
+/*
+ * GL objects are not deleted, there is no telling if the context they were
+ * created in is still current.
+ */
+void
+egl_hud_destroy(EGLShimHud *hud);
+
+/* must be called with ctx, the current context, before the swap */
+void
+egl_hud_draw(EGLShimHud *hud, EGLContext ctx, uint32_t buffers,
+             uint64_t stalls);
+
+/* ctx is going away, its GL objects go with it */
+void
+egl_hud_forget_context(EGLShimHud *hud, EGLContext ctx);
+
+#endif // EGL_HUD_H
@@ -0,0 +1,515 @@
+/*
+ * egl_log.c
+ *
+ * Copyright (C) 2020 Ivaylo Dimitrov <ivo.g.dimitrov.75@gmail.com>
+ *
+ * This library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "egl_log.h"
+
+/* per thread, a message takes its length plus 16 bytes */
+#define RING_SIZE 65536
+#define MAX_MESSAGE 256
+#define DRAIN_INTERVAL_NS 50000000
+/* errors and warnings a call site may log per second */
+#define RATE_LIMIT_BURST 10
+#define RATE_LIMIT_WINDOW_NS 1000000000ULL
+
+typedef struct
+{
+  uint64_t time_ns;
+  uint32_t tid;
+  uint16_t len;
+  uint8_t level;
+  uint8_t cat;
+} EGLLogRecord;
+
+typedef struct _EGLLogRing EGLLogRing;
+
+/*
+ * Single producer (the owning thread) and single consumer (whoever holds
+ * drain_mutex). Rings are never freed, a ring whose thread exited is handed
+ * to the next new thread.
+ */
+struct _EGLLogRing
+{
+  EGLLogRing *next;
+  int owned;
+  uint64_t head;
+  uint64_t tail;
+  uint64_t dropped;
+  uint64_t dropped_reported;
+  char data[RING_SIZE];
+};
+
+uint8_t egl_log_levels[EGL_LOG_CAT_COUNT];
+
+static const char *level_names[] =
+{
+  "none", "error", "warn", "info", "debug"
+};
+
+static const char *cat_names[EGL_LOG_CAT_COUNT] =
+{
+  "display", "surface", "present", "shm"
+};
+
+static EGLLogRing *rings;
+static __thread EGLLogRing *thread_ring;
+/* looked up once per thread, with the ring, not per message */
+static __thread uint32_t thread_tid;
+static pthread_key_t ring_key;
+static pthread_once_t drain_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t drain_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+#define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
+
+static uint64_t
+get_time_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int
+parse_level(const char *s, size_t len)
+{
+  int i;
+
+  for (i = 0; i < ARRAY_SIZE(level_names); i++)
+  {
+    if (strlen(level_names[i]) == len && !strncasecmp(s, level_names[i], len))
+      return i;
+  }
+
+  return -1;
+}
+
+static void
+parse_item(const char *item, size_t len)
+{
+  const char *eq = memchr(item, '=', len);
+  int level, i;
+
+  if (!eq)
+  {
+    if ((level = parse_level(item, len)) == -1)
+      goto bad;
+
+    memset(egl_log_levels, level, sizeof(egl_log_levels));
+
+    return;
+  }
+
+  if ((level = parse_level(eq + 1, item + len - eq - 1)) == -1)
+    goto bad;
+
+  for (i = 0; i < EGL_LOG_CAT_COUNT; i++)
+  {
+    if (strlen(cat_names[i]) == eq - item &&
+        !strncasecmp(item, cat_names[i], eq - item))
+    {
+      egl_log_levels[i] = level;
+      return;
+    }
+  }
+
+bad:
+  fprintf(stderr, "EGL_SHIM_LOG: ignoring \"%.*s\"\n", (int)len, item);
+}
+
+static void
+write_out(const char *buf, size_t len)
+{
+  while (len)
+  {
+    ssize_t n = write(STDERR_FILENO, buf, len);
+
+    if (n <= 0)
+      break;
+
+    buf += n;
+    len -= n;
+  }
+}
+
+/* makes room for one more line in out */
+static void
+reserve_line(char *out, size_t size, size_t *used)
+{
+  if (size - *used < MAX_MESSAGE + 128)
+  {
+    write_out(out, *used);
+    *used = 0;
+  }
+}
+
+static void
+drain_ring(EGLLogRing *ring, char *out, size_t size, size_t *used)
+{
+  uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  uint64_t dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+  uint64_t tail = ring->tail;
+
+  while (tail != head)
+  {
+    EGLLogRecord rec;
+    char text[MAX_MESSAGE];
+    uint32_t pos;
+    int n;
+
+    /* records never wrap, the writer skips the end of the buffer instead */
+    pos = tail % RING_SIZE;
+
+    if (RING_SIZE - pos < sizeof(rec))
+    {
+      tail += RING_SIZE - pos;
+      continue;
+    }
+
+    memcpy(&rec, ring->data + pos, sizeof(rec));
+
+    if (!rec.len)
+    {
+      /* padding up to the end of the buffer */
+      tail += RING_SIZE - pos;
+      continue;
+    }
+
+    memcpy(text, ring->data + pos + sizeof(rec), rec.len);
+    tail += sizeof(rec) + rec.len;
+
+    reserve_line(out, size, used);
+    n = snprintf(out + *used, size - *used,
+                 "egl_shim %llu.%06llu %u %s %s: %.*s\n",
+                 (unsigned long long)(rec.time_ns / 1000000000ULL),
+                 (unsigned long long)(rec.time_ns % 1000000000ULL / 1000),
+                 rec.tid, level_names[rec.level], cat_names[rec.cat],
+                 (int)rec.len, text);
+    *used += n;
+  }
+
+  __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+  if (dropped != ring->dropped_reported)
+  {
+    reserve_line(out, size, used);
+    *used += snprintf(out + *used, size - *used,
+                      "egl_shim: %llu messages lost, log ring full\n",
+                      (unsigned long long)(dropped - ring->dropped_reported));
+    ring->dropped_reported = dropped;
+  }
+}
+
+/* drain_mutex held */
+static void
+drain_rings(void)
+{
+  char out[4096];
+  size_t used = 0;
+  EGLLogRing *ring;
+
+  for (ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring;
+       ring = ring->next)
+  {
+    drain_ring(ring, out, sizeof(out), &used);
+  }
+
+  write_out(out, used);
+}
+
+void
+egl_log_flush(void)
+{
+  pthread_mutex_lock(&drain_mutex);
+  drain_rings();
+  pthread_mutex_unlock(&drain_mutex);
+}
+
+static void *
+drain_thread(void *arg)
+{
+  struct timespec interval = {0, DRAIN_INTERVAL_NS};
+
+  for (;;)
+  {
+    nanosleep(&interval, NULL);
+    egl_log_flush();
+  }
+
+  return NULL;
+}
+
+static void
+start_drain_thread(void)
+{
+  pthread_attr_t attr;
+  pthread_t thread;
+
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+  if (pthread_create(&thread, &attr, drain_thread, NULL))
+    fprintf(stderr, "egl_shim: no log thread, messages show up at exit\n");
+
+  pthread_attr_destroy(&attr);
+}
+
+/* the thread exited, its ring can be reused once drained */
+static void
+release_ring(void *data)
+{
+  EGLLogRing *ring = data;
+
+  __atomic_store_n(&ring->owned, 0, __ATOMIC_RELEASE);
+}
+
+static EGLLogRing *
+get_ring(void)
+{
+  EGLLogRing *ring;
+
+  if (thread_ring)
+    return thread_ring;
+
+  pthread_once(&drain_once, start_drain_thread);
+
+  for (ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring;
+       ring = ring->next)
+  {
+    int unowned = 0;
+
+    if (__atomic_compare_exchange_n(&ring->owned, &unowned, 1, 0,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    {
+      break;
+    }
+  }
+
+  if (!ring)
+  {
+    if (!(ring = calloc(1, sizeof(*ring))))
+      return NULL;
+
+    ring->owned = 1;
+    ring->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+
+    while (!__atomic_compare_exchange_n(&rings, &ring->next, ring, 0,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+      ;
+  }
+
+  pthread_setspecific(ring_key, ring);
+  thread_ring = ring;
+  thread_tid = syscall(SYS_gettid);
+
+  return ring;
+}
+
+static void
+ring_push(EGLLogRing *ring, EGLLogRecord *rec, const char *text)
+{
+  uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+  uint64_t head = ring->head;
+  uint32_t pos = head % RING_SIZE;
+  uint32_t size = sizeof(*rec) + rec->len;
+  uint32_t pad = 0;
+
+  /* keep records contiguous, skip what is left at the end */
+  if (RING_SIZE - pos < size)
+    pad = RING_SIZE - pos;
+
+  if (head + pad + size - tail > RING_SIZE)
+  {
+    __atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  if (pad)
+  {
+    /* a zero length record marks the padding */
+    if (pad >= sizeof(*rec))
+      memset(ring->data + pos, 0, sizeof(*rec));
+
+    head += pad;
+    pos = 0;
+  }
+
+  memcpy(ring->data + pos, rec, sizeof(*rec));
+  memcpy(ring->data + pos + sizeof(*rec), text, rec->len);
+
+  __atomic_store_n(&ring->head, head + size, __ATOMIC_RELEASE);
+}
+
+/*
+ * Races between threads logging from the same site only make the limit a bit
+ * off, that is fine.
+ */
+static int
+rate_limit(EGLLogSite *site, uint64_t now, uint32_t *suppressed)
+{
+  if (now - site->window_start >= RATE_LIMIT_WINDOW_NS)
+  {
+    *suppressed = site->suppressed;
+    site->window_start = now;
+    site->count = 0;
+    site->suppressed = 0;
+  }
+
+  if (site->count >= RATE_LIMIT_BURST)
+  {
+    site->suppressed++;
+    return 0;
+  }
+
+  site->count++;
+
+  return 1;
+}
+
+void
+egl_log_write(EGLLogSite *site, EGLLogLevel level, EGLLogCategory cat,
+              const char *format, ...)
+{
+  uint64_t now = get_time_ns();
+  char text[MAX_MESSAGE];
+  uint32_t suppressed = 0;
+  EGLLogRecord rec;
+  EGLLogRing *ring;
+  va_list ap;
+  int len;
+
+  if (level <= EGL_LOG_LEVEL_WARN && !rate_limit(site, now, &suppressed))
+    return;
+
+  va_start(ap, format);
+  len = vsnprintf(text, sizeof(text), format, ap);
+  va_end(ap);
+
+  if (len < 0)
+    return;
+
+  if (len >= sizeof(text))
+    len = sizeof(text) - 1;
+
+  /* messages used to end with a newline, the drain adds one */
+  while (len && text[len - 1] == '\n')
+    len--;
+
+  if (suppressed && len < sizeof(text) - 1)
+  {
+    len += snprintf(text + len, sizeof(text) - len,
+                    " (%u similar suppressed)", suppressed);
+
+    if (len >= sizeof(text))
+      len = sizeof(text) - 1;
+  }
+
+  rec.time_ns = now;
+  rec.len = len;
+  rec.level = level;
+  rec.cat = cat;
+
+  if ((ring = get_ring()))
+  {
+    rec.tid = thread_tid;
+    ring_push(ring, &rec, text);
+  }
+  else
+    fprintf(stderr, "egl_shim: %.*s\n", len, text);
+}
+
+/*
+ * drain_mutex is held across fork(), the child would never get it back from
+ * a thread that does not exist there. Whatever the rings hold is written out
+ * before, by the parent only.
+ */
+static void
+fork_prepare(void)
+{
+  pthread_mutex_lock(&drain_mutex);
+  drain_rings();
+}
+
+static void
+fork_parent(void)
+{
+  pthread_mutex_unlock(&drain_mutex);
+}
+
+/*
+ * Only the forking thread made it into the child, and no drain thread. Give
+ * up all rings, messages other threads pushed since fork_prepare() are the
+ * parent's, so the next message claims a ring under the new tid and starts
+ * a drain thread again.
+ */
+static void
+fork_child(void)
+{
+  static const pthread_once_t once_init = PTHREAD_ONCE_INIT;
+  EGLLogRing *ring;
+
+  pthread_mutex_init(&drain_mutex, NULL);
+  drain_once = once_init;
+
+  for (ring = rings; ring; ring = ring->next)
+  {
+    ring->tail = ring->head;
+    ring->dropped_reported = ring->dropped;
+    ring->owned = 0;
+  }
+
+  thread_ring = NULL;
+}
+
+__attribute__((constructor)) static void
+egl_log_init(void)
+{
+  const char *spec = getenv("EGL_SHIM_LOG");
+
+  memset(egl_log_levels, EGL_LOG_LEVEL_WARN, sizeof(egl_log_levels));
+
+  while (spec && *spec)
+  {
+    size_t len = strcspn(spec, ",");
+
+    if (len)
+      parse_item(spec, len);
+
+    spec += len;
+
+    if (*spec)
+      spec++;
+  }
+
+  pthread_key_create(&ring_key, release_ring);
+  pthread_atfork(fork_prepare, fork_parent, fork_child);
+  atexit(egl_log_flush);
+}
@@ -0,0 +1,98 @@
+/*
+ * egl_log.h
+ *
+ * Copyright (C) 2020 Ivaylo Dimitrov <ivo.g.dimitrov.75@gmail.com>
+ *
+ * This library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Logging for the shim, selected at runtime with EGL_SHIM_LOG, a comma
+ * separated list of [category=]level items:
+ *
+ *   EGL_SHIM_LOG=debug                everything
+ *   EGL_SHIM_LOG=warn,present=debug   present path in detail, warnings else
+ *
+ * Levels are none, error, warn (the default), info and debug; categories are
+ * display, surface, present and shm. A disabled message costs a compare.
+ *
+ * Enabled messages are formatted into a ring buffer owned by the calling
+ * thread, without locks or syscalls, and written to stderr by a background
+ * thread and at exit. Errors and warnings are rate limited per call site.
+ */
+
+#ifndef EGL_LOG_H
+#define EGL_LOG_H
+
+#include <stdint.h>
+
+typedef enum
+{
+  EGL_LOG_LEVEL_NONE,
+  EGL_LOG_LEVEL_ERROR,
+  EGL_LOG_LEVEL_WARN,
+  EGL_LOG_LEVEL_INFO,
+  EGL_LOG_LEVEL_DEBUG
+} EGLLogLevel;
+
+typedef enum
+{
+  EGL_LOG_CAT_DISPLAY,  /* screens, devices, extensions */
+  EGL_LOG_CAT_SURFACE,  /* surfaces, buffers, timing */
+  EGL_LOG_CAT_PRESENT,  /* pixmaps, presents and Present events */
+  EGL_LOG_CAT_SHM,      /* MIT-SHM fallback */
+  EGL_LOG_CAT_COUNT
+} EGLLogCategory;
+
+/* per call site state for the rate limiting */
+typedef struct
+{
+  uint64_t window_start;
+  uint32_t count;
+  uint32_t suppressed;
+} EGLLogSite;
+
+extern uint8_t egl_log_levels[EGL_LOG_CAT_COUNT];
+
+static inline int
+egl_log_enabled(EGLLogLevel level, EGLLogCategory cat)
+{
+  return __builtin_expect(level <= egl_log_levels[cat], 0);
+}
+
+void
+egl_log_write(EGLLogSite *site, EGLLogLevel level, EGLLogCategory cat,
+              const char *format, ...) __attribute__((format(printf, 4, 5)));
+
+/* writes out everything logged so far */
+void
+egl_log_flush(void);
+
+#define EGL_LOG(level, cat, ...) \
+  do \
+  { \
+    static EGLLogSite site_; \
+    if (egl_log_enabled(EGL_LOG_LEVEL_##level, EGL_LOG_CAT_##cat)) \
+    { \
+      egl_log_write(&site_, EGL_LOG_LEVEL_##level, EGL_LOG_CAT_##cat, \
+                    __VA_ARGS__); \
+    } \
+  } while (0)
+
+#define LOG_ERROR(cat, ...) EGL_LOG(ERROR, cat, __VA_ARGS__)
+#define LOG_WARN(cat, ...) EGL_LOG(WARN, cat, __VA_ARGS__)
+#define LOG_INFO(cat, ...) EGL_LOG(INFO, cat, __VA_ARGS__)
+#define LOG_DEBUG(cat, ...) EGL_LOG(DEBUG, cat, __VA_ARGS__)
+
+#endif // EGL_LOG_H
@@ -24,6 +24,9 @@
 #include <stdio.h>
 
 #include "egl_pixmap.h"
+#include "egl_format.h"
+#include "egl_log.h"
+#include "egl_trace.h"
 #include "list.h"
 
 void
@@ -51,13 +54,13 @@ egl_pixmap_buffer_create(EGLShimDisplay *dpy, EGLShimSurface *surf,
                                           gbm_bo_get_width(bo),
                                           gbm_bo_get_height(bo),
                                           gbm_bo_get_stride(bo),
-                                          surf->bpp,
-                                          gbm_bo_get_bpp(bo),
+                                          surf->format->depth,
+                                          surf->format->bpp,
                                           gbm_bo_get_fd(bo));
 
   if ((error = xcb_request_check(dpy->xcb_conn, pixmap_cookie)))
   {
-    fprintf(stderr, "create pixmap failed\n");
+    LOG_ERROR(PRESENT, "create pixmap failed");
     free(pb);
     return NULL;
   }
@@ -71,6 +74,8 @@ egl_pixmap_buffer_create(EGLShimDisplay *dpy, EGLShimSurface *surf,
 
   surf->buffers = slist_append(surf->buffers, pb);
 
+  EGL_TRACE(pixmap_created, surf->drawable, pb->serial, pixmap);
+
   return pb;
 }
 
@@ -78,26 +83,57 @@ void
 egl_pixmap_buffer_present(EGLShimDisplay *dpy, EGLShimSurface *surf,
                           EGLPixmapBuffer *pb, uint32_t options)
 {
+  EGLuint64KHR frame_id = surf->frame_id++;
+  uint64_t target_msc = 0;
   xcb_void_cookie_t cookie;
   xcb_generic_error_t *error;
 
+  if (pb->present_time)
+  {
+    target_msc = egl_surface_msc_from_time(surf, pb->present_time);
+    pb->present_time = 0;
+  }
+
+  pb->frame_id = frame_id;
+
+  /* only explicitly requested targets count as missed */
+  egl_surface_timing_add(surf, frame_id, target_msc);
+
+  if (!target_msc && surf->present_mode == EGL_SHIM_PRESENT_MODE_MAILBOX &&
+      surf->vblank.msc)
+  {
+    /*
+     * All frames rendered within the same vblank interval target the same
+     * msc, so the server replaces a still pending one with the newer frame
+     * and sends IDLE_NOTIFY for the one it dropped.
+     */
+    target_msc = surf->vblank.msc + 1;
+  }
+
   cookie = xcb_present_pixmap_checked(dpy->xcb_conn, surf->drawable, pb->pixmap,
-                                      pb->serial,
+                                      (uint32_t)frame_id,
                                       None, None, 0, 0, // valid, update, x_off, y_off
                                       None, /* target_crtc */
                                       None, /* wait fence */
                                       None, /* idle fence */
                                       options,
-                                      0,
+                                      target_msc,
                                       0, /* divisor */
                                       0, /* remainder */
                                       0, /* notifiers len */
                                       NULL); /* notifiers */
 
   if ((error = xcb_request_check(dpy->xcb_conn, cookie)))
-    fprintf(stderr, "present pixmap failed %d\n", error->error_code);
+  {
+    LOG_ERROR(PRESENT, "present pixmap failed %d", error->error_code);
+    free(error);
+    egl_surface_timing_fail(surf, frame_id);
+  }
 
   xcb_flush(dpy->xcb_conn);
 
-  DEBUG("presented %d\n", pb->serial);
+  EGL_TRACE(present_sent, surf->drawable, pb->serial, frame_id, target_msc);
+
+  LOG_DEBUG(PRESENT, "presented %d frame %llu", pb->serial,
+            (unsigned long long)frame_id);
 }
@@ -20,6 +20,8 @@
 #ifndef EGL_PIXMAP_H
 #define EGL_PIXMAP_H
 
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
 #include <gbm.h>
 #include <xcb/xcb.h>
 
@@ -33,6 +35,8 @@ struct _EGLPixmapBuffer
   xcb_pixmap_t pixmap;
   Bool busy;
   uint32_t serial;
+  EGLuint64KHR frame_id;
+  EGLnsecsANDROID present_time;
 };
 
 EGLPixmapBuffer *
@@ -0,0 +1,361 @@
+/*
+ * egl_present_bench.c
+ *
+ * Copyright (C) 2020 Ivaylo Dimitrov <ivo.g.dimitrov.75@gmail.com>
+ *
+ * This library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Measures present throughput of a given colour format through the shim:
+ *
+ *   LD_PRELOAD=./egl_shim.so ./present_bench -f 565 -n 1000
+ *   LD_PRELOAD=./egl_shim.so ./present_bench -f 8888 -n 1000
+ *
+ * and input-to-photon latency of FIFO vs mailbox present modes:
+ *
+ *   LD_PRELOAD=./egl_shim.so ./present_bench -m fifo
+ *   LD_PRELOAD=./egl_shim.so ./present_bench -m mailbox
+ *
+ * "input" is sampled right before a frame is rendered, "photon" is the UST
+ * the X server reports for that frame in COMPLETE_NOTIFY.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+
+#include <EGL/egl.h>
+#include <GLES2/gl2.h>
+
+#include "egl_shim_ext.h"
+
+static struct
+{
+  const char *name;
+  EGLint red;
+  EGLint green;
+  EGLint blue;
+  EGLint alpha;
+  int bytes_pp;
+} bench_formats[] =
+{
+  {"565", 5, 6, 5, 0, 2},
+  {"888", 8, 8, 8, 0, 4},
+  {"8888", 8, 8, 8, 8, 4},
+  {"2101010", 10, 10, 10, 0, 4},
+};
+
+#define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
+
+/* must be bigger than the number of frames in flight */
+#define INPUT_HISTORY 64
+#define WARMUP_FRAMES 10
+
+static uint64_t input_ust[INPUT_HISTORY];
+static uint64_t *latencies;
+static int latency_count;
+static int skipped_count;
+
+static uint64_t
+time_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int
+compare_u64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+static void
+collect_latencies(EGLDisplay dpy, EGLSurface surface,
+                  PFNEGLGETPASTPRESENTATIONTIMINGSHIMPROC get_timing)
+{
+  EGLPresentTimingSHIM timings[EGL_PRESENT_TIMING_HISTORY_SHIM];
+  EGLint count = ARRAY_SIZE(timings);
+  EGLint i;
+
+  if (!get_timing(dpy, surface, &count, timings))
+    return;
+
+  for (i = 0; i < count; i++)
+  {
+    if (timings[i].frame_id < WARMUP_FRAMES)
+      continue;
+
+    if (timings[i].mode == EGL_PRESENT_MODE_SKIP_SHIM)
+      skipped_count++;
+    else
+    {
+      latencies[latency_count++] =
+          timings[i].actual_ust -
+          input_ust[timings[i].frame_id % INPUT_HISTORY];
+    }
+  }
+}
+
+static EGLConfig
+choose_config(EGLDisplay dpy, EGLint red, EGLint green, EGLint blue,
+              EGLint alpha)
+{
+  const EGLint attribs[] =
+  {
+    EGL_SURFACE_TYPE, EGL_WINDOW_BIT,
+    EGL_RED_SIZE, red,
+    EGL_GREEN_SIZE, green,
+    EGL_BLUE_SIZE, blue,
+    EGL_ALPHA_SIZE, alpha,
+    EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+    EGL_NONE
+  };
+  EGLConfig configs[64];
+  EGLint n, i;
+
+  if (!eglChooseConfig(dpy, attribs, configs, ARRAY_SIZE(configs), &n))
+    return NULL;
+
+  /* eglChooseConfig returns "at least" matches, we want exact ones */
+  for (i = 0; i < n; i++)
+  {
+    EGLint r, g, b, a;
+
+    eglGetConfigAttrib(dpy, configs[i], EGL_RED_SIZE, &r);
+    eglGetConfigAttrib(dpy, configs[i], EGL_GREEN_SIZE, &g);
+    eglGetConfigAttrib(dpy, configs[i], EGL_BLUE_SIZE, &b);
+    eglGetConfigAttrib(dpy, configs[i], EGL_ALPHA_SIZE, &a);
+
+    if (r == red && g == green && b == blue && a == alpha)
+      return configs[i];
+  }
+
+  return NULL;
+}
+
+static void
+usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [-f 565|888|8888|2101010] [-n frames] "
+          "[-w width] [-h height] [-m fifo|mailbox]\n", name);
+}
+
+int
+main(int argc, char *argv[])
+{
+  static const EGLint context_attribs[] =
+  {
+    EGL_CONTEXT_CLIENT_VERSION, 2,
+    EGL_NONE
+  };
+  PFNEGLGETPASTPRESENTATIONTIMINGSHIMPROC get_timing = NULL;
+  const char *format_name = "8888";
+  const char *mode = NULL;
+  int frames = 1000;
+  int width = 640;
+  int height = 480;
+  int fi = -1;
+  int opt, i, swap = 0;
+  Display *x_dpy;
+  XVisualInfo template, *vinfo;
+  XSetWindowAttributes swa;
+  Window win;
+  EGLDisplay dpy;
+  EGLConfig config;
+  EGLContext ctx;
+  EGLSurface surface;
+  EGLint visual_id, n;
+  uint64_t start, elapsed;
+  double fps;
+
+  while ((opt = getopt(argc, argv, "f:n:w:h:m:")) != -1)
+  {
+    switch (opt)
+    {
+      case 'f':
+        format_name = optarg;
+        break;
+      case 'n':
+        frames = atoi(optarg);
+        break;
+      case 'w':
+        width = atoi(optarg);
+        break;
+      case 'h':
+        height = atoi(optarg);
+        break;
+      case 'm':
+        mode = optarg;
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  for (i = 0; i < ARRAY_SIZE(bench_formats); i++)
+  {
+    if (!strcmp(bench_formats[i].name, format_name))
+      fi = i;
+  }
+
+  if (fi == -1 || frames <= 0)
+  {
+    usage(argv[0]);
+    return 1;
+  }
+
+  /* picked up by the shim when the surface gets created */
+  if (mode)
+    setenv("EGL_SHIM_PRESENT_MODE", mode, 1);
+
+  if (!(x_dpy = XOpenDisplay(NULL)))
+  {
+    fprintf(stderr, "failed to open X display\n");
+    return 1;
+  }
+
+  dpy = eglGetDisplay((EGLNativeDisplayType)x_dpy);
+
+  if (!eglInitialize(dpy, NULL, NULL))
+  {
+    fprintf(stderr, "failed to initialize\n");
+    return 1;
+  }
+
+  eglBindAPI(EGL_OPENGL_ES_API);
+
+  config = choose_config(dpy, bench_formats[fi].red, bench_formats[fi].green,
+                         bench_formats[fi].blue, bench_formats[fi].alpha);
+
+  if (!config)
+  {
+    fprintf(stderr, "no config for format %s\n", format_name);
+    return 1;
+  }
+
+  if (!eglGetConfigAttrib(dpy, config, EGL_NATIVE_VISUAL_ID, &visual_id))
+  {
+    fprintf(stderr, "no X visual for format %s\n", format_name);
+    return 1;
+  }
+
+  template.visualid = visual_id;
+  vinfo = XGetVisualInfo(x_dpy, VisualIDMask, &template, &n);
+
+  if (!vinfo)
+  {
+    fprintf(stderr, "failed to get visual 0x%x\n", visual_id);
+    return 1;
+  }
+
+  swa.colormap = XCreateColormap(x_dpy, DefaultRootWindow(x_dpy),
+                                 vinfo->visual, AllocNone);
+  swa.border_pixel = 0;
+
+  win = XCreateWindow(x_dpy, DefaultRootWindow(x_dpy), 0, 0, width, height,
+                      0, vinfo->depth, InputOutput, vinfo->visual,
+                      CWColormap | CWBorderPixel, &swa);
+  XMapWindow(x_dpy, win);
+  XSync(x_dpy, False);
+  XFree(vinfo);
+
+  ctx = eglCreateContext(dpy, config, EGL_NO_CONTEXT, context_attribs);
+  surface = eglCreateWindowSurface(dpy, config, (EGLNativeWindowType)win,
+                                   NULL);
+
+  if (!ctx || surface == EGL_NO_SURFACE)
+  {
+    fprintf(stderr, "failed to create context/surface\n");
+    return 1;
+  }
+
+  eglMakeCurrent(dpy, surface, surface, ctx);
+  glViewport(0, 0, width, height);
+
+  if (strstr(eglQueryString(dpy, EGL_EXTENSIONS), "EGL_SHIM_present_timing"))
+  {
+    get_timing = (PFNEGLGETPASTPRESENTATIONTIMINGSHIMPROC)
+        eglGetProcAddress("eglGetPastPresentationTimingSHIM");
+    latencies = calloc(frames + INPUT_HISTORY, sizeof(*latencies));
+  }
+
+  /* warm up, so all the swapchain pixmaps are created */
+  for (i = 0; i < WARMUP_FRAMES; i++, swap++)
+  {
+    glClear(GL_COLOR_BUFFER_BIT);
+    eglSwapBuffers(dpy, surface);
+  }
+
+  start = time_ns();
+
+  for (i = 0; i < frames; i++, swap++)
+  {
+    input_ust[swap % INPUT_HISTORY] = time_ns() / 1000;
+    glClearColor((i % 100) * .01, 0.5f, 0.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    eglSwapBuffers(dpy, surface);
+
+    if (get_timing)
+      collect_latencies(dpy, surface, get_timing);
+  }
+
+  elapsed = time_ns() - start;
+  fps = (double)frames * 1000000000.0 / elapsed;
+
+  printf("format %s %dx%d: %d frames, %.3f ms/frame, %.1f fps, %.1f MB/s\n",
+         format_name, width, height, frames,
+         (double)elapsed / frames / 1000000.0, fps,
+         fps * width * height * bench_formats[fi].bytes_pp / 1000000.0);
+
+  if (latency_count)
+  {
+    uint64_t sum = 0;
+
+    qsort(latencies, latency_count, sizeof(*latencies), compare_u64);
+
+    for (i = 0; i < latency_count; i++)
+      sum += latencies[i];
+
+    printf("mode %s: input-to-photon latency avg %.2f ms, p50 %.2f ms, "
+           "p99 %.2f ms, %d frames skipped\n", mode ? mode : "fifo",
+           sum / latency_count / 1000.0,
+           latencies[latency_count / 2] / 1000.0,
+           latencies[latency_count * 99 / 100] / 1000.0, skipped_count);
+  }
+
+  free(latencies);
+
+  eglMakeCurrent(dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  eglDestroySurface(dpy, surface);
+  eglDestroyContext(dpy, ctx);
+  eglTerminate(dpy);
+  XDestroyWindow(x_dpy, win);
+  XCloseDisplay(x_dpy);
+
+  return 0;
+}
@@ -0,0 +1,360 @@
+/*
+ * egl_present_sim.c
+ *
+ * Copyright (C) 2020 Ivaylo Dimitrov <ivo.g.dimitrov.75@gmail.com>
+ *
+ * This library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Runs the shim's swap path against fake_x_server with a simulated display,
+ * to see how pacing and buffer handling behave with a given refresh rate,
+ * jitter, flip or copy presents and lost IDLE_NOTIFY events:
+ *
+ *   ./present_sim -r 60 -f -d 100
+ *
+ * By default the vblank clock runs in lockstep with the application, so a
+ * thousand frames take milliseconds and, as long as the machine is not too
+ * loaded to answer within the server's 500 us quiet period, the results are
+ * the same on every run. Lost IDLEs (-d) also go through the shim's real time
+ * wait timeout. -s N runs the clock N times faster than real time instead,
+ * -w adds (real time) rendering work per frame.
+ *
+ * In mailbox mode rendering faster than the refresh rate must replace frames
+ * rather than queue them, the run fails if the shim had to wait for a buffer
+ * while no IDLE_NOTIFY was lost:
+ *
+ *   ./present_sim -f -m mailbox -s 1 -w 1000
+ *
+ * Reports how many vblanks the frames took, how far apart consecutive frames
+ * reached the screen, and what the shim had to do to get buffers back.
+ */
+
+#define EGL_EGLEXT_PROTOTYPES
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+
+#include <EGL/egl.h>
+
+#include "egl_shim_ext.h"
+#include "fake_x_server.h"
+
+#define SURFACE_SIZE 64
+/* frames that reached the screen 1, 2, ... MAX_INTERVAL or more vblanks apart */
+#define MAX_INTERVAL 4
+
+#define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
+
+static uint64_t intervals[MAX_INTERVAL + 1];
+static uint64_t last_msc;
+static uint64_t first_msc;
+static uint64_t completed;
+static uint64_t skipped;
+static uint64_t flipped;
+
+static uint64_t
+time_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+busy_wait_us(int us)
+{
+  uint64_t end = time_ns() + us * 1000ULL;
+
+  while (time_ns() < end)
+    ;
+}
+
+static EGLConfig
+choose_config(EGLDisplay dpy)
+{
+  EGLConfig configs[16];
+  EGLint n, i;
+
+  if (!eglGetConfigs(dpy, configs, ARRAY_SIZE(configs), &n))
+    return NULL;
+
+  for (i = 0; i < n; i++)
+  {
+    EGLint r, a;
+
+    eglGetConfigAttrib(dpy, configs[i], EGL_RED_SIZE, &r);
+    eglGetConfigAttrib(dpy, configs[i], EGL_ALPHA_SIZE, &a);
+
+    if (r == 8 && a == 0)
+      return configs[i];
+  }
+
+  return NULL;
+}
+
+static void
+collect_timings(EGLDisplay dpy, EGLSurface surface)
+{
+  EGLPresentTimingSHIM timings[EGL_PRESENT_TIMING_HISTORY_SHIM];
+  EGLint count = ARRAY_SIZE(timings);
+  EGLint i;
+
+  if (!eglGetPastPresentationTimingSHIM(dpy, surface, &count, timings))
+    return;
+
+  for (i = 0; i < count; i++)
+  {
+    uint64_t interval;
+
+    if (timings[i].mode == EGL_PRESENT_MODE_SKIP_SHIM)
+    {
+      skipped++;
+      continue;
+    }
+
+    if (timings[i].mode == EGL_PRESENT_MODE_FLIP_SHIM)
+      flipped++;
+
+    if (completed++)
+    {
+      interval = timings[i].msc - last_msc;
+      intervals[interval < MAX_INTERVAL ? interval : MAX_INTERVAL]++;
+    }
+    else
+      first_msc = timings[i].msc;
+
+    last_msc = timings[i].msc;
+  }
+}
+
+static void
+usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [-n frames] [-r refresh_hz] [-j jitter_us] "
+          "[-l latency_frames] [-f] [-d drop_idle_every] [-s speedup] "
+          "[-S seed] [-w render_us] [-m fifo|mailbox] [-t timeout_ms]\n",
+          name);
+}
+
+int
+main(int argc, char *argv[])
+{
+  FakeXConfig config = {.refresh_hz = 60};
+  FakeXServer *srv;
+  FakeXStats stats;
+  EGLStallStatsSHIM stall_stats;
+  const char *mode = "fifo";
+  const char *timeout = "50";
+  int frames = 1000;
+  int render_us = 0;
+  int opt, i;
+  int ret = 0;
+  Display *x_dpy;
+  XVisualInfo template, *vinfo;
+  XSetWindowAttributes swa;
+  Window win;
+  EGLDisplay dpy;
+  EGLConfig egl_config;
+  EGLSurface surface;
+  EGLint visual_id, n;
+  uint64_t start, elapsed;
+
+  while ((opt = getopt(argc, argv, "n:r:j:l:fd:s:S:w:m:t:")) != -1)
+  {
+    switch (opt)
+    {
+      case 'n':
+        frames = atoi(optarg);
+        break;
+      case 'r':
+        config.refresh_hz = atoi(optarg);
+        break;
+      case 'j':
+        config.jitter_us = atoi(optarg);
+        break;
+      case 'l':
+        config.latency_frames = atoi(optarg);
+        break;
+      case 'f':
+        config.flip = 1;
+        break;
+      case 'd':
+        config.drop_idle_every = atoi(optarg);
+        break;
+      case 's':
+        config.speedup = atoi(optarg);
+        break;
+      case 'S':
+        config.seed = strtoull(optarg, NULL, 0);
+        break;
+      case 'w':
+        render_us = atoi(optarg);
+        break;
+      case 'm':
+        mode = optarg;
+        break;
+      case 't':
+        timeout = optarg;
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  if (frames <= 0 || config.refresh_hz <= 0)
+  {
+    usage(argv[0]);
+    return 1;
+  }
+
+  /* picked up by the shim */
+  setenv("EGL_SHIM_PRESENT_MODE", mode, 1);
+  setenv("EGL_SHIM_WAIT_TIMEOUT_MS", timeout, 1);
+
+  if (!(srv = fake_x_server_start(&config)))
+    return 1;
+
+  setenv("DISPLAY", fake_x_server_display_name(srv), 1);
+
+  if (!(x_dpy = XOpenDisplay(NULL)))
+  {
+    fprintf(stderr, "failed to open fake X display\n");
+    return 1;
+  }
+
+  dpy = eglGetDisplay((EGLNativeDisplayType)x_dpy);
+
+  if (!dpy || !eglInitialize(dpy, NULL, NULL))
+  {
+    fprintf(stderr, "failed to initialize EGL\n");
+    return 1;
+  }
+
+  if (!(egl_config = choose_config(dpy)) ||
+      !eglGetConfigAttrib(dpy, egl_config, EGL_NATIVE_VISUAL_ID, &visual_id))
+  {
+    fprintf(stderr, "no usable config\n");
+    return 1;
+  }
+
+  template.visualid = visual_id;
+
+  if (!(vinfo = XGetVisualInfo(x_dpy, VisualIDMask, &template, &n)))
+  {
+    fprintf(stderr, "failed to get visual 0x%x\n", visual_id);
+    return 1;
+  }
+
+  swa.colormap = XCreateColormap(x_dpy, DefaultRootWindow(x_dpy),
+                                 vinfo->visual, AllocNone);
+  swa.border_pixel = 0;
+  win = XCreateWindow(x_dpy, DefaultRootWindow(x_dpy), 0, 0, SURFACE_SIZE,
+                      SURFACE_SIZE, 0, vinfo->depth, InputOutput,
+                      vinfo->visual, CWColormap | CWBorderPixel, &swa);
+  XMapWindow(x_dpy, win);
+  XSync(x_dpy, False);
+  XFree(vinfo);
+
+  surface = eglCreateWindowSurface(dpy, egl_config, (EGLNativeWindowType)win,
+                                   NULL);
+
+  if (surface == EGL_NO_SURFACE)
+  {
+    fprintf(stderr, "failed to create surface\n");
+    return 1;
+  }
+
+  start = time_ns();
+
+  for (i = 0; i < frames; i++)
+  {
+    if (render_us)
+      busy_wait_us(render_us);
+
+    if (!eglSwapBuffers(dpy, surface))
+    {
+      fprintf(stderr, "eglSwapBuffers failed\n");
+      return 1;
+    }
+
+    collect_timings(dpy, surface);
+  }
+
+  elapsed = time_ns() - start;
+
+  /* let the last frames complete, in lockstep the clock needs a quiet moment */
+  usleep(20000);
+  XSync(x_dpy, False);
+  collect_timings(dpy, surface);
+
+  eglGetStallStatsSHIM(dpy, surface, &stall_stats);
+  fake_x_server_get_stats(srv, &stats);
+
+  printf("%d frames, %d Hz, jitter %d us, latency %d, %s, %s, drop idle %d, "
+         "%s\n", frames, config.refresh_hz, config.jitter_us,
+         config.latency_frames, config.flip ? "flip" : "copy", mode,
+         config.drop_idle_every,
+         config.speedup ? "scaled time" : "lockstep");
+  printf("on screen: %llu frames in %llu vblanks, %llu flipped, "
+         "%llu skipped\n", (unsigned long long)completed,
+         (unsigned long long)(completed ? last_msc - first_msc + 1 : 0),
+         (unsigned long long)flipped, (unsigned long long)skipped);
+  printf("frame intervals:");
+
+  for (i = 1; i <= MAX_INTERVAL; i++)
+  {
+    printf(" %s%d: %llu", i == MAX_INTERVAL ? ">=" : "", i,
+           (unsigned long long)intervals[i]);
+  }
+
+  printf("\nshim: %llu waits, %llu stalls, %llu reclaims\n",
+         (unsigned long long)stall_stats.waits,
+         (unsigned long long)stall_stats.stalls,
+         (unsigned long long)stall_stats.reclaims);
+  printf("server: %llu presents, %llu idles dropped, %llu requests, "
+         "%llu round trips\n", (unsigned long long)stats.presents,
+         (unsigned long long)stats.dropped_idles,
+         (unsigned long long)stats.requests,
+         (unsigned long long)stats.replies);
+  printf("wall time %.1f ms\n", elapsed / 1000000.0);
+
+  /*
+   * In mailbox a new frame replaces the pending one, so with every IDLE
+   * delivered the application never has to wait for a buffer.
+   */
+  if (!strcmp(mode, "mailbox") && !config.drop_idle_every &&
+      stall_stats.waits)
+  {
+    printf("FAIL: mailbox waited for buffers, frames were queued\n");
+    ret = 1;
+  }
+
+  eglTerminate(dpy);
+  XDestroyWindow(x_dpy, win);
+  XCloseDisplay(x_dpy);
+  fake_x_server_stop(srv);
+
+  return ret;
+}
@@ -0,0 +1,229 @@
+/*
+ * egl_prime.c
+ *
+ * Copyright (C) 2020 Ivaylo Dimitrov <ivo.g.dimitrov.75@gmail.com>
+ *
+ * This library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "egl_prime.h"
+#include "egl_log.h"
+
+#ifndef DRM_FORMAT_MOD_LINEAR
+#define DRM_FORMAT_MOD_LINEAR 0
+#endif
+
+#define RENDER_NODE_MIN 128
+#define RENDER_NODE_MAX 192
+
+#define PROBE_SIZE 64
+
+static int
+open_node(const char *path)
+{
+  int fd = open(path, O_RDWR | O_CLOEXEC);
+
+  if (fd == -1)
+    LOG_ERROR(DISPLAY, "failed to open render node %s", path);
+  else
+    LOG_INFO(DISPLAY, "rendering on %s", path);
+
+  return fd;
+}
+
+static int
+open_nth_render_node(int index)
+{
+  char path[64];
+  int n = index;
+  int i;
+
+  for (i = RENDER_NODE_MIN; i < RENDER_NODE_MAX; i++)
+  {
+    snprintf(path, sizeof(path), "/dev/dri/renderD%d", i);
+
+    if (access(path, F_OK))
+      continue;
+
+    if (!n--)
+      return open_node(path);
+  }
+
+  LOG_ERROR(DISPLAY, "no render node with index %d", index);
+
+  return -1;
+}
+
+static unsigned int
+read_sysfs_id(int node, const char *name)
+{
+  char path[64];
+  unsigned int id = 0;
+  FILE *f;
+
+  snprintf(path, sizeof(path), "/sys/class/drm/renderD%d/device/%s", node,
+           name);
+
+  if ((f = fopen(path, "r")))
+  {
+    if (fscanf(f, "%x", &id) != 1)
+      id = 0;
+
+    fclose(f);
+  }
+
+  return id;
+}
+
+static int
+open_render_node_by_pci_id(unsigned int vendor, unsigned int device)
+{
+  char path[64];
+  int i;
+
+  for (i = RENDER_NODE_MIN; i < RENDER_NODE_MAX; i++)
+  {
+    if (read_sysfs_id(i, "vendor") == vendor &&
+        read_sysfs_id(i, "device") == device)
+    {
+      snprintf(path, sizeof(path), "/dev/dri/renderD%d", i);
+
+      return open_node(path);
+    }
+  }
+
+  LOG_ERROR(DISPLAY, "no render node for PCI device %04x:%04x", vendor,
+            device);
+
+  return -1;
+}
+
+/* 0000:01:00.0 or the pci-0000_01_00_0 DRI_PRIME tag */
+static Bool
+bus_id_to_path(const char *bus_id, char *path, size_t size)
+{
+  unsigned int domain, bus, dev, func;
+
+  if (sscanf(bus_id, "pci-%x_%x_%x_%x", &domain, &bus, &dev, &func) != 4 &&
+      sscanf(bus_id, "%x:%x:%x.%x", &domain, &bus, &dev, &func) != 4)
+  {
+    return False;
+  }
+
+  snprintf(path, size, "/dev/dri/by-path/pci-%04x:%02x:%02x.%x-render",
+           domain, bus, dev, func);
+
+  return True;
+}
+
+int
+egl_prime_open_render_node(void)
+{
+  const char *spec = getenv("EGL_SHIM_RENDER_NODE");
+  unsigned int vendor, device;
+  char path[64];
+  const char *p;
+
+  if (!spec || !*spec)
+    spec = getenv("DRI_PRIME");
+
+  if (!spec || !*spec)
+    return -1;
+
+  if (*spec == '/')
+    return open_node(spec);
+
+  for (p = spec; isdigit(*p); p++)
+    ;
+
+  if (!*p)
+    return open_nth_render_node(atoi(spec));
+
+  if (bus_id_to_path(spec, path, sizeof(path)))
+    return open_node(path);
+
+  if (sscanf(spec, "%4x:%4x", &vendor, &device) == 2)
+    return open_render_node_by_pci_id(vendor, device);
+
+  LOG_ERROR(DISPLAY, "bad render node selection \"%s\"", spec);
+
+  return -1;
+}
+
+static Bool
+import_bo(struct gbm_device *display, struct gbm_bo *bo)
+{
+  struct gbm_import_fd_data data;
+  struct gbm_bo *imported;
+
+  data.fd = gbm_bo_get_fd(bo);
+  data.width = gbm_bo_get_width(bo);
+  data.height = gbm_bo_get_height(bo);
+  data.stride = gbm_bo_get_stride(bo);
+  data.format = gbm_bo_get_format(bo);
+
+  if (data.fd == -1)
+    return False;
+
+  imported = gbm_bo_import(display, GBM_BO_IMPORT_FD, &data,
+                           GBM_BO_USE_SCANOUT);
+  close(data.fd);
+
+  if (!imported)
+    return False;
+
+  gbm_bo_destroy(imported);
+
+  return True;
+}
+
+Bool
+egl_prime_check_import(struct gbm_device *render, struct gbm_device *display,
+                       Bool *linear)
+{
+  struct gbm_bo *bo = gbm_bo_create(render, PROBE_SIZE, PROBE_SIZE,
+                                    GBM_FORMAT_XRGB8888,
+                                    GBM_BO_USE_RENDERING);
+  Bool ok;
+
+  if (!bo)
+    return False;
+
+  /*
+   * PixmapFromBuffer does not carry a modifier, the X server's device can only
+   * make sense of another GPU's buffer if it is linear.
+   */
+  *linear = gbm_bo_get_modifier(bo) != DRM_FORMAT_MOD_LINEAR;
+
+  if (*linear)
+  {
+    gbm_bo_destroy(bo);
+    bo = gbm_bo_create(render, PROBE_SIZE, PROBE_SIZE, GBM_FORMAT_XRGB8888,
+                       GBM_BO_USE_RENDERING | GBM_BO_USE_LINEAR);
+
+    if (!bo)
+      return False;
+  }
+
+  ok = import_bo(display, bo);
+  gbm_bo_destroy(bo);
+
+  return ok;
+}
@@ -0,0 +1,50 @@
+/*
+ * egl_prime.h
+ *
+ * Copyright (C) 2020 Ivaylo Dimitrov <ivo.g.dimitrov.75@gmail.com>
+ *
+ * This library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef EGL_PRIME_H
+#define EGL_PRIME_H
+
+#include <gbm.h>
+
+#include "defs.h"
+
+/*
+ * Render on one GPU and present on another. The render node is picked with
+ * EGL_SHIM_RENDER_NODE, or DRI_PRIME when that is not set, either one being
+ *
+ *   /dev/dri/renderD129      a device path
+ *   1                        an index, the Nth render node
+ *   pci-0000_01_00_0         a PCI bus id, 0000:01:00.0 works too
+ *   1010:cafe                PCI vendor and device id
+ *
+ * Returns -1 if there is no selection or the node can't be opened.
+ */
+int
+egl_prime_open_render_node(void);
+
+/*
+ * Checks if buffers rendered on the render device can be handed to the X
+ * server's device as they are. *linear is set if they have to be rendered
+ * linear first. Returns False if the display device can't import them at all.
+ */
+Bool
+egl_prime_check_import(struct gbm_device *render, struct gbm_device *display,
+                       Bool *linear);
+
+#endif // EGL_PRIME_H
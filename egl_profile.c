@@ -0,0 +1,373 @@
+/*
+ * egl_profile.c
+ *
+ * Copyright (C) 2020 Ivaylo Dimitrov <ivo.g.dimitrov.75@gmail.com>
+ *
+ * This library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "egl_profile.h"
+#include "egl_log.h"
+
+/*
+ * Log-linear buckets: 8 per power of two, so a percentile is off by at most
+ * 12.5%. Values below 8 get a bucket each.
+ */
+#define SUB_BITS 3
+#define SUB_BUCKETS (1 << SUB_BITS)
+#define BUCKETS ((64 - SUB_BITS + 1) * SUB_BUCKETS)
+
+/* time plus the perf counters */
+#define METRICS (1 + EGL_PROFILE_COUNTERS)
+
+typedef struct
+{
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max;
+  uint64_t buckets[BUCKETS];
+} EGLProfileHistogram;
+
+int egl_profile_enabled;
+
+static int use_counters;
+static volatile sig_atomic_t dump_requested;
+static __thread int perf_fd = -2;
+/* the whole group of the thread, closed when it exits */
+static pthread_key_t counters_key;
+
+static EGLProfileHistogram histograms[EGL_PROFILE_PHASES][METRICS];
+
+static const char *phase_names[EGL_PROFILE_PHASES] =
+{
+  "driver", "poll", "lock", "wait", "pixmap", "present", "swap"
+};
+
+static const char *metric_names[METRICS] =
+{
+  "time us", "cycles", "instructions", "cache misses"
+};
+
+static const uint64_t perf_configs[EGL_PROFILE_COUNTERS] =
+{
+  PERF_COUNT_HW_CPU_CYCLES,
+  PERF_COUNT_HW_INSTRUCTIONS,
+  PERF_COUNT_HW_CACHE_MISSES
+};
+
+static int
+bucket_of(uint64_t v)
+{
+  int shift;
+
+  if (v < SUB_BUCKETS)
+    return v;
+
+  shift = 63 - __builtin_clzll(v) - SUB_BITS;
+
+  return (shift + 1) * SUB_BUCKETS + ((v >> shift) & (SUB_BUCKETS - 1));
+}
+
+/* middle of the bucket */
+static uint64_t
+bucket_value(int bucket)
+{
+  int shift;
+
+  if (bucket < SUB_BUCKETS)
+    return bucket;
+
+  shift = bucket / SUB_BUCKETS - 1;
+
+  return ((uint64_t)(SUB_BUCKETS + bucket % SUB_BUCKETS) << shift) +
+      ((1ULL << shift) >> 1);
+}
+
+static void
+close_counters(void *data)
+{
+  int *fds = data;
+  int i;
+
+  for (i = 0; i < EGL_PROFILE_COUNTERS; i++)
+  {
+    if (fds[i] != -1)
+      close(fds[i]);
+  }
+
+  free(fds);
+}
+
+/*
+ * One group per thread, counting only while the thread runs, user and kernel
+ * space, so ioctls and syscalls into the driver are included.
+ */
+static int
+open_counters(void)
+{
+  struct perf_event_attr attr;
+  int leader = -1;
+  int *fds;
+  int i;
+
+  if (!(fds = malloc(sizeof(int) * EGL_PROFILE_COUNTERS)))
+    return -1;
+
+  for (i = 0; i < EGL_PROFILE_COUNTERS; i++)
+    fds[i] = -1;
+
+  for (i = 0; i < EGL_PROFILE_COUNTERS; i++)
+  {
+    int fd;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = perf_configs[i];
+    attr.read_format = PERF_FORMAT_GROUP;
+    attr.exclude_hv = 1;
+
+    fd = syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+
+    if (fd == -1)
+    {
+      LOG_WARN(DISPLAY, "perf_event_open failed: %s, profiling without "
+               "counters", strerror(errno));
+      close_counters(fds);
+
+      return -1;
+    }
+
+    fds[i] = fd;
+
+    if (leader == -1)
+      leader = fd;
+  }
+
+  ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  pthread_setspecific(counters_key, fds);
+
+  return leader;
+}
+
+static void
+take_sample(EGLProfileSample *sample)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  sample->ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+  if (!use_counters)
+    return;
+
+  if (perf_fd == -2 && (perf_fd = open_counters()) == -1)
+  {
+    /* no PMU access (perf_event_paranoid, VMs), don't print zeros */
+    use_counters = 0;
+    return;
+  }
+
+  if (perf_fd >= 0)
+  {
+    uint64_t values[1 + EGL_PROFILE_COUNTERS];
+
+    if (read(perf_fd, values, sizeof(values)) == sizeof(values))
+    {
+      memcpy(sample->counters, values + 1, sizeof(sample->counters));
+      return;
+    }
+  }
+
+  memset(sample->counters, 0, sizeof(sample->counters));
+}
+
+static void
+histogram_add(EGLProfileHistogram *h, uint64_t v)
+{
+  uint64_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+
+  __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&h->sum, v, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&h->buckets[bucket_of(v)], 1, __ATOMIC_RELAXED);
+
+  while (v > max && !__atomic_compare_exchange_n(&h->max, &max, v, 0,
+                                                 __ATOMIC_RELAXED,
+                                                 __ATOMIC_RELAXED))
+    ;
+}
+
+static void
+add_sample(EGLProfilePhase phase, const EGLProfileSample *from,
+           const EGLProfileSample *to)
+{
+  int i;
+
+  histogram_add(&histograms[phase][0], to->ns - from->ns);
+
+  if (!use_counters)
+    return;
+
+  for (i = 0; i < EGL_PROFILE_COUNTERS; i++)
+  {
+    histogram_add(&histograms[phase][i + 1],
+                  to->counters[i] - from->counters[i]);
+  }
+}
+
+static uint64_t
+percentile(const EGLProfileHistogram *h, double p)
+{
+  uint64_t rank = h->count * p;
+  uint64_t seen = 0;
+  int i;
+
+  for (i = 0; i < BUCKETS; i++)
+  {
+    seen += h->buckets[i];
+
+    if (seen > rank)
+    {
+      uint64_t v = bucket_value(i);
+
+      return v < h->max ? v : h->max;
+    }
+  }
+
+  return h->max;
+}
+
+static void
+dump_metric(int metric)
+{
+  /* time is kept in ns and printed in us */
+  double scale = metric ? 1.0 : 1000.0;
+  int i;
+
+  fprintf(stderr, "%-10s %10s %10s %10s %10s %10s %10s\n", metric_names[metric],
+          "p50", "p90", "p99", "p99.9", "max", "mean");
+
+  for (i = 0; i < EGL_PROFILE_PHASES; i++)
+  {
+    const EGLProfileHistogram *h = &histograms[i][metric];
+
+    if (!h->count)
+      continue;
+
+    fprintf(stderr, "%-10s %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+            phase_names[i], percentile(h, 0.5) / scale,
+            percentile(h, 0.9) / scale, percentile(h, 0.99) / scale,
+            percentile(h, 0.999) / scale, h->max / scale,
+            (double)h->sum / h->count / scale);
+  }
+}
+
+static void
+dump(void)
+{
+  int metric;
+
+  fprintf(stderr, "egl_shim profile, %llu swaps\n",
+          (unsigned long long)histograms[EGL_PROFILE_SWAP][0].count);
+
+  for (metric = 0; metric < (use_counters ? METRICS : 1); metric++)
+    dump_metric(metric);
+}
+
+static void
+request_dump(int sig)
+{
+  dump_requested = 1;
+}
+
+void
+egl_profile_start_swap(EGLProfileMark *mark)
+{
+  take_sample(&mark->start);
+  mark->last = mark->start;
+}
+
+void
+egl_profile_record(EGLProfilePhase phase, EGLProfileMark *mark)
+{
+  EGLProfileSample now;
+
+  take_sample(&now);
+  add_sample(phase, &mark->last, &now);
+  mark->last = now;
+}
+
+void
+egl_profile_record_zero(EGLProfilePhase phase)
+{
+  EGLProfileSample zero;
+
+  memset(&zero, 0, sizeof(zero));
+  add_sample(phase, &zero, &zero);
+}
+
+void
+egl_profile_end_swap(EGLProfileMark *mark)
+{
+  EGLProfileSample now;
+
+  take_sample(&now);
+  add_sample(EGL_PROFILE_SWAP, &mark->start, &now);
+
+  /* not from the signal handler, stdio is not async-signal-safe */
+  if (dump_requested)
+  {
+    dump_requested = 0;
+    dump();
+  }
+}
+
+__attribute__((constructor)) static void
+egl_profile_init(void)
+{
+  const char *mode = getenv("EGL_SHIM_PROFILE");
+  struct sigaction sa, old;
+
+  if (!mode || !*mode || !strcmp(mode, "0"))
+    return;
+
+  egl_profile_enabled = 1;
+  use_counters = !strcmp(mode, "perf") &&
+      !pthread_key_create(&counters_key, close_counters);
+
+  /* leave the application's own SIGUSR1 handler alone */
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = request_dump;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+
+  if (!sigaction(SIGUSR1, NULL, &old) && old.sa_handler == SIG_DFL)
+    sigaction(SIGUSR1, &sa, NULL);
+
+  atexit(dump);
+}
@@ -0,0 +1,103 @@
+/*
+ * egl_profile.h
+ *
+ * Copyright (C) 2020 Ivaylo Dimitrov <ivo.g.dimitrov.75@gmail.com>
+ *
+ * This library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Per swap breakdown of where eglSwapBuffers spends its time, enabled with
+ * EGL_SHIM_PROFILE=1, or EGL_SHIM_PROFILE=perf to also count cycles,
+ * instructions and cache misses of every phase with perf_event_open.
+ * Percentiles are printed to stderr at exit, and at the next swap after a
+ * SIGUSR1.
+ */
+
+#ifndef EGL_PROFILE_H
+#define EGL_PROFILE_H
+
+#include <stdint.h>
+
+typedef enum
+{
+  EGL_PROFILE_DRIVER,   /* the driver's eglSwapBuffers */
+  EGL_PROFILE_POLL,     /* handling queued Present (MIT-SHM: Expose) events */
+  EGL_PROFILE_LOCK,     /* gbm_surface_lock_front_buffer */
+  EGL_PROFILE_WAIT,     /* waiting for the server to release a buffer */
+  EGL_PROFILE_PIXMAP,   /* creating the pixmap of a new buffer */
+  EGL_PROFILE_PRESENT,  /* sending the present, or the MIT-SHM upload */
+  EGL_PROFILE_SWAP,     /* all of the above */
+  EGL_PROFILE_PHASES
+} EGLProfilePhase;
+
+#define EGL_PROFILE_COUNTERS 3
+
+typedef struct
+{
+  uint64_t ns;
+  uint64_t counters[EGL_PROFILE_COUNTERS];
+} EGLProfileSample;
+
+typedef struct
+{
+  EGLProfileSample start;
+  EGLProfileSample last;
+} EGLProfileMark;
+
+extern int egl_profile_enabled;
+
+void
+egl_profile_start_swap(EGLProfileMark *mark);
+
+void
+egl_profile_record(EGLProfilePhase phase, EGLProfileMark *mark);
+
+void
+egl_profile_record_zero(EGLProfilePhase phase);
+
+void
+egl_profile_end_swap(EGLProfileMark *mark);
+
+static inline void
+egl_profile_start(EGLProfileMark *mark)
+{
+  if (__builtin_expect(egl_profile_enabled, 0))
+    egl_profile_start_swap(mark);
+}
+
+/* accounts the time since the previous phase ended to phase */
+static inline void
+egl_profile_phase(EGLProfilePhase phase, EGLProfileMark *mark)
+{
+  if (__builtin_expect(egl_profile_enabled, 0))
+    egl_profile_record(phase, mark);
+}
+
+/* for a phase this swap does not have, so every phase counts every swap */
+static inline void
+egl_profile_skip(EGLProfilePhase phase)
+{
+  if (__builtin_expect(egl_profile_enabled, 0))
+    egl_profile_record_zero(phase);
+}
+
+static inline void
+egl_profile_end(EGLProfileMark *mark)
+{
+  if (__builtin_expect(egl_profile_enabled, 0))
+    egl_profile_end_swap(mark);
+}
+
+#endif // EGL_PROFILE_H
@@ -1,52 +1,48 @@
 #define _GNU_SOURCE
+#define EGL_EGLEXT_PROTOTYPES
 
 #include <dlfcn.h>
 #include <xcb/xcb.h>
 
 #include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
 
 #include "egl_shim_display.h"
+#include "egl_shim_ext.h"
+#include "egl_format.h"
+#include "egl_hud.h"
+#include "egl_log.h"
 #include "egl_pixmap.h"
+#include "egl_profile.h"
+#include "egl_shm.h"
+#include "egl_trace.h"
 #include "xcb_event.h"
+#include "list.h"
 
 #include "egl_pvr.h"
 
 static EGLAPI EGLDisplay EGLAPIENTRY (*_eglGetDisplay)(EGLNativeDisplayType display_id) = 0;
+static EGLAPI EGLDisplay EGLAPIENTRY (*_eglGetPlatformDisplay)(EGLenum platform, void *native_display, const EGLAttrib *attrib_list);
+static EGLAPI EGLDisplay EGLAPIENTRY (*_eglGetPlatformDisplayEXT)(EGLenum platform, void *native_display, const EGLint *attrib_list);
 static EGLAPI EGLBoolean EGLAPIENTRY (*_eglGetConfigAttrib)(EGLDisplay dpy, EGLConfig config, EGLint attribute, EGLint *value);
 static EGLAPI EGLSurface EGLAPIENTRY (*_eglCreateWindowSurface)(EGLDisplay dpy, EGLConfig config, EGLNativeWindowType win, const EGLint *attrib_list) = 0;
 static EGLAPI EGLBoolean EGLAPIENTRY (*_eglSwapBuffers)(EGLDisplay dpy, EGLSurface surface);
+static EGLAPI EGLContext EGLAPIENTRY (*_eglGetCurrentContext)(void);
+static EGLAPI EGLBoolean EGLAPIENTRY (*_eglDestroyContext)(EGLDisplay dpy, EGLContext ctx);
+static EGLAPI const char * EGLAPIENTRY (*_eglQueryString)(EGLDisplay dpy, EGLint name);
+static EGLAPI __eglMustCastToProperFunctionPointerType EGLAPIENTRY (*_eglGetProcAddress)(const char *procname);
 
-static int
-bpp_from_gbm_fourcc(uint32_t gbm_fourcc)
-{
-  switch (gbm_fourcc)
-  {
-    case GBM_FORMAT_RGB888:
-    case GBM_FORMAT_BGR888:
-    case GBM_FORMAT_XRGB8888:
-    case GBM_FORMAT_XBGR8888:
-    case GBM_FORMAT_RGBX8888:
-    case GBM_FORMAT_BGRX8888:
-    {
-      return 24;
-    }
-    case GBM_FORMAT_ARGB8888:
-    case GBM_FORMAT_ABGR8888:
-    case GBM_FORMAT_RGBA8888:
-    case GBM_FORMAT_BGRA8888:
-    {
-      return 32;
-    }
-    default:
-      assert(0);
-  }
+#define SHIM_EXTENSIONS \
+  "EGL_ANDROID_presentation_time EGL_SHIM_present_timing EGL_SHIM_stall_stats"
 
-  return 0;
-}
+/* longest a deadline wait sleeps without looking at xcb's event queue */
+#define WAIT_SLICE_MS 2
 
 extern void *__libc_dlsym (void *, const char *);
 
@@ -61,6 +57,13 @@ hook_egl_functions()
     _eglGetConfigAttrib = dlsym(RTLD_NEXT, "eglGetConfigAttrib");
     _eglCreateWindowSurface = dlsym(RTLD_NEXT, "eglCreateWindowSurface");
     _eglSwapBuffers = dlsym(RTLD_NEXT, "eglSwapBuffers");
+    _eglGetCurrentContext = dlsym(RTLD_NEXT, "eglGetCurrentContext");
+    _eglDestroyContext = dlsym(RTLD_NEXT, "eglDestroyContext");
+    _eglQueryString = dlsym(RTLD_NEXT, "eglQueryString");
+    _eglGetProcAddress = dlsym(RTLD_NEXT, "eglGetProcAddress");
+    _eglGetPlatformDisplay = dlsym(RTLD_NEXT, "eglGetPlatformDisplay");
+    _eglGetPlatformDisplayEXT =
+        (void *)_eglGetProcAddress("eglGetPlatformDisplayEXT");
 
     init_done = 1;
   }
@@ -95,34 +98,65 @@ dlsym(void * handle, const char * symbol)
     {
       if (!strcmp(symbol, "eglGetDisplay"))
         return eglGetDisplay;
+      else if (!strcmp(symbol, "eglGetPlatformDisplay"))
+        return eglGetPlatformDisplay;
+      else if (!strcmp(symbol, "eglGetPlatformDisplayEXT"))
+        return eglGetPlatformDisplayEXT;
       else if (!strcmp(symbol, "eglGetConfigAttrib"))
         return eglGetConfigAttrib;
       else if(!strcmp(symbol, "eglCreateWindowSurface"))
         return eglCreateWindowSurface;
       else if (!strcmp(symbol, "eglSwapBuffers"))
         return eglSwapBuffers;
+      else if (!strcmp(symbol, "eglDestroyContext"))
+        return eglDestroyContext;
+      else if (!strcmp(symbol, "eglQueryString"))
+        return eglQueryString;
+      else if (!strcmp(symbol, "eglGetProcAddress"))
+        return eglGetProcAddress;
+      else if (!strcmp(symbol, "eglGetPastPresentationTimingSHIM"))
+        return eglGetPastPresentationTimingSHIM;
+      else if (!strcmp(symbol, "eglPresentationTimeANDROID"))
+        return eglPresentationTimeANDROID;
+      else if (!strcmp(symbol, "eglGetStallStatsSHIM"))
+        return eglGetStallStatsSHIM;
     }
 
     return dlsym_ptr(handle, symbol);
 }
 
-EGLAPI EGLDisplay EGLAPIENTRY
-eglGetDisplay(EGLNativeDisplayType display_id)
+/*
+ * The EGL display for a screen of x_dpy, -1 for its default one. Every
+ * screen gets its own, on the device of that screen.
+ */
+static EGLDisplay
+get_x11_display(Display *x_dpy, int screen)
 {
+  static Display *default_x_dpy;
   EGLShimDisplay *dpy;
   EGLDisplay egl_dpy;
 
-  hook_egl_functions();
+  if (!x_dpy)
+  {
+    if (!default_x_dpy)
+      default_x_dpy = XOpenDisplay(NULL);
+
+    if (!(x_dpy = default_x_dpy))
+      return NULL;
+  }
+
+  if (screen < 0)
+    screen = DefaultScreen(x_dpy);
 
-  if (!display_id)
-    display_id = XOpenDisplay(NULL);
+  if ((dpy = egl_shim_display_find_x11(x_dpy, screen)))
+    return dpy->egl_dpy;
 
-  dpy = egl_shim_display_create(display_id);
+  dpy = egl_shim_display_create(x_dpy, screen);
 
   if (!dpy)
     return NULL;
 
-  egl_dpy = _eglGetDisplay((EGLNativeDisplayType)dpy->gbm);
+  egl_dpy = _eglGetDisplay((EGLNativeDisplayType)dpy->screen->gbm);
   dpy->egl_dpy = egl_dpy;
 
   if (!egl_dpy)
@@ -131,14 +165,108 @@ eglGetDisplay(EGLNativeDisplayType display_id)
   return egl_dpy;
 }
 
+EGLAPI EGLDisplay EGLAPIENTRY
+eglGetDisplay(EGLNativeDisplayType display_id)
+{
+  hook_egl_functions();
+
+  return get_x11_display(display_id, -1);
+}
+
+EGLAPI EGLDisplay EGLAPIENTRY
+eglGetPlatformDisplay(EGLenum platform, void *native_display,
+                      const EGLAttrib *attrib_list)
+{
+  int screen = -1;
+
+  hook_egl_functions();
+
+  if (platform != EGL_PLATFORM_X11_KHR)
+  {
+    if (!_eglGetPlatformDisplay)
+      return EGL_NO_DISPLAY;
+
+    return _eglGetPlatformDisplay(platform, native_display, attrib_list);
+  }
+
+  for (; attrib_list && attrib_list[0] != EGL_NONE; attrib_list += 2)
+  {
+    if (attrib_list[0] == EGL_PLATFORM_X11_SCREEN_KHR)
+      screen = attrib_list[1];
+  }
+
+  return get_x11_display(native_display, screen);
+}
+
+EGLAPI EGLDisplay EGLAPIENTRY
+eglGetPlatformDisplayEXT(EGLenum platform, void *native_display,
+                         const EGLint *attrib_list)
+{
+  int screen = -1;
+
+  hook_egl_functions();
+
+  if (platform != EGL_PLATFORM_X11_EXT)
+  {
+    if (!_eglGetPlatformDisplayEXT)
+      return EGL_NO_DISPLAY;
+
+    return _eglGetPlatformDisplayEXT(platform, native_display, attrib_list);
+  }
+
+  for (; attrib_list && attrib_list[0] != EGL_NONE; attrib_list += 2)
+  {
+    if (attrib_list[0] == EGL_PLATFORM_X11_SCREEN_EXT)
+      screen = attrib_list[1];
+  }
+
+  return get_x11_display(native_display, screen);
+}
+
+static Bool
+match_visual(Display *x_dpy, int screen, const EGLShimFormat *format,
+             XVisualInfo *vinfo)
+{
+  XVisualInfo template;
+  XVisualInfo *visuals;
+  int n;
+
+  template.screen = screen;
+  template.depth = format->depth;
+  template.class = format->visual_class;
+  template.red_mask = format->red_mask;
+  template.green_mask = format->green_mask;
+  template.blue_mask = format->blue_mask;
+
+  visuals = XGetVisualInfo(x_dpy,
+                           VisualScreenMask | VisualDepthMask |
+                           VisualClassMask | VisualRedMaskMask |
+                           VisualGreenMaskMask | VisualBlueMaskMask,
+                           &template, &n);
+
+  /*
+   * A visual of the same depth but another channel layout would show the
+   * colours swapped (BGR565 on RGB565), such a config has no visual.
+   */
+  if (!visuals)
+  {
+    LOG_DEBUG(DISPLAY, "no visual for gbm format 0x%08x", format->gbm_fourcc);
+    return False;
+  }
+
+  *vinfo = visuals[0];
+  XFree(visuals);
+
+  return True;
+}
+
 EGLAPI EGLBoolean EGLAPIENTRY
 eglGetConfigAttrib(EGLDisplay egl_dpy, EGLConfig config, EGLint attribute,
                    EGLint *value)
 {
   XVisualInfo vinfo;
   EGLShimDisplay *dpy;
-  Display *x_dpy;
-  int bpp;
+  const EGLShimFormat *format;
 
   hook_egl_functions();
 
@@ -149,10 +277,12 @@ eglGetConfigAttrib(EGLDisplay egl_dpy, EGLConfig config, EGLint attribute,
 
   assert(dpy);
 
-  bpp = bpp_from_gbm_fourcc(((_EGLConfig *)config)->NativeVisualID);
-  x_dpy = dpy->x_dpy;
+  format = egl_format_find(((_EGLConfig *)config)->NativeVisualID);
+
+  if (!format)
+    return EGL_FALSE;
 
-  if (!XMatchVisualInfo(x_dpy,  DefaultScreen(x_dpy), bpp, TrueColor, &vinfo))
+  if (!match_visual(dpy->x_dpy, dpy->screen->num, format, &vinfo))
     return EGL_FALSE;
 
   *value = vinfo.visualid;
@@ -166,6 +296,7 @@ eglCreateWindowSurface(EGLDisplay egl_dpy, EGLConfig config,
 {
   EGLShimDisplay *dpy = egl_shim_display_find(egl_dpy);
   uint32_t gbm_fourcc = ((struct _egl_config *)config)->NativeVisualID;
+  const EGLShimFormat *format = egl_format_find(gbm_fourcc);
   EGLSurface egl_surface;
   EGLShimSurface *surf;
 
@@ -173,13 +304,17 @@ eglCreateWindowSurface(EGLDisplay egl_dpy, EGLConfig config,
 
   assert(dpy);
 
-  surf = egl_shim_display_create_surface(dpy, win, gbm_fourcc);
+  if (!format)
+  {
+    LOG_ERROR(SURFACE, "unsupported gbm format 0x%08x", gbm_fourcc);
+    return NULL;
+  }
+
+  surf = egl_shim_display_create_surface(dpy, win, format);
 
   if (!surf)
     return NULL;
 
-  surf->bpp = bpp_from_gbm_fourcc(gbm_fourcc);
-
   egl_surface = _eglCreateWindowSurface(egl_dpy, config,
                                         (EGLNativeWindowType)surf->gbm_surface,
                                         attrib_list);
@@ -195,6 +330,40 @@ eglCreateWindowSurface(EGLDisplay egl_dpy, EGLConfig config,
   return egl_surface;
 }
 
+static void
+release_buffer(EGLShimSurface *surf, EGLPixmapBuffer *pb)
+{
+  gbm_surface_release_buffer(surf->gbm_surface, pb->bo);
+  pb->busy = False;
+  surf->lock_count--;
+
+  if (surf->scanout == pb)
+    surf->scanout = NULL;
+}
+
+static int
+match_busy_frame(const void *data, const void *user_data)
+{
+  const EGLPixmapBuffer *pb = data;
+
+  return pb->busy && (uint32_t)pb->frame_id == (uint32_t)(uintptr_t)user_data;
+}
+
+/*
+ * Buffers presented and not shown yet, plus the one just rendered. A flipped
+ * buffer is held until the next flip replaces it, waiting for it to go idle
+ * before presenting that next frame would never end in FIFO, and in mailbox
+ * it would turn the spare buffer into a queue slot.
+ */
+static uint32_t
+queued_buffers(EGLShimSurface *surf)
+{
+  if (surf->scanout)
+    return surf->lock_count - 1;
+
+  return surf->lock_count;
+}
+
 static void
 handle_special_event(EGLShimDisplay *dpy, EGLShimSurface *surf,
                      xcb_present_generic_event_t *ge)
@@ -203,13 +372,33 @@ handle_special_event(EGLShimDisplay *dpy, EGLShimSurface *surf,
   {
     case XCB_PRESENT_COMPLETE_NOTIFY:
     {
-#ifdef DBG
       xcb_present_complete_notify_event_t *ce =
           (xcb_present_complete_notify_event_t*) ge;
 
-      DEBUG("XCB_PRESENT_COMPLETE_NOTIFY %d %llu %llu\n", ce->serial,
-             (unsigned long long)ce->msc, (unsigned long long)ce->ust);
-#endif
+      LOG_DEBUG(PRESENT, "XCB_PRESENT_COMPLETE_NOTIFY %d %llu %llu",
+                ce->serial, (unsigned long long)ce->msc,
+                (unsigned long long)ce->ust);
+
+      EGL_TRACE(complete_received, surf->drawable, ce->serial, ce->msc,
+                ce->ust, ce->mode);
+
+      if (ce->kind == XCB_PRESENT_COMPLETE_KIND_PIXMAP)
+      {
+        egl_surface_timing_complete(surf, ce->serial, ce->ust, ce->msc,
+                                    ce->mode);
+
+        if (ce->mode == XCB_PRESENT_COMPLETE_MODE_FLIP)
+        {
+          slist *l = slist_find(surf->buffers, match_busy_frame,
+                                (void *)(uintptr_t)ce->serial);
+
+          if (l)
+            surf->scanout = l->data;
+        }
+        else if (ce->mode == XCB_PRESENT_COMPLETE_MODE_COPY)
+          surf->scanout = NULL;
+      }
+
       break;
     }
 
@@ -222,14 +411,17 @@ handle_special_event(EGLShimDisplay *dpy, EGLShimSurface *surf,
 
       assert(pb);
 
-      DEBUG("XCB_PRESENT_EVENT_IDLE_NOTIFY %d\n", ie->serial);
+      LOG_DEBUG(PRESENT, "XCB_PRESENT_EVENT_IDLE_NOTIFY %d", ie->serial);
 
-      if (pb->busy)
-      {
-        gbm_surface_release_buffer(surf->gbm_surface, pb->bo);
-        pb->busy = False;
-        surf->lock_count--;
-      }
+      /*
+       * Ignore late idle events for buffers reclaimed after a stall, the
+       * buffer might have been presented again meanwhile.
+       */
+      if (pb->busy && ie->serial == (uint32_t)pb->frame_id)
+        release_buffer(surf, pb);
+
+      EGL_TRACE(idle_received, surf->drawable, pb->serial, ie->serial,
+                surf->lock_count);
 
       break;
     }
@@ -264,19 +456,142 @@ poll_special_events(EGLShimDisplay *dpy, EGLShimSurface *surf)
 {
   xcb_generic_event_t *ge;
 
+  /* MIT-SHM surfaces get no Present events, their timings stay empty */
+  if (!surf->ev)
+    return;
+
   while ((ge = xcb_poll_for_special_event(dpy->xcb_conn, surf->ev)) != NULL)
     handle_special_event(dpy, surf, (xcb_present_generic_event_t *)ge);
 }
 
-static void
-wait_special_event(EGLShimDisplay *dpy, EGLShimSurface *surf)
+static uint64_t
+get_time_ms()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* returns False if no event arrived before the deadline */
+static Bool
+wait_special_event(EGLShimDisplay *dpy, EGLShimSurface *surf,
+                   uint64_t deadline)
 {
   xcb_generic_event_t *ge;
+  struct pollfd pfd;
 
-  ge = xcb_wait_for_special_event(dpy->xcb_conn, surf->ev);
-  handle_special_event(dpy, surf, (xcb_present_generic_event_t*)ge);
+  if (!deadline)
+  {
+    ge = xcb_wait_for_special_event(dpy->xcb_conn, surf->ev);
+
+    if (!ge)
+      return False;
+
+    handle_special_event(dpy, surf, (xcb_present_generic_event_t*)ge);
+    poll_special_events(dpy, surf);
+
+    return True;
+  }
+
+  pfd.fd = xcb_get_file_descriptor(dpy->xcb_conn);
+  pfd.events = POLLIN;
+
+  while (!(ge = xcb_poll_for_special_event(dpy->xcb_conn, surf->ev)))
+  {
+    uint64_t now = get_time_ms();
+    uint64_t slice = deadline - now;
+
+    if (now >= deadline || xcb_connection_has_error(dpy->xcb_conn))
+      return False;
+
+    /*
+     * Another thread reading the connection can put our event in xcb's
+     * queue, the fd then stays quiet, so look at the queue every slice.
+     */
+    if (slice > WAIT_SLICE_MS)
+      slice = WAIT_SLICE_MS;
 
+    /* xcb reads the socket for us in xcb_poll_for_special_event */
+    if (poll(&pfd, 1, slice) < 0 && errno != EINTR)
+      return False;
+  }
+
+  handle_special_event(dpy, surf, (xcb_present_generic_event_t*)ge);
   poll_special_events(dpy, surf);
+
+  return True;
+}
+
+/*
+ * The server did not return any buffer in time (window unmapped, compositor
+ * restarted, ...). Take back the oldest presented one, at worst we get a
+ * glitch on the screen instead of a frozen application. Nothing says the
+ * buffer is off screen, it may be rendered to while it is still scanned out,
+ * which is why this only happens with EGL_SHIM_WAIT_TIMEOUT_MS set.
+ */
+static void
+reclaim_buffer(EGLShimSurface *surf)
+{
+  EGLPixmapBuffer *oldest = NULL;
+  slist *l;
+
+  slist_for_each(surf->buffers, l)
+  {
+    EGLPixmapBuffer *pb = l->data;
+
+    if (pb->busy && (!oldest || pb->frame_id < oldest->frame_id))
+      oldest = pb;
+  }
+
+  if (oldest)
+  {
+    release_buffer(surf, oldest);
+    surf->stall_stats.reclaims++;
+  }
+}
+
+static void
+wait_for_free_buffer(EGLShimDisplay *dpy, EGLShimSurface *surf)
+{
+  uint64_t start = get_time_ms();
+  uint64_t deadline = 0;
+  uint64_t elapsed;
+  int bucket = 0;
+
+  if (dpy->wait_timeout_ms > 0)
+    deadline = start + dpy->wait_timeout_ms;
+
+  EGL_TRACE(wait_begin, surf->drawable, surf->lock_count);
+
+  while (queued_buffers(surf) > surf->max_lock_count)
+  {
+    LOG_DEBUG(SURFACE, "No free buffers");
+
+    if (!wait_special_event(dpy, surf, deadline))
+    {
+      surf->stall_stats.stalls++;
+      LOG_WARN(SURFACE, "no IDLE_NOTIFY for drawable 0x%x in %d ms, "
+               "reclaiming buffer (stall #%llu)", surf->drawable,
+               dpy->wait_timeout_ms,
+               (unsigned long long)surf->stall_stats.stalls);
+      reclaim_buffer(surf);
+    }
+  }
+
+  elapsed = get_time_ms() - start;
+
+  EGL_TRACE(wait_end, surf->drawable, surf->lock_count, elapsed);
+
+  while (bucket < EGL_STALL_HISTOGRAM_BUCKETS_SHIM - 1 &&
+         elapsed >= (1ULL << bucket))
+  {
+    bucket++;
+  }
+
+  surf->stall_stats.waits++;
+  surf->stall_stats.histogram[bucket]++;
 }
 
 EGLAPI EGLBoolean EGLAPIENTRY
@@ -286,8 +601,24 @@ eglSwapBuffers(EGLDisplay egl_dpy, EGLSurface surface)
   EGLShimSurface *surf;
   struct gbm_bo *bo;
   EGLPixmapBuffer *pb;
+  EGLProfileMark mark;
+
+  LOG_DEBUG(PRESENT, "%s", __FUNCTION__);
+
+  dpy = egl_shim_display_find(egl_dpy);
+  assert(dpy);
+
+  surf = egl_shim_display_find_surface(dpy, surface);
+  assert(surf);
+
+  EGL_TRACE(swap_begin, surf->drawable, surf->lock_count);
+  egl_profile_start(&mark);
 
-  DEBUG("\n%s\n", __FUNCTION__);
+  if (surf->hud)
+  {
+    egl_hud_draw(surf->hud, _eglGetCurrentContext(), surf->lock_count,
+                 surf->stall_stats.stalls);
+  }
 
   if (!_eglSwapBuffers(egl_dpy, surface))
   {
@@ -295,33 +626,195 @@ eglSwapBuffers(EGLDisplay egl_dpy, EGLSurface surface)
     return EGL_FALSE;
   }
 
-  dpy = egl_shim_display_find(egl_dpy);
-  assert(dpy);
+  egl_profile_phase(EGL_PROFILE_DRIVER, &mark);
 
-  surf = egl_shim_display_find_surface(dpy, surface);
-  assert(surf);
+  if (surf->screen->backend == EGL_SHIM_BACKEND_SHM)
+  {
+    /* pixels are copied out, the bo can be reused right away */
+    egl_shm_check_exposures(dpy);
+    egl_profile_phase(EGL_PROFILE_POLL, &mark);
+    bo = gbm_surface_lock_front_buffer(surf->gbm_surface);
+    egl_profile_phase(EGL_PROFILE_LOCK, &mark);
+    egl_profile_skip(EGL_PROFILE_WAIT);
+    egl_profile_skip(EGL_PROFILE_PIXMAP);
+    egl_shm_buffer_present(surf, surf->shm, bo);
+    gbm_surface_release_buffer(surf->gbm_surface, bo);
+    egl_profile_phase(EGL_PROFILE_PRESENT, &mark);
+
+    EGL_TRACE(swap_end, surf->drawable, -1, surf->lock_count);
+    egl_profile_end(&mark);
+
+    return EGL_TRUE;
+  }
 
   poll_special_events(dpy, surf);
+  egl_profile_phase(EGL_PROFILE_POLL, &mark);
 
   bo = gbm_surface_lock_front_buffer(surf->gbm_surface);
+  egl_profile_phase(EGL_PROFILE_LOCK, &mark);
 
   pb = gbm_bo_get_user_data(bo);
   surf->lock_count++;
 
-  while (surf->lock_count > 1)
-  {
-    DEBUG("No free buffers\n");
-    wait_special_event(dpy, surf);
-  }
+  EGL_TRACE(front_locked, surf->drawable, pb ? (int)pb->serial : -1,
+            surf->lock_count);
+
+  if (queued_buffers(surf) > surf->max_lock_count)
+    wait_for_free_buffer(dpy, surf);
+
+  egl_profile_phase(EGL_PROFILE_WAIT, &mark);
 
   if (!pb)
     pb = egl_pixmap_buffer_create(dpy, surf, bo);
 
+  egl_profile_phase(EGL_PROFILE_PIXMAP, &mark);
+
   assert(!pb->busy);
-  DEBUG("locked %d\n", pb->serial);
+  LOG_DEBUG(SURFACE, "locked %d", pb->serial);
 
   pb->busy = True;
+  pb->present_time = surf->present_time;
+  surf->present_time = 0;
+
   egl_pixmap_buffer_present(dpy, surf, pb, XCB_PRESENT_OPTION_NONE);
+  egl_profile_phase(EGL_PROFILE_PRESENT, &mark);
+
+  EGL_TRACE(swap_end, surf->drawable, pb->serial, surf->lock_count);
+  egl_profile_end(&mark);
+
+  return EGL_TRUE;
+}
+
+EGLAPI EGLBoolean EGLAPIENTRY
+eglDestroyContext(EGLDisplay egl_dpy, EGLContext ctx)
+{
+  EGLShimDisplay *dpy;
+  slist *l;
+
+  hook_egl_functions();
+
+  /* the handle may come back for another context, with other GL objects */
+  dpy = egl_shim_display_find(egl_dpy);
+
+  if (dpy)
+  {
+    slist_for_each(dpy->surfaces, l)
+    {
+      EGLShimSurface *surf = l->data;
+
+      if (surf->hud)
+        egl_hud_forget_context(surf->hud, ctx);
+    }
+  }
+
+  return _eglDestroyContext(egl_dpy, ctx);
+}
+
+EGLAPI const char * EGLAPIENTRY
+eglQueryString(EGLDisplay egl_dpy, EGLint name)
+{
+  EGLShimDisplay *dpy;
+  const char *s;
+
+  hook_egl_functions();
+
+  s = _eglQueryString(egl_dpy, name);
+
+  if (!s || name != EGL_EXTENSIONS || !(dpy = egl_shim_display_find(egl_dpy)))
+    return s;
+
+  if (!dpy->extensions)
+  {
+    dpy->extensions = malloc(strlen(s) + strlen(SHIM_EXTENSIONS) + 2);
+    sprintf(dpy->extensions, "%s%s" SHIM_EXTENSIONS, s, *s ? " " : "");
+  }
+
+  return dpy->extensions;
+}
+
+EGLAPI __eglMustCastToProperFunctionPointerType EGLAPIENTRY
+eglGetProcAddress(const char *procname)
+{
+  hook_egl_functions();
+
+  if (!strcmp(procname, "eglGetPlatformDisplayEXT"))
+  {
+    return (__eglMustCastToProperFunctionPointerType)eglGetPlatformDisplayEXT;
+  }
+  else if (!strcmp(procname, "eglGetPastPresentationTimingSHIM"))
+  {
+    return (__eglMustCastToProperFunctionPointerType)
+        eglGetPastPresentationTimingSHIM;
+  }
+  else if (!strcmp(procname, "eglPresentationTimeANDROID"))
+  {
+    return (__eglMustCastToProperFunctionPointerType)
+        eglPresentationTimeANDROID;
+  }
+  else if (!strcmp(procname, "eglGetStallStatsSHIM"))
+  {
+    return (__eglMustCastToProperFunctionPointerType)eglGetStallStatsSHIM;
+  }
+
+  return _eglGetProcAddress(procname);
+}
+
+EGLAPI EGLBoolean EGLAPIENTRY
+eglGetPastPresentationTimingSHIM(EGLDisplay egl_dpy, EGLSurface surface,
+                                 EGLint *count, EGLPresentTimingSHIM *timings)
+{
+  EGLShimDisplay *dpy;
+  EGLShimSurface *surf;
+
+  if (!count || (timings && *count < 0) ||
+      !(dpy = egl_shim_display_find(egl_dpy)))
+  {
+    return EGL_FALSE;
+  }
+
+  if (!(surf = egl_shim_display_find_surface(dpy, surface)))
+    return EGL_FALSE;
+
+  poll_special_events(dpy, surf);
+
+  *count = egl_surface_timing_get(surf, *count, timings);
+
+  return EGL_TRUE;
+}
+
+EGLAPI EGLBoolean EGLAPIENTRY
+eglPresentationTimeANDROID(EGLDisplay egl_dpy, EGLSurface surface,
+                           EGLnsecsANDROID time)
+{
+  EGLShimDisplay *dpy;
+  EGLShimSurface *surf;
+
+  if (!(dpy = egl_shim_display_find(egl_dpy)))
+    return EGL_FALSE;
+
+  if (!(surf = egl_shim_display_find_surface(dpy, surface)))
+    return EGL_FALSE;
+
+  /* applies to the next eglSwapBuffers */
+  surf->present_time = time;
+
+  return EGL_TRUE;
+}
+
+EGLAPI EGLBoolean EGLAPIENTRY
+eglGetStallStatsSHIM(EGLDisplay egl_dpy, EGLSurface surface,
+                     EGLStallStatsSHIM *stats)
+{
+  EGLShimDisplay *dpy;
+  EGLShimSurface *surf;
+
+  if (!stats || !(dpy = egl_shim_display_find(egl_dpy)))
+    return EGL_FALSE;
+
+  if (!(surf = egl_shim_display_find_surface(dpy, surface)))
+    return EGL_FALSE;
+
+  *stats = surf->stall_stats;
 
   return EGL_TRUE;
 }
@@ -0,0 +1,272 @@
+/*
+ * egl_shim_bench.c
+ *
+ * Copyright (C) 2020 Ivaylo Dimitrov <ivo.g.dimitrov.75@gmail.com>
+ *
+ * This library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Measures what the shim itself costs per eglSwapBuffers, with no GPU and no
+ * X server around: EGL and gbm are stubs (stub_egl.so, stub_gbm.so) and the
+ * X server is fake_x_server running in a thread of this process. Reports,
+ * for 1, 10 and 100 surfaces swapped round-robin:
+ *
+ *   ns/swap      wall time of eglSwapBuffers, including the X round trips
+ *   rtt/swap     replies the shim had to wait for
+ *   req/swap     X requests sent
+ *   alloc/swap   malloc/calloc/realloc calls made by the swapping thread
+ *
+ * Run with "make bench".
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+
+#include <EGL/egl.h>
+
+#include "fake_x_server.h"
+
+#define SURFACE_SIZE 64
+#define WARMUP_FRAMES 10
+#define SWAPS_PER_RUN 20000
+
+#define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+/* only the thread calling eglSwapBuffers is counted, not the X server */
+static __thread int count_allocations;
+static uint64_t allocations;
+
+void *
+malloc(size_t size)
+{
+  if (count_allocations)
+    allocations++;
+
+  return __libc_malloc(size);
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+  if (count_allocations)
+    allocations++;
+
+  return __libc_calloc(nmemb, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+  if (count_allocations)
+    allocations++;
+
+  return __libc_realloc(ptr, size);
+}
+
+void
+free(void *ptr)
+{
+  __libc_free(ptr);
+}
+
+static uint64_t
+time_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static EGLConfig
+choose_config(EGLDisplay dpy)
+{
+  EGLConfig configs[16];
+  EGLint n, i;
+
+  if (!eglGetConfigs(dpy, configs, ARRAY_SIZE(configs), &n))
+    return NULL;
+
+  for (i = 0; i < n; i++)
+  {
+    EGLint r, a;
+
+    eglGetConfigAttrib(dpy, configs[i], EGL_RED_SIZE, &r);
+    eglGetConfigAttrib(dpy, configs[i], EGL_ALPHA_SIZE, &a);
+
+    if (r == 8 && a == 0)
+      return configs[i];
+  }
+
+  return NULL;
+}
+
+/*
+ * The shim does not hook eglDestroySurface, so surfaces are never destroyed,
+ * a new one could get the address of a stale shim surface.
+ */
+static Bool
+run(FakeXServer *srv, Display *x_dpy, EGLDisplay dpy, EGLConfig config,
+    XVisualInfo *vinfo, int count)
+{
+  EGLSurface *surfaces = calloc(count, sizeof(*surfaces));
+  XSetWindowAttributes swa;
+  FakeXStats before, after;
+  uint64_t start, elapsed, allocs;
+  int rounds = SWAPS_PER_RUN / count;
+  int swaps = rounds * count;
+  int i, j;
+
+  swa.colormap = XCreateColormap(x_dpy, DefaultRootWindow(x_dpy),
+                                 vinfo->visual, AllocNone);
+  swa.border_pixel = 0;
+
+  for (i = 0; i < count; i++)
+  {
+    Window win = XCreateWindow(x_dpy, DefaultRootWindow(x_dpy), 0, 0,
+                               SURFACE_SIZE, SURFACE_SIZE, 0, vinfo->depth,
+                               InputOutput, vinfo->visual,
+                               CWColormap | CWBorderPixel, &swa);
+
+    XMapWindow(x_dpy, win);
+    XSync(x_dpy, False);
+
+    surfaces[i] = eglCreateWindowSurface(dpy, config,
+                                         (EGLNativeWindowType)win, NULL);
+
+    if (surfaces[i] == EGL_NO_SURFACE)
+    {
+      fprintf(stderr, "failed to create surface %d\n", i);
+      free(surfaces);
+      return False;
+    }
+  }
+
+  /* so all the pixmaps get created */
+  for (i = 0; i < WARMUP_FRAMES; i++)
+  {
+    for (j = 0; j < count; j++)
+      eglSwapBuffers(dpy, surfaces[j]);
+  }
+
+  fake_x_server_get_stats(srv, &before);
+  allocs = allocations;
+  count_allocations = 1;
+  start = time_ns();
+
+  for (i = 0; i < rounds; i++)
+  {
+    for (j = 0; j < count; j++)
+    {
+      if (!eglSwapBuffers(dpy, surfaces[j]))
+      {
+        count_allocations = 0;
+        fprintf(stderr, "eglSwapBuffers failed\n");
+        free(surfaces);
+        return False;
+      }
+    }
+  }
+
+  elapsed = time_ns() - start;
+  count_allocations = 0;
+  allocs = allocations - allocs;
+  fake_x_server_get_stats(srv, &after);
+
+  printf("%8d %10.0f %10.2f %10.2f %10.2f\n", count,
+         (double)elapsed / swaps,
+         (double)(after.replies - before.replies) / swaps,
+         (double)(after.requests - before.requests) / swaps,
+         (double)allocs / swaps);
+
+  free(surfaces);
+
+  return True;
+}
+
+int
+main(int argc, char *argv[])
+{
+  static const int surface_counts[] = {1, 10, 100};
+  FakeXServer *srv;
+  Display *x_dpy;
+  EGLDisplay dpy;
+  EGLConfig config;
+  EGLint visual_id, n;
+  XVisualInfo template, *vinfo;
+  int i, ret = 0;
+
+  if (!(srv = fake_x_server_start(NULL)))
+    return 1;
+
+  setenv("DISPLAY", fake_x_server_display_name(srv), 1);
+
+  if (!(x_dpy = XOpenDisplay(NULL)))
+  {
+    fprintf(stderr, "failed to open fake X display\n");
+    return 1;
+  }
+
+  dpy = eglGetDisplay((EGLNativeDisplayType)x_dpy);
+
+  if (!dpy || !eglInitialize(dpy, NULL, NULL))
+  {
+    fprintf(stderr, "failed to initialize EGL\n");
+    return 1;
+  }
+
+  if (!(config = choose_config(dpy)) ||
+      !eglGetConfigAttrib(dpy, config, EGL_NATIVE_VISUAL_ID, &visual_id))
+  {
+    fprintf(stderr, "no usable config\n");
+    return 1;
+  }
+
+  template.visualid = visual_id;
+
+  if (!(vinfo = XGetVisualInfo(x_dpy, VisualIDMask, &template, &n)))
+  {
+    fprintf(stderr, "failed to get visual 0x%x\n", visual_id);
+    return 1;
+  }
+
+  printf("%8s %10s %10s %10s %10s\n", "surfaces", "ns/swap", "rtt/swap",
+         "req/swap", "alloc/swap");
+
+  for (i = 0; i < ARRAY_SIZE(surface_counts) && !ret; i++)
+  {
+    if (!run(srv, x_dpy, dpy, config, vinfo, surface_counts[i]))
+      ret = 1;
+  }
+
+  XFree(vinfo);
+  eglTerminate(dpy);
+  XCloseDisplay(x_dpy);
+  fake_x_server_stop(srv);
+
+  return ret;
+}
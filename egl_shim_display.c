@@ -19,41 +19,192 @@
 
 #include <xcb/xcb.h>
 #include <X11/Xlib-xcb.h>
+#include <sys/stat.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <unistd.h>
 
 #include "egl_shim_display.h"
+#include "egl_format.h"
+#include "egl_hud.h"
+#include "egl_log.h"
+#include "egl_prime.h"
+#include "egl_shm.h"
 #include "xcb_dri3.h"
 #include "xcb_event.h"
 #include "list.h"
 
 static slist *egl_displays = NULL;
 
+static int
+match_screen_root(const void *data, const void *user_data)
+{
+  const EGLShimScreen *screen = data;
+  xcb_window_t root = (xcb_window_t)(uintptr_t)user_data;
+
+  if (screen->xcb_screen->root == root)
+    return 1;
+
+  return 0;
+}
+
+static void
+destroy_gbm_device(struct gbm_device *gbm)
+{
+  int fd = gbm_device_get_fd(gbm);
+
+  gbm_device_destroy(gbm);
+  close(fd);
+}
+
+/*
+ * Render on the node the user picked, the X server's device only has to
+ * import the buffers. If it can't, the pixels go through MIT-SHM instead.
+ */
+static void
+egl_shim_screen_setup_prime(EGLShimDisplay *dpy, EGLShimScreen *screen)
+{
+  int fd = egl_prime_open_render_node();
+  struct gbm_device *render;
+
+  if (fd == -1)
+    return;
+
+  if (!(render = gbm_create_device(fd)))
+  {
+    LOG_ERROR(DISPLAY, "failed to create gbm device for the render node");
+    close(fd);
+    return;
+  }
+
+  if (egl_prime_check_import(render, screen->gbm, &screen->linear))
+  {
+    LOG_INFO(DISPLAY, "screen %d renders on another GPU%s", screen->num,
+             screen->linear ? ", linear" : "");
+    screen->display_gbm = screen->gbm;
+    screen->gbm = render;
+
+    return;
+  }
+
+  destroy_gbm_device(render);
+
+  LOG_WARN(DISPLAY, "screen %d can't import buffers from the render node, "
+           "falling back to MIT-SHM", screen->num);
+
+  /* opens the selected render node again */
+  if ((render = egl_shm_create_gbm_device(dpy->xcb_conn)))
+  {
+    destroy_gbm_device(screen->gbm);
+    screen->gbm = render;
+    screen->backend = EGL_SHIM_BACKEND_SHM;
+  }
+}
+
+static EGLShimScreen *
+egl_shim_screen_create(EGLShimDisplay *dpy, xcb_window_t root)
+{
+  xcb_screen_iterator_t it;
+  EGLShimScreen *screen;
+  int num = 0;
+
+  for (it = xcb_setup_roots_iterator(xcb_get_setup(dpy->xcb_conn)); it.rem;
+       xcb_screen_next(&it))
+  {
+    if (it.data->root == root)
+      break;
+
+    num++;
+  }
+
+  if (!it.rem)
+  {
+    LOG_ERROR(DISPLAY, "no screen with root 0x%x", root);
+    return NULL;
+  }
+
+  screen = calloc(sizeof(EGLShimScreen), 1);
+  screen->num = num;
+  screen->xcb_screen = it.data;
+
+  if ((screen->gbm = xcb_dri3_create_gbm_device(dpy->xcb_conn, it.data)))
+  {
+    screen->backend = EGL_SHIM_BACKEND_DRI3;
+    egl_shim_screen_setup_prime(dpy, screen);
+  }
+  else if ((screen->gbm = egl_shm_create_gbm_device(dpy->xcb_conn)))
+  {
+    LOG_WARN(DISPLAY, "DRI3 not available on screen %d, falling back to "
+             "MIT-SHM", num);
+    screen->backend = EGL_SHIM_BACKEND_SHM;
+  }
+  else
+  {
+    free(screen);
+    return NULL;
+  }
+
+  LOG_DEBUG(DISPLAY, "screen %d root 0x%x uses gbm device %p", num, root,
+            screen->gbm);
+
+  return screen;
+}
+
+static void
+egl_shim_screen_destroy(void *data)
+{
+  EGLShimScreen *screen = data;
+
+  if (screen->display_gbm)
+    destroy_gbm_device(screen->display_gbm);
+
+  destroy_gbm_device(screen->gbm);
+  free(screen);
+}
+
+EGLShimScreen *
+egl_shim_display_get_screen(EGLShimDisplay *dpy, xcb_window_t root)
+{
+  slist *l = slist_find(dpy->screens, match_screen_root,
+                        (void *)(uintptr_t)root);
+  EGLShimScreen *screen;
+
+  if (l)
+    return l->data;
+
+  if ((screen = egl_shim_screen_create(dpy, root)))
+    dpy->screens = slist_append(dpy->screens, screen);
+
+  return screen;
+}
+
 EGLShimDisplay *
-egl_shim_display_create(Display *x_dpy)
+egl_shim_display_create(Display *x_dpy, int screen)
 {
   EGLShimDisplay *dpy = calloc(sizeof(EGLShimDisplay), 1);
-  const xcb_setup_t *setup;
-  xcb_screen_t *screen;
+  const char *timeout = getenv("EGL_SHIM_WAIT_TIMEOUT_MS");
 
   dpy->x_dpy = x_dpy;
   dpy->xcb_conn = XGetXCBConnection(x_dpy);
 
-  if (!(setup = xcb_get_setup(dpy->xcb_conn)))
-  {
-    fprintf(stderr, "xcb_get_setup failed\n");
-    goto fail;
-  }
+  /*
+   * Unset or 0 means wait forever. A reclaimed buffer may still be on screen,
+   * so giving up on IDLE_NOTIFY is something the user asks for.
+   */
+  if (timeout)
+    dpy->wait_timeout_ms = atoi(timeout);
 
-  /* get the first screen */
-  if (!(screen = xcb_setup_roots_iterator(setup).data))
+  if (screen < 0 || screen >= ScreenCount(x_dpy))
   {
-    fprintf(stderr, "failed to find screen\n");
+    LOG_ERROR(DISPLAY, "no screen %d", screen);
     goto fail;
   }
 
-  if (!(dpy->gbm = xcb_dri3_create_gbm_device(dpy->xcb_conn, screen)))
-      goto fail;
+  dpy->screen = egl_shim_display_get_screen(dpy, RootWindow(x_dpy, screen));
+
+  if (!dpy->screen)
+    goto fail;
 
   egl_displays = slist_append(egl_displays, dpy);
 
@@ -77,6 +228,33 @@ egl_display_find(const void *data, const void *user_data)
   return 0;
 }
 
+struct x11_key
+{
+  Display *x_dpy;
+  int screen;
+};
+
+static int
+egl_display_find_x11(const void *data, const void *user_data)
+{
+  const EGLShimDisplay *dpy = data;
+  const struct x11_key *key = user_data;
+
+  return dpy->x_dpy == key->x_dpy && dpy->screen->num == key->screen;
+}
+
+EGLShimDisplay *
+egl_shim_display_find_x11(Display *x_dpy, int screen)
+{
+  struct x11_key key = {x_dpy, screen};
+  slist *l = slist_find(egl_displays, egl_display_find_x11, &key);
+
+  if (l)
+    return l->data;
+
+  return NULL;
+}
+
 EGLShimDisplay *
 egl_shim_display_find(EGLDisplay egl_dpy)
 {
@@ -93,8 +271,14 @@ egl_shim_display_destroy(void * data)
 {
   EGLShimDisplay *dpy = data;
 
-  gbm_device_destroy(dpy->gbm);
+  while (dpy->screens)
+    dpy->screens = slist_remove(dpy->screens, dpy->screens->data,
+                                egl_shim_screen_destroy);
+
+  if (dpy->shm_events)
+    xcb_disconnect(dpy->shm_events);
 
+  free(dpy->extensions);
   free(data);
 }
 
@@ -104,30 +288,102 @@ egl_shim_display_remove(EGLShimDisplay *dpy)
   egl_displays = slist_remove(egl_displays, dpy, egl_shim_display_destroy);
 }
 
+/* the same GPU, even if opened separately for each screen */
+static Bool
+same_device(struct gbm_device *a, struct gbm_device *b)
+{
+  struct stat sa, sb;
+
+  if (a == b)
+    return True;
+
+  if (fstat(gbm_device_get_fd(a), &sa) || fstat(gbm_device_get_fd(b), &sb))
+    return False;
+
+  return sa.st_rdev == sb.st_rdev;
+}
+
 EGLShimSurface *
 egl_shim_display_create_surface(EGLShimDisplay *dpy, EGLNativeWindowType win,
-                                uint32_t format)
+                                const EGLShimFormat *format)
 {
-  EGLShimSurface *surf = egl_shim_surface_create(win);
   xcb_get_geometry_cookie_t cookie = xcb_get_geometry(dpy->xcb_conn, win);
   xcb_get_geometry_reply_t *geom =
       xcb_get_geometry_reply(dpy->xcb_conn, cookie, NULL);
+  uint32_t flags = GBM_BO_USE_RENDERING | GBM_BO_USE_SCANOUT;
+  EGLShimScreen *screen;
+  EGLShimSurface *surf;
+  uint32_t width, height;
 
-  DEBUG("Creating gbm surface w=%d h=%d\n", geom->width, geom->height);
+  if (!geom)
+  {
+    LOG_ERROR(SURFACE, "failed to get geometry of window 0x%lx",
+              (unsigned long)win);
+    return NULL;
+  }
+
+  width = geom->width;
+  height = geom->height;
 
-  surf->gbm_surface =
-      gbm_surface_create(dpy->gbm, geom->width, geom->height, format,
-                         GBM_BO_USE_RENDERING | GBM_BO_USE_SCANOUT);
+  /* the window might be on another screen than the display's default one */
+  screen = egl_shim_display_get_screen(dpy, geom->root);
 
   free(geom);
 
+  if (!screen)
+    return NULL;
+
+  /*
+   * The driver renders with the device the EGL display was created on, and
+   * the app's configs and contexts belong to that display. A window on a
+   * screen driven by another GPU needs an EGL display of its own, see
+   * EGL_PLATFORM_X11_SCREEN_KHR.
+   */
+  if (!same_device(screen->gbm, dpy->screen->gbm))
+  {
+    LOG_ERROR(SURFACE, "window 0x%lx is on screen %d, which has another GPU "
+              "than screen %d of the EGL display", (unsigned long)win,
+              screen->num, dpy->screen->num);
+    return NULL;
+  }
+
+  LOG_DEBUG(SURFACE, "Creating gbm surface w=%d h=%d on screen %d", width,
+            height, screen->num);
+
+  surf = egl_shim_surface_create(win);
+  surf->screen = screen;
+
+  /* we map the buffers on the CPU */
+  if (screen->backend == EGL_SHIM_BACKEND_SHM)
+    flags = GBM_BO_USE_RENDERING | GBM_BO_USE_LINEAR;
+  else if (screen->display_gbm)
+  {
+    /* the render GPU does not scan out, the display one imports */
+    flags = GBM_BO_USE_RENDERING;
+
+    if (screen->linear)
+      flags |= GBM_BO_USE_LINEAR;
+  }
+
+  surf->gbm_surface = gbm_surface_create(dpy->screen->gbm, width, height,
+                                        format->gbm_fourcc, flags);
+
   if (!surf->gbm_surface)
   {
-    fprintf(stdout, "Unable to create gbm surface");
+    LOG_ERROR(SURFACE, "Unable to create gbm surface");
     goto fail;
   }
 
-  surf->ev = xcb_event_init_special_event_queue(dpy->xcb_conn, win, NULL);
+  surf->format = format;
+  surf->hud = egl_hud_create(width, height);
+
+  if (screen->backend == EGL_SHIM_BACKEND_SHM)
+  {
+    if (!(surf->shm = egl_shm_buffer_create(dpy, surf, width, height)))
+      goto fail;
+  }
+  else
+    surf->ev = xcb_event_init_special_event_queue(dpy->xcb_conn, win, NULL);
 
   return surf;
 
@@ -28,29 +28,75 @@
 #include <gbm.h>
 
 #include "egl_shim_surface.h"
+#include "list.h"
+
+typedef enum
+{
+  EGL_SHIM_BACKEND_DRI3,
+  EGL_SHIM_BACKEND_SHM
+} EGLShimBackend;
+
+/*
+ * An X screen and the device its server renders with. With several GPUs
+ * (Zaphod) every screen can be driven by a different one, so buffers for a
+ * window must come from the device of the screen the window is on.
+ */
+struct _EGLShimScreen
+{
+  int num;
+  xcb_screen_t *xcb_screen;
+  /* the device we render with */
+  struct gbm_device *gbm;
+  /* the X server's device when rendering on another GPU (PRIME), or NULL */
+  struct gbm_device *display_gbm;
+  /* the X server's device can't handle the render GPU's tiling */
+  Bool linear;
+  EGLShimBackend backend;
+};
 
 struct _EGLShimDisplay
 {
   Display *x_dpy;
   xcb_connection_t *xcb_conn;
   xcb_special_event_t *special_ev;
-  struct gbm_device *gbm;
+  /*
+   * Expose and structure events of MIT-SHM windows, on a connection of our
+   * own so the app's event masks and queue stay untouched
+   */
+  xcb_connection_t *shm_events;
+  /* opened on first use, the display's own one when it is created */
+  slist *screens;
+  /*
+   * The screen the EGL display, and so its configs and visuals, belong to.
+   * There is an EGL display per screen an app asks for.
+   */
+  EGLShimScreen *screen;
   EGLDisplay egl_dpy;
   EGLShimSurfaceList surfaces;
+  char *extensions;
+  int wait_timeout_ms;
 };
 
+/* for screen of x_dpy, its default one unless asked for another */
 EGLShimDisplay *
-egl_shim_display_create(Display *x_dpy);
+egl_shim_display_create(Display *x_dpy, int screen);
 
 EGLShimDisplay *
 egl_shim_display_find(EGLDisplay egl_dpy);
 
+/* the one created for a screen of x_dpy, NULL if there is none yet */
+EGLShimDisplay *
+egl_shim_display_find_x11(Display *x_dpy, int screen);
+
 void
 egl_shim_display_remove(EGLShimDisplay *dpy);
 
+EGLShimScreen *
+egl_shim_display_get_screen(EGLShimDisplay *dpy, xcb_window_t root);
+
 EGLShimSurface *
 egl_shim_display_create_surface(EGLShimDisplay *dpy, EGLNativeWindowType win,
-                                uint32_t format);
+                                const EGLShimFormat *format);
 void
 egl_shim_display_add_surface(EGLShimDisplay *dpy, EGLShimSurface *surf);
 
@@ -0,0 +1,110 @@
+/*
+ * egl_shim_ext.h
+ *
+ * Copyright (C) 2020 Ivaylo Dimitrov <ivo.g.dimitrov.75@gmail.com>
+ *
+ * This library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Public extensions exported by the shim. Applications should check for the
+ * extension name in eglQueryString(dpy, EGL_EXTENSIONS) and get the entry
+ * points through eglGetProcAddress().
+ */
+
+#ifndef EGL_SHIM_EXT_H
+#define EGL_SHIM_EXT_H
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef EGL_SHIM_present_timing
+#define EGL_SHIM_present_timing 1
+
+/*
+ * present modes, as reported by the X server. SKIP is also reported for
+ * frames the server never completed, because the present failed or was
+ * discarded.
+ */
+#define EGL_PRESENT_MODE_COPY_SHIM 0
+#define EGL_PRESENT_MODE_FLIP_SHIM 1
+#define EGL_PRESENT_MODE_SKIP_SHIM 2
+#define EGL_PRESENT_MODE_SUBOPTIMAL_COPY_SHIM 3
+
+/*
+ * All times are in microseconds, CLOCK_MONOTONIC based, the same time base
+ * X server uses for Present UST.
+ */
+typedef struct
+{
+  EGLuint64KHR frame_id;      /* increments by one for every eglSwapBuffers */
+  EGLuint64KHR requested_ust; /* when eglSwapBuffers sent the frame */
+  EGLuint64KHR actual_ust;    /* when the frame reached the screen */
+  EGLuint64KHR msc;           /* vblank counter at actual_ust */
+  EGLuint64KHR target_msc;    /* from eglPresentationTimeANDROID, 0 if none */
+  EGLint mode;                /* EGL_PRESENT_MODE_*_SHIM */
+  EGLBoolean missed;          /* shown after target_msc */
+} EGLPresentTimingSHIM;
+
+/*
+ * Returns timings of the frames completed since the last call, oldest first.
+ * If timings is NULL, *count is set to the number of available entries,
+ * otherwise up to *count entries are copied and *count is updated with the
+ * number of entries actually returned, a negative *count is an error. Only
+ * the last EGL_PRESENT_TIMING_HISTORY_SHIM frames are kept.
+ */
+#define EGL_PRESENT_TIMING_HISTORY_SHIM 16
+
+typedef EGLBoolean (EGLAPIENTRYP PFNEGLGETPASTPRESENTATIONTIMINGSHIMPROC)(EGLDisplay dpy, EGLSurface surface, EGLint *count, EGLPresentTimingSHIM *timings);
+
+#ifdef EGL_EGLEXT_PROTOTYPES
+EGLAPI EGLBoolean EGLAPIENTRY eglGetPastPresentationTimingSHIM(EGLDisplay dpy, EGLSurface surface, EGLint *count, EGLPresentTimingSHIM *timings);
+#endif
+
+#endif /* EGL_SHIM_present_timing */
+
+#ifndef EGL_SHIM_stall_stats
+#define EGL_SHIM_stall_stats 1
+
+/*
+ * Bucket i counts waits for a free buffer shorter than 2^i ms, the last
+ * bucket counts everything longer.
+ */
+#define EGL_STALL_HISTOGRAM_BUCKETS_SHIM 12
+
+typedef struct
+{
+  EGLuint64KHR waits;     /* swaps that had to wait for a free buffer */
+  EGLuint64KHR stalls;    /* waits that ran into EGL_SHIM_WAIT_TIMEOUT_MS */
+  EGLuint64KHR reclaims;  /* buffers taken back without IDLE_NOTIFY */
+  EGLuint64KHR histogram[EGL_STALL_HISTOGRAM_BUCKETS_SHIM];
+} EGLStallStatsSHIM;
+
+typedef EGLBoolean (EGLAPIENTRYP PFNEGLGETSTALLSTATSSHIMPROC)(EGLDisplay dpy, EGLSurface surface, EGLStallStatsSHIM *stats);
+
+#ifdef EGL_EGLEXT_PROTOTYPES
+EGLAPI EGLBoolean EGLAPIENTRY eglGetStallStatsSHIM(EGLDisplay dpy, EGLSurface surface, EGLStallStatsSHIM *stats);
+#endif
+
+#endif /* EGL_SHIM_stall_stats */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // EGL_SHIM_EXT_H
@@ -19,24 +19,48 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 #include <gbm.h>
 
 #include "egl_shim_surface.h"
+#include "egl_hud.h"
+#include "egl_log.h"
+#include "egl_shm.h"
 #include "list.h"
 
 EGLShimSurface *
 egl_shim_surface_create(EGLNativeWindowType win)
 {
   EGLShimSurface *surf = calloc(sizeof(EGLShimSurface), 1);
+  const char *mode = getenv("EGL_SHIM_PRESENT_MODE");
 
   surf->drawable = (xcb_drawable_t)win;
 
+  if (mode && !strcmp(mode, "mailbox"))
+  {
+    /* one buffer on screen, one pending, one being rendered */
+    surf->present_mode = EGL_SHIM_PRESENT_MODE_MAILBOX;
+    surf->max_lock_count = 2;
+  }
+  else
+  {
+    surf->present_mode = EGL_SHIM_PRESENT_MODE_FIFO;
+    surf->max_lock_count = 1;
+  }
+
   return surf;
 }
 
 void
 egl_shim_surface_destroy(EGLShimSurface *surf)
 {
+  if (surf->hud)
+    egl_hud_destroy(surf->hud);
+
+  if (surf->shm)
+    egl_shm_buffer_destroy(surf->shm);
+
   if (surf->gbm_surface)
     gbm_surface_destroy(surf->gbm_surface);
 
@@ -144,3 +168,188 @@ egl_surface_pixmap_buffer_find_by_serial(EGLShimSurface *surf,
 
   return NULL;
 }
+
+#define TIMING_SLOT(surf, i) \
+  (&(surf)->timings.frames[(i) % EGL_PRESENT_TIMING_HISTORY_SHIM])
+
+void
+egl_surface_timing_add(EGLShimSurface *surf, EGLuint64KHR frame_id,
+                       uint64_t target_msc)
+{
+  EGLShimFrameTiming *ft;
+  struct timespec ts;
+
+  /* ring is full, drop the oldest entry */
+  if (surf->timings.head - surf->timings.tail ==
+      EGL_PRESENT_TIMING_HISTORY_SHIM)
+  {
+    surf->timings.tail++;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  ft = TIMING_SLOT(surf, surf->timings.head);
+  ft->timing.frame_id = frame_id;
+  ft->timing.requested_ust =
+      (EGLuint64KHR)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+  ft->timing.actual_ust = 0;
+  ft->timing.msc = 0;
+  ft->timing.target_msc = target_msc;
+  ft->timing.mode = EGL_PRESENT_MODE_COPY_SHIM;
+  ft->timing.missed = EGL_FALSE;
+  ft->complete = False;
+
+  surf->timings.head++;
+}
+
+void
+egl_surface_timing_complete(EGLShimSurface *surf, uint32_t serial,
+                            uint64_t ust, uint64_t msc, int mode)
+{
+  EGLShimFrameTiming *ft;
+  uint32_t i, j;
+
+  /* learn refresh period and phase from the vblank counter */
+  if (mode != EGL_PRESENT_MODE_SKIP_SHIM && ust)
+  {
+    if (surf->vblank.ust && msc > surf->vblank.msc &&
+        ust > surf->vblank.ust)
+    {
+      uint64_t period = (ust - surf->vblank.ust) * 1000 /
+          (msc - surf->vblank.msc);
+
+      if (surf->vblank.period_ns)
+        surf->vblank.period_ns = (7 * surf->vblank.period_ns + period) / 8;
+      else
+        surf->vblank.period_ns = period;
+    }
+
+    surf->vblank.ust = ust;
+    surf->vblank.msc = msc;
+  }
+
+  for (i = surf->timings.tail; i != surf->timings.head; i++)
+  {
+    if ((uint32_t)TIMING_SLOT(surf, i)->timing.frame_id == serial)
+      break;
+  }
+
+  if (i == surf->timings.head)
+    return;
+
+  /*
+   * Presents complete in order, older frames still waiting for it were
+   * discarded without one. Do not let them hold back the timings after.
+   */
+  for (j = surf->timings.tail; j != i; j++)
+  {
+    ft = TIMING_SLOT(surf, j);
+
+    if (!ft->complete)
+    {
+      ft->timing.mode = EGL_PRESENT_MODE_SKIP_SHIM;
+      ft->complete = True;
+    }
+  }
+
+  ft = TIMING_SLOT(surf, i);
+  ft->timing.actual_ust = ust;
+  ft->timing.msc = msc;
+  ft->timing.mode = mode;
+  ft->complete = True;
+
+  if (ft->timing.target_msc && msc > ft->timing.target_msc)
+  {
+    ft->timing.missed = EGL_TRUE;
+    surf->missed_count++;
+    LOG_DEBUG(SURFACE, "frame %llu missed target msc %llu by %llu",
+              (unsigned long long)ft->timing.frame_id,
+              (unsigned long long)ft->timing.target_msc,
+              (unsigned long long)(msc - ft->timing.target_msc));
+  }
+}
+
+void
+egl_surface_timing_fail(EGLShimSurface *surf, EGLuint64KHR frame_id)
+{
+  uint32_t i;
+
+  for (i = surf->timings.tail; i != surf->timings.head; i++)
+  {
+    EGLShimFrameTiming *ft = TIMING_SLOT(surf, i);
+
+    if (ft->timing.frame_id == frame_id && !ft->complete)
+    {
+      ft->timing.mode = EGL_PRESENT_MODE_SKIP_SHIM;
+      ft->complete = True;
+      break;
+    }
+  }
+}
+
+uint64_t
+egl_surface_msc_from_time(EGLShimSurface *surf, EGLnsecsANDROID time)
+{
+  uint64_t vblank_ns = surf->vblank.ust * 1000;
+  uint64_t msc = surf->vblank.msc;
+  uint64_t period = surf->vblank.period_ns;
+  uint64_t now_ns, n;
+  struct timespec ts;
+
+  /* no estimate yet, present as soon as possible */
+  if (!period || time <= 0)
+    return 0;
+
+  /*
+   * The last completed present can be many frames old, move to the latest
+   * vblank before now, UST runs on CLOCK_MONOTONIC.
+   */
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  now_ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+  if (now_ns > vblank_ns)
+  {
+    n = (now_ns - vblank_ns) / period;
+    vblank_ns += n * period;
+    msc += n;
+  }
+
+  /* pick the vblank nearest to the requested time, but not one gone by */
+  if ((uint64_t)time > vblank_ns)
+    n = ((uint64_t)time - vblank_ns + period / 2) / period;
+  else
+    n = 0;
+
+  return msc + (n ? n : 1);
+}
+
+EGLint
+egl_surface_timing_get(EGLShimSurface *surf, EGLint count,
+                       EGLPresentTimingSHIM *timings)
+{
+  uint32_t i;
+  EGLint n = 0;
+
+  for (i = surf->timings.tail; i != surf->timings.head; i++)
+  {
+    EGLShimFrameTiming *ft = TIMING_SLOT(surf, i);
+
+    if (!ft->complete)
+      break;
+
+    if (timings)
+    {
+      if (n == count)
+        break;
+
+      timings[n] = ft->timing;
+    }
+
+    n++;
+  }
+
+  if (timings)
+    surf->timings.tail += n;
+
+  return n;
+}
@@ -25,17 +25,53 @@
 #include <xcb/xcb.h>
 
 #include "egl_pixmap.h"
+#include "egl_shim_ext.h"
+
+typedef enum
+{
+  EGL_SHIM_PRESENT_MODE_FIFO,
+  EGL_SHIM_PRESENT_MODE_MAILBOX
+} EGLShimPresentMode;
+
+typedef struct
+{
+  EGLPresentTimingSHIM timing;
+  Bool complete;
+} EGLShimFrameTiming;
 
 struct _EGLShimSurface
 {
   EGLSurface egl_surface;
   xcb_drawable_t drawable;
+  EGLShimScreen *screen;
   struct gbm_surface *gbm_surface;
   xcb_special_event_t *ev;
-  int bpp;
+  EGLShmBuffer *shm;
+  EGLShimHud *hud;
+  const EGLShimFormat *format;
   EGLShimPixmapBufferList buffers;
   uint32_t buf_count;
   uint32_t lock_count;
+  uint32_t max_lock_count;
+  /* flipped, busy until the next flip completes; NULL after a copy */
+  EGLPixmapBuffer *scanout;
+  EGLShimPresentMode present_mode;
+  EGLuint64KHR frame_id;
+  EGLnsecsANDROID present_time;
+  struct
+  {
+    uint64_t ust;
+    uint64_t msc;
+    uint64_t period_ns;
+  } vblank;
+  uint32_t missed_count;
+  EGLStallStatsSHIM stall_stats;
+  struct
+  {
+    EGLShimFrameTiming frames[EGL_PRESENT_TIMING_HISTORY_SHIM];
+    uint32_t head;
+    uint32_t tail;
+  } timings;
 };
 
 EGLShimSurface *
@@ -66,4 +102,24 @@ egl_surface_pixmap_buffer_find_by_serial(EGLShimSurface *surf,
 void
 egl_surface_pixmap_buffers_release(EGLShimSurface *surf);
 
+void
+egl_surface_timing_add(EGLShimSurface *surf, EGLuint64KHR frame_id,
+                       uint64_t target_msc);
+
+void
+egl_surface_timing_complete(EGLShimSurface *surf, uint32_t serial,
+                            uint64_t ust, uint64_t msc, int mode);
+
+/* the frame is never going to be shown, reported as skipped */
+void
+egl_surface_timing_fail(EGLShimSurface *surf, EGLuint64KHR frame_id);
+
+/* 0 without a refresh estimate, otherwise the next vblank at the earliest */
+uint64_t
+egl_surface_msc_from_time(EGLShimSurface *surf, EGLnsecsANDROID time);
+
+EGLint
+egl_surface_timing_get(EGLShimSurface *surf, EGLint count,
+                       EGLPresentTimingSHIM *timings);
+
 #endif // EGL_SHIM_SURFACE_H
@@ -0,0 +1,521 @@
+/*
+ * egl_shm.c
+ *
+ * Copyright (C) 2020 Ivaylo Dimitrov <ivo.g.dimitrov.75@gmail.com>
+ *
+ * This library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "egl_shm.h"
+#include "egl_format.h"
+#include "egl_log.h"
+#include "egl_prime.h"
+#include "egl_shim_display.h"
+
+static Bool
+xcb_check_shm_ext(xcb_connection_t *xcb_conn)
+{
+  xcb_prefetch_extension_data(xcb_conn, &xcb_shm_id);
+
+  const xcb_query_extension_reply_t *extension =
+      xcb_get_extension_data(xcb_conn, &xcb_shm_id);
+
+  if (!(extension && extension->present))
+  {
+    LOG_WARN(SHM, "No MIT-SHM support");
+    return False;
+  }
+
+  xcb_shm_query_version_cookie_t cookie = xcb_shm_query_version(xcb_conn);
+  xcb_shm_query_version_reply_t *reply =
+      xcb_shm_query_version_reply(xcb_conn, cookie, NULL);
+
+  if (!reply)
+  {
+    LOG_ERROR(SHM, "xcb_shm_query_version failed");
+    return False;
+  }
+
+  free(reply);
+
+  return True;
+}
+
+static int
+open_render_node()
+{
+  char path[64];
+  int i;
+
+  for (i = 128; i < 192; i++)
+  {
+    int fd;
+
+    snprintf(path, sizeof(path), "/dev/dri/renderD%d", i);
+
+    if ((fd = open(path, O_RDWR | O_CLOEXEC)) != -1)
+      return fd;
+  }
+
+  LOG_ERROR(SHM, "no render node found");
+
+  return -1;
+}
+
+struct gbm_device *
+egl_shm_create_gbm_device(xcb_connection_t *xcb_conn)
+{
+  struct gbm_device *gbm;
+  int fd;
+
+  if (!xcb_check_shm_ext(xcb_conn))
+    return NULL;
+
+  /* a render node picked with EGL_SHIM_RENDER_NODE/DRI_PRIME wins */
+  if ((fd = egl_prime_open_render_node()) == -1 &&
+      (fd = open_render_node()) == -1)
+  {
+    return NULL;
+  }
+
+  if (!(gbm = gbm_create_device(fd)))
+  {
+    LOG_ERROR(SHM, "failed to create gbm device for the render node");
+    close(fd);
+  }
+
+  return gbm;
+}
+
+static int
+server_bpp_for_depth(xcb_connection_t *xcb_conn, int depth, int *pad)
+{
+  const xcb_setup_t *setup = xcb_get_setup(xcb_conn);
+  xcb_format_iterator_t it;
+
+  *pad = 32;
+
+  for (it = xcb_setup_pixmap_formats_iterator(setup); it.rem;
+       xcb_format_next(&it))
+  {
+    if (it.data->depth == depth)
+    {
+      *pad = it.data->scanline_pad;
+      return it.data->bits_per_pixel;
+    }
+  }
+
+  return 0;
+}
+
+static xcb_visualtype_t *
+find_visual(xcb_connection_t *xcb_conn, xcb_visualid_t visual_id)
+{
+  xcb_screen_iterator_t screens;
+
+  for (screens = xcb_setup_roots_iterator(xcb_get_setup(xcb_conn));
+       screens.rem; xcb_screen_next(&screens))
+  {
+    xcb_depth_iterator_t depths;
+
+    for (depths = xcb_screen_allowed_depths_iterator(screens.data);
+         depths.rem; xcb_depth_next(&depths))
+    {
+      xcb_visualtype_iterator_t visuals;
+
+      for (visuals = xcb_depth_visuals_iterator(depths.data); visuals.rem;
+           xcb_visualtype_next(&visuals))
+      {
+        if (visuals.data->visual_id == visual_id)
+          return visuals.data;
+      }
+    }
+  }
+
+  return NULL;
+}
+
+/*
+ * Picks a conversion from the rendering format to the window pixel layout,
+ * NULL conversion means plain copy. Returns False if there is no kernel for
+ * the combination.
+ */
+static Bool
+choose_conversion(const EGLShimFormat *format, int depth, int bpp,
+                  const xcb_visualtype_t *visual, const EGLConvertImpl **impl)
+{
+  EGLConvertKernel kernel;
+
+  if (format->bpp == bpp && format->depth == depth &&
+      format->red_mask == visual->red_mask &&
+      format->blue_mask == visual->blue_mask)
+  {
+    *impl = NULL;
+    return True;
+  }
+
+  /* ARGB8888 on a depth 24 window, alpha lands in the unused top byte */
+  if (format->bpp == 32 && bpp == 32 && format->depth == 32 && depth == 24 &&
+      format->alpha_mask == 0xff000000 &&
+      format->red_mask == visual->red_mask &&
+      format->blue_mask == visual->blue_mask)
+  {
+    *impl = NULL;
+    return True;
+  }
+
+  if (format->bpp == 24 && bpp == 32 && visual->red_mask == 0x00ff0000 &&
+      visual->blue_mask == 0x000000ff)
+  {
+    if (format->red_mask == 0x00ff0000)
+      kernel = EGL_CONVERT_RGB888_TO_XRGB8888;
+    else
+      kernel = EGL_CONVERT_BGR888_TO_XRGB8888;
+  }
+  else if (format->bpp == 32 && bpp == 32 &&
+           format->red_mask == visual->blue_mask &&
+           format->blue_mask == visual->red_mask &&
+           format->green_mask == 0x0000ff00)
+  {
+    kernel = EGL_CONVERT_SWAP_RB_8888;
+  }
+  else if (format->bpp == 32 && bpp == 32 &&
+           format->red_mask == visual->blue_mask &&
+           format->blue_mask == visual->red_mask &&
+           format->green_mask == 0x00ff0000)
+  {
+    kernel = EGL_CONVERT_SWAP_RB_X8888;
+  }
+  else if (format->bpp == 32 && bpp == 32 && depth == 32 &&
+           !format->alpha_mask && format->red_mask == visual->red_mask &&
+           format->blue_mask == visual->blue_mask)
+  {
+    kernel = EGL_CONVERT_SET_ALPHA_8888;
+  }
+  else if (format->bpp == 32 && bpp == 16 &&
+           format->red_mask == 0x00ff0000 && visual->red_mask == 0xf800)
+  {
+    kernel = EGL_CONVERT_XRGB8888_TO_RGB565;
+  }
+  else
+    return False;
+
+  *impl = egl_convert_get(kernel);
+
+  return True;
+}
+
+/*
+ * Exposure events go to every client that selects them, so a connection of
+ * our own sees them without taking them away from the app. Without one,
+ * every put sends the whole frame.
+ */
+static Bool
+watch_window(EGLShimDisplay *dpy, xcb_window_t win)
+{
+  uint32_t mask = XCB_EVENT_MASK_EXPOSURE | XCB_EVENT_MASK_STRUCTURE_NOTIFY;
+
+  if (!dpy->shm_events)
+  {
+    dpy->shm_events = xcb_connect(DisplayString(dpy->x_dpy), NULL);
+
+    if (xcb_connection_has_error(dpy->shm_events))
+    {
+      LOG_WARN(SHM, "no connection for exposure events, sending full "
+               "frames");
+      xcb_disconnect(dpy->shm_events);
+      dpy->shm_events = NULL;
+      return False;
+    }
+  }
+
+  xcb_change_window_attributes(dpy->shm_events, win, XCB_CW_EVENT_MASK,
+                               &mask);
+  xcb_flush(dpy->shm_events);
+
+  return True;
+}
+
+void
+egl_shm_check_exposures(EGLShimDisplay *dpy)
+{
+  xcb_generic_event_t *ev;
+
+  if (!dpy->shm_events)
+    return;
+
+  while ((ev = xcb_poll_for_event(dpy->shm_events)))
+  {
+    xcb_window_t win = XCB_NONE;
+    EGLShimSurface *surf;
+
+    switch (ev->response_type & ~0x80)
+    {
+      case XCB_EXPOSE:
+        win = ((xcb_expose_event_t *)ev)->window;
+        break;
+      case XCB_MAP_NOTIFY:
+        win = ((xcb_map_notify_event_t *)ev)->window;
+        break;
+      case XCB_CONFIGURE_NOTIFY:
+        win = ((xcb_configure_notify_event_t *)ev)->window;
+        break;
+    }
+
+    free(ev);
+
+    if (win == XCB_NONE)
+      continue;
+
+    surf = egl_shim_surface_list_find_by_drawable(dpy->surfaces, win);
+
+    if (surf && surf->shm)
+      surf->shm->full = True;
+  }
+}
+
+EGLShmBuffer *
+egl_shm_buffer_create(EGLShimDisplay *dpy, EGLShimSurface *surf,
+                      uint32_t width, uint32_t height)
+{
+  EGLShmBuffer *sb;
+  xcb_void_cookie_t cookie;
+  xcb_generic_error_t *error;
+  xcb_get_window_attributes_reply_t *attrs;
+  xcb_get_geometry_reply_t *geom;
+  xcb_visualtype_t *visual = NULL;
+  const EGLConvertImpl *convert;
+  int depth = 0;
+  int bpp, pad;
+
+  attrs = xcb_get_window_attributes_reply(
+        dpy->xcb_conn, xcb_get_window_attributes(dpy->xcb_conn, surf->drawable),
+        NULL);
+  geom = xcb_get_geometry_reply(
+        dpy->xcb_conn, xcb_get_geometry(dpy->xcb_conn, surf->drawable), NULL);
+
+  if (attrs && geom)
+  {
+    visual = find_visual(dpy->xcb_conn, attrs->visual);
+    depth = geom->depth;
+  }
+
+  free(attrs);
+  free(geom);
+
+  if (!visual)
+  {
+    LOG_ERROR(SHM, "failed to get window visual");
+    return NULL;
+  }
+
+  bpp = server_bpp_for_depth(dpy->xcb_conn, depth, &pad);
+
+  if (!choose_conversion(surf->format, depth, bpp, visual, &convert))
+  {
+    LOG_ERROR(SHM, "no conversion from gbm format 0x%08x to %d bpp "
+              "depth %d visual", surf->format->gbm_fourcc, bpp, depth);
+    return NULL;
+  }
+
+  if (convert)
+  {
+    LOG_DEBUG(SHM, "shm present converts with %s kernel %d", convert->name,
+              convert->kernel);
+  }
+
+  sb = calloc(sizeof(EGLShmBuffer), 1);
+  sb->xcb_conn = dpy->xcb_conn;
+  sb->width = width;
+  sb->height = height;
+  sb->depth = depth;
+  sb->bpp = bpp;
+  sb->convert = convert;
+  sb->full = True;
+  sb->stride = ((width * bpp + pad - 1) / pad) * pad / 8;
+
+  if (convert)
+    sb->row = malloc(sb->stride);
+
+  sb->shmid = shmget(IPC_PRIVATE, sb->stride * height, IPC_CREAT | 0600);
+
+  if (sb->shmid == -1)
+  {
+    LOG_ERROR(SHM, "shmget failed: %s", strerror(errno));
+    goto fail;
+  }
+
+  sb->data = shmat(sb->shmid, NULL, 0);
+
+  if (sb->data == (void *)-1)
+  {
+    LOG_ERROR(SHM, "shmat failed: %s", strerror(errno));
+    shmctl(sb->shmid, IPC_RMID, NULL);
+    sb->data = NULL;
+    goto fail;
+  }
+
+  sb->seg = xcb_generate_id(dpy->xcb_conn);
+  cookie = xcb_shm_attach_checked(dpy->xcb_conn, sb->seg, sb->shmid, 1);
+  error = xcb_request_check(dpy->xcb_conn, cookie);
+
+  /*
+   * The segment goes away once both we and the server detach. Only Linux
+   * lets the server attach a segment already marked for removal, so wait
+   * for the attach reply.
+   */
+  shmctl(sb->shmid, IPC_RMID, NULL);
+
+  if (error)
+  {
+    LOG_ERROR(SHM, "shm attach failed %d", error->error_code);
+    free(error);
+    sb->seg = 0;
+    goto fail;
+  }
+
+  sb->gc = xcb_generate_id(dpy->xcb_conn);
+  xcb_create_gc(dpy->xcb_conn, sb->gc, surf->drawable, 0, NULL);
+  sb->watched = watch_window(dpy, surf->drawable);
+
+  return sb;
+
+fail:
+  egl_shm_buffer_destroy(sb);
+
+  return NULL;
+}
+
+void
+egl_shm_buffer_destroy(EGLShmBuffer *sb)
+{
+  if (sb->pending)
+    free(xcb_request_check(sb->xcb_conn, sb->cookie));
+
+  if (sb->gc)
+    xcb_free_gc(sb->xcb_conn, sb->gc);
+
+  if (sb->seg)
+    xcb_shm_detach(sb->xcb_conn, sb->seg);
+
+  if (sb->data)
+    shmdt(sb->data);
+
+  xcb_flush(sb->xcb_conn);
+
+  free(sb->row);
+  free(sb);
+}
+
+void
+egl_shm_buffer_present(EGLShimSurface *surf, EGLShmBuffer *sb,
+                       struct gbm_bo *bo)
+{
+  uint32_t width = gbm_bo_get_width(bo);
+  uint32_t height = gbm_bo_get_height(bo);
+  uint32_t row_size;
+  uint32_t first = height;
+  uint32_t last = 0;
+  uint32_t bo_stride;
+  void *map_data = NULL;
+  uint8_t *src;
+  uint32_t y;
+
+  if (width > sb->width)
+    width = sb->width;
+
+  if (height > sb->height)
+    height = sb->height;
+
+  row_size = width * sb->bpp / 8;
+
+  src = gbm_bo_map(bo, 0, 0, width, height, GBM_BO_TRANSFER_READ,
+                   &bo_stride, &map_data);
+
+  if (!src)
+  {
+    LOG_ERROR(SHM, "failed to map bo");
+    return;
+  }
+
+  /* the server must be done reading the previous frame */
+  if (sb->pending)
+  {
+    free(xcb_request_check(sb->xcb_conn, sb->cookie));
+    sb->pending = False;
+  }
+
+  /*
+   * Only touch and send the rows that changed since the last frame, unless
+   * the window lost its contents since.
+   */
+  if ((sb->full || !sb->watched) && height)
+  {
+    first = 0;
+    last = height - 1;
+  }
+
+  for (y = 0; y < height; y++)
+  {
+    uint8_t *s = src + y * bo_stride;
+    uint8_t *d = sb->data + y * sb->stride;
+
+    if (sb->convert)
+    {
+      sb->convert->fn(sb->row, s, width);
+      s = sb->row;
+    }
+
+    if (memcmp(s, d, row_size))
+    {
+      memcpy(d, s, row_size);
+
+      if (y < first)
+        first = y;
+
+      last = y;
+    }
+  }
+
+  gbm_bo_unmap(bo, map_data);
+
+  if (first > last)
+    return;
+
+  sb->full = False;
+
+  sb->cookie = xcb_shm_put_image_checked(sb->xcb_conn, surf->drawable, sb->gc,
+                                         sb->width, sb->height,
+                                         0, first, width, last - first + 1,
+                                         0, first,
+                                         sb->depth,
+                                         XCB_IMAGE_FORMAT_Z_PIXMAP,
+                                         0, sb->seg, 0);
+  sb->pending = True;
+
+  xcb_flush(sb->xcb_conn);
+
+  LOG_DEBUG(SHM, "shm put rows %u-%u", first, last);
+}
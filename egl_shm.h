@@ -0,0 +1,78 @@
+/*
+ * egl_shm.h
+ *
+ * Copyright (C) 2020 Ivaylo Dimitrov <ivo.g.dimitrov.75@gmail.com>
+ *
+ * This library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef EGL_SHM_H
+#define EGL_SHM_H
+
+#include <gbm.h>
+#include <xcb/xcb.h>
+#include <xcb/shm.h>
+
+#include "defs.h"
+#include "egl_convert.h"
+
+/*
+ * Fallback present path for X servers without DRI3/Present (Xvfb, VNC, ...):
+ * render into linear bos, map them and push the pixels through a MIT-SHM
+ * segment that is reused between frames.
+ */
+struct _EGLShmBuffer
+{
+  xcb_connection_t *xcb_conn;
+  xcb_shm_seg_t seg;
+  xcb_gcontext_t gc;
+  int shmid;
+  uint8_t *data;
+  uint32_t width;
+  uint32_t height;
+  uint32_t stride;
+  int depth;
+  int bpp;
+  const EGLConvertImpl *convert;
+  uint8_t *row;
+  Bool pending;
+  xcb_void_cookie_t cookie;
+  /*
+   * the window lost what was sent (exposed, mapped, resized) or nothing was
+   * sent yet, the next put sends every row
+   */
+  Bool full;
+  /* exposures are tracked, see egl_shm_check_exposures() */
+  Bool watched;
+};
+
+struct gbm_device *
+egl_shm_create_gbm_device(xcb_connection_t *xcb_conn);
+
+EGLShmBuffer *
+egl_shm_buffer_create(EGLShimDisplay *dpy, EGLShimSurface *surf,
+                      uint32_t width, uint32_t height);
+
+void
+egl_shm_buffer_destroy(EGLShmBuffer *sb);
+
+/* marks the shm buffers whose windows need all of their rows again */
+void
+egl_shm_check_exposures(EGLShimDisplay *dpy);
+
+void
+egl_shm_buffer_present(EGLShimSurface *surf, EGLShmBuffer *sb,
+                       struct gbm_bo *bo);
+
+#endif // EGL_SHM_H
@@ -0,0 +1,63 @@
+/*
+ * egl_trace.h
+ *
+ * Copyright (C) 2020 Ivaylo Dimitrov <ivo.g.dimitrov.75@gmail.com>
+ *
+ * This library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * USDT probes (provider egl_shim) for tracing the shim in production with
+ * bpftrace, perf or SystemTap. A probe is a nop unless someone attaches to
+ * it. Builds without <sys/sdt.h> (systemtap-sdt-dev), or with
+ * -DEGL_SHIM_NO_TRACE, get no probes.
+ *
+ * Every probe takes the X drawable of the surface first. serial is the
+ * buffer's, -1 if it has no pixmap yet, lock_count is the number of buffers
+ * the shim holds after the event.
+ *
+ *   swap_begin(drawable, lock_count)
+ *   front_locked(drawable, serial, lock_count)
+ *   wait_begin(drawable, lock_count)
+ *   wait_end(drawable, lock_count, elapsed_ms)
+ *   pixmap_created(drawable, serial, pixmap)
+ *   present_sent(drawable, serial, frame_id, target_msc)
+ *   swap_end(drawable, serial, lock_count)
+ *   idle_received(drawable, serial, frame_id, lock_count)
+ *   complete_received(drawable, frame_id, msc, ust, mode)
+ *
+ * frame_id is the Present serial, idle_received fires for IDLE_NOTIFY events
+ * that are ignored too, in that case lock_count does not change. Example:
+ *
+ *   bpftrace -e 'usdt:./egl_shim.so:egl_shim:present_sent
+ *                { @sent[arg2] = nsecs; }
+ *                usdt:./egl_shim.so:egl_shim:complete_received
+ *                { @lat = hist(nsecs - @sent[arg1]); delete(@sent[arg1]); }'
+ */
+
+#ifndef EGL_TRACE_H
+#define EGL_TRACE_H
+
+#if !defined(EGL_SHIM_NO_TRACE) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define EGL_TRACE(name, ...) STAP_PROBEV(egl_shim, name, __VA_ARGS__)
+#endif
+#endif
+
+#ifndef EGL_TRACE
+#define EGL_TRACE(name, ...) do {} while (0)
+#endif
+
+#endif // EGL_TRACE_H
@@ -0,0 +1,1619 @@
+/*
+ * fake_x_server.c
+ *
+ * Copyright (C) 2020 Ivaylo Dimitrov <ivo.g.dimitrov.75@gmail.com>
+ *
+ * This library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Only little-endian clients on a little-endian host are supported, requests
+ * are decoded in place. Anything not implemented gets a BadRequest error, so
+ * a client waiting for a reply does not hang.
+ *
+ * Xlib opens the display by name, so instead of a socketpair the server
+ * listens on the abstract socket xcb tries first for ":N" display names.
+ */
+
+#define _GNU_SOURCE
+
+#include <xcb/xcb.h>
+#include <xcb/xproto.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "defs.h"
+#include "list.h"
+#include "fake_x_server.h"
+
+#define MAX_CLIENTS 16
+#define MAX_CLIENT_FDS 16
+
+#define ROOT_WINDOW 0x100
+#define ROOT_COLORMAP 0x101
+#define ROOT_WIDTH 1920
+#define ROOT_HEIGHT 1080
+
+#define VISUAL_RGB888 0x21
+#define VISUAL_ARGB8888 0x22
+#define VISUAL_RGB565 0x23
+
+#define CLIENT_ID_SHIFT 21
+#define CLIENT_ID_MASK ((1 << CLIENT_ID_SHIFT) - 1)
+
+#define FIRST_ATOM 69 /* above the predefined ones */
+
+/*
+ * In lockstep, the clock moves when clients have been quiet for that long.
+ * A client that goes quiet is normally blocked on a buffer, so events reach
+ * it at the same point of its swap every run.
+ */
+#define LOCKSTEP_QUIET_NS 500000
+
+/* extension major opcodes, anything above 127 will do */
+#define DRI3_MAJOR 149
+#define PRESENT_MAJOR 150
+
+/* core requests */
+#define X_CreateWindow 1
+#define X_ChangeWindowAttributes 2
+#define X_GetWindowAttributes 3
+#define X_DestroyWindow 4
+#define X_MapWindow 8
+#define X_UnmapWindow 10
+#define X_ConfigureWindow 12
+#define X_GetGeometry 14
+#define X_InternAtom 16
+#define X_ChangeProperty 18
+#define X_DeleteProperty 19
+#define X_GetProperty 20
+#define X_GetInputFocus 43
+#define X_FreePixmap 54
+#define X_CreateGC 55
+#define X_ChangeGC 56
+#define X_FreeGC 60
+#define X_CreateColormap 78
+#define X_FreeColormap 79
+#define X_QueryExtension 98
+#define X_ListExtensions 99
+#define X_Bell 104
+#define X_NoOperation 127
+
+/* DRI3 minor opcodes */
+#define X_DRI3QueryVersion 0
+#define X_DRI3Open 1
+#define X_DRI3PixmapFromBuffer 2
+
+/* Present minor opcodes */
+#define X_PresentQueryVersion 0
+#define X_PresentPixmap 1
+#define X_PresentNotifyMSC 2
+#define X_PresentSelectInput 3
+#define X_PresentQueryCapabilities 4
+
+/* Present event types and masks */
+#define PRESENT_CONFIGURE_NOTIFY 0
+#define PRESENT_COMPLETE_NOTIFY 1
+#define PRESENT_IDLE_NOTIFY 2
+#define PRESENT_MASK_CONFIGURE 1
+#define PRESENT_MASK_COMPLETE 2
+#define PRESENT_MASK_IDLE 4
+#define PRESENT_KIND_PIXMAP 0
+#define PRESENT_KIND_NOTIFY_MSC 1
+#define PRESENT_MODE_COPY 0
+#define PRESENT_MODE_FLIP 1
+#define PRESENT_MODE_SKIP 2
+
+#define BAD_REQUEST 1
+#define BAD_WINDOW 3
+#define BAD_DRAWABLE 9
+#define BAD_LENGTH 16
+
+#define GENERIC_EVENT 35
+
+typedef struct
+{
+  int fd;
+  int index;
+  Bool setup_done;
+  uint16_t seq;
+  uint8_t *buf;
+  size_t len;
+  size_t size;
+  int fds[MAX_CLIENT_FDS];
+  int nfds;
+} FakeXClient;
+
+typedef struct
+{
+  uint32_t id;
+  uint32_t parent;
+  uint32_t visual;
+  int16_t x;
+  int16_t y;
+  uint16_t width;
+  uint16_t height;
+  uint8_t depth;
+  Bool mapped;
+  uint32_t flip_pixmap;   /* on screen, when flipping */
+  uint32_t flip_serial;
+} FakeWindow;
+
+typedef struct
+{
+  uint32_t id;
+  uint32_t drawable;
+  uint16_t width;
+  uint16_t height;
+  uint8_t depth;
+} FakePixmap;
+
+typedef struct
+{
+  uint32_t window;
+  uint32_t pixmap;        /* 0 for NotifyMSC */
+  uint32_t serial;
+  uint64_t msc;           /* vblank it gets executed at */
+} FakePresent;
+
+typedef struct
+{
+  FakeXClient *client;
+  uint32_t eid;
+  uint32_t window;
+  uint32_t mask;
+} FakeSelection;
+
+typedef struct
+{
+  char *name;
+  uint32_t atom;
+} FakeAtom;
+
+struct _FakeXServer
+{
+  int listen_fd;
+  int wake_fd[2];
+  pthread_t thread;
+  char display_name[32];
+  FakeXClient *clients[MAX_CLIENTS];
+  slist *windows;
+  slist *pixmaps;
+  slist *selections;
+  slist *atoms;
+  uint32_t next_atom;
+  FakeXConfig config;
+  slist *presents;
+  uint64_t msc;
+  uint64_t start_ust;     /* of msc 0 */
+  uint64_t start_ns;      /* real time of msc 0 when not in lockstep */
+  uint64_t idle_count;
+  uint64_t last_request_ns;
+  FakeXStats stats;
+};
+
+static const struct
+{
+  const char *name;
+  uint8_t major;
+} extensions[] =
+{
+  {"DRI3", DRI3_MAJOR},
+  {"Present", PRESENT_MAJOR},
+};
+
+#define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
+#define PAD4(x) (((x) + 3) & ~3)
+
+static uint16_t
+get16(const uint8_t *p)
+{
+  uint16_t v;
+
+  memcpy(&v, p, sizeof(v));
+
+  return v;
+}
+
+static uint32_t
+get32(const uint8_t *p)
+{
+  uint32_t v;
+
+  memcpy(&v, p, sizeof(v));
+
+  return v;
+}
+
+static uint64_t
+get64(const uint8_t *p)
+{
+  uint64_t v;
+
+  memcpy(&v, p, sizeof(v));
+
+  return v;
+}
+
+static void
+put16(uint8_t *p, uint16_t v)
+{
+  memcpy(p, &v, sizeof(v));
+}
+
+static void
+put32(uint8_t *p, uint32_t v)
+{
+  memcpy(p, &v, sizeof(v));
+}
+
+static void
+put64(uint8_t *p, uint64_t v)
+{
+  memcpy(p, &v, sizeof(v));
+}
+
+static uint64_t
+get_time_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t
+get_time_us(void)
+{
+  return get_time_ns() / 1000;
+}
+
+static void
+stats_inc(uint64_t *counter)
+{
+  __atomic_add_fetch(counter, 1, __ATOMIC_RELAXED);
+}
+
+static void
+client_send(FakeXClient *c, const void *data, size_t len, int fd)
+{
+  const uint8_t *p = data;
+  union
+  {
+    struct cmsghdr hdr;
+    char buf[CMSG_SPACE(sizeof(int))];
+  } cmsg;
+
+  while (len && c->fd != -1)
+  {
+    struct iovec iov = {(void *)p, len};
+    struct msghdr msg = {0};
+    ssize_t n;
+
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if (fd != -1)
+    {
+      msg.msg_control = cmsg.buf;
+      msg.msg_controllen = sizeof(cmsg.buf);
+      cmsg.hdr.cmsg_level = SOL_SOCKET;
+      cmsg.hdr.cmsg_type = SCM_RIGHTS;
+      cmsg.hdr.cmsg_len = CMSG_LEN(sizeof(int));
+      memcpy(CMSG_DATA(&cmsg.hdr), &fd, sizeof(int));
+    }
+
+    n = sendmsg(c->fd, &msg, MSG_NOSIGNAL);
+
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+
+      /* client is gone, it gets cleaned up on the next poll */
+      shutdown(c->fd, SHUT_RDWR);
+      return;
+    }
+
+    fd = -1;
+    p += n;
+    len -= n;
+  }
+}
+
+static void
+send_reply(FakeXServer *srv, FakeXClient *c, uint8_t *rep, size_t len,
+           int fd)
+{
+  rep[0] = 1;
+  put16(rep + 2, c->seq);
+  put32(rep + 4, (len - 32) / 4);
+  client_send(c, rep, len, fd);
+  stats_inc(&srv->stats.replies);
+}
+
+static void
+send_error(FakeXServer *srv, FakeXClient *c, uint8_t code, uint32_t value,
+           uint8_t major, uint16_t minor)
+{
+  uint8_t err[32] = {0};
+
+  err[1] = code;
+  put16(err + 2, c->seq);
+  put32(err + 4, value);
+  put16(err + 8, minor);
+  err[10] = major;
+  client_send(c, err, sizeof(err), -1);
+  stats_inc(&srv->stats.errors);
+}
+
+static int
+match_window(const void *data, const void *user_data)
+{
+  return ((const FakeWindow *)data)->id == (uintptr_t)user_data;
+}
+
+static FakeWindow *
+find_window(FakeXServer *srv, uint32_t id)
+{
+  slist *l = slist_find(srv->windows, match_window, (void *)(uintptr_t)id);
+
+  return l ? l->data : NULL;
+}
+
+static int
+match_pixmap(const void *data, const void *user_data)
+{
+  return ((const FakePixmap *)data)->id == (uintptr_t)user_data;
+}
+
+static FakePixmap *
+find_pixmap(FakeXServer *srv, uint32_t id)
+{
+  slist *l = slist_find(srv->pixmaps, match_pixmap, (void *)(uintptr_t)id);
+
+  return l ? l->data : NULL;
+}
+
+static FakeWindow *
+add_window(FakeXServer *srv, uint32_t id, uint32_t parent, uint32_t visual,
+           uint16_t width, uint16_t height, uint8_t depth)
+{
+  FakeWindow *win = calloc(1, sizeof(*win));
+
+  win->id = id;
+  win->parent = parent;
+  win->visual = visual;
+  win->width = width;
+  win->height = height;
+  win->depth = depth;
+  srv->windows = slist_append(srv->windows, win);
+
+  return win;
+}
+
+static int
+client_take_fd(FakeXClient *c)
+{
+  int fd;
+
+  if (!c->nfds)
+    return -1;
+
+  fd = c->fds[0];
+  memmove(c->fds, c->fds + 1, --c->nfds * sizeof(int));
+
+  return fd;
+}
+
+/*
+ * Present
+ */
+
+static void
+send_present_event(FakeXServer *srv, FakeSelection *sel, uint8_t *ev,
+                   size_t len, uint16_t evtype)
+{
+  ev[0] = GENERIC_EVENT;
+  ev[1] = PRESENT_MAJOR;
+  put16(ev + 2, sel->client->seq);
+  put32(ev + 4, (len - 32) / 4);
+  put16(ev + 8, evtype);
+  put32(ev + 12, sel->eid);
+  put32(ev + 16, sel->window);
+  client_send(sel->client, ev, len, -1);
+  stats_inc(&srv->stats.events);
+}
+
+static void
+send_idle_notify(FakeXServer *srv, uint32_t window, uint32_t serial,
+                 uint32_t pixmap)
+{
+  slist *l;
+
+  slist_for_each(srv->selections, l)
+  {
+    FakeSelection *sel = l->data;
+    uint8_t ev[32] = {0};
+
+    if (sel->window != window || !(sel->mask & PRESENT_MASK_IDLE))
+      continue;
+
+    put32(ev + 20, serial);
+    put32(ev + 24, pixmap);
+    send_present_event(srv, sel, ev, sizeof(ev), PRESENT_IDLE_NOTIFY);
+  }
+}
+
+static void
+send_complete_notify(FakeXServer *srv, uint32_t window, uint8_t kind,
+                     uint8_t mode, uint32_t serial, uint64_t ust,
+                     uint64_t msc)
+{
+  slist *l;
+
+  slist_for_each(srv->selections, l)
+  {
+    FakeSelection *sel = l->data;
+    uint8_t ev[40] = {0};
+
+    if (sel->window != window || !(sel->mask & PRESENT_MASK_COMPLETE))
+      continue;
+
+    ev[10] = kind;
+    ev[11] = mode;
+    put32(ev + 20, serial);
+    put64(ev + 24, ust);
+    put64(ev + 32, msc);
+    send_present_event(srv, sel, ev, sizeof(ev), PRESENT_COMPLETE_NOTIFY);
+  }
+}
+
+static void
+send_configure_notify(FakeXServer *srv, FakeWindow *win)
+{
+  slist *l;
+
+  slist_for_each(srv->selections, l)
+  {
+    FakeSelection *sel = l->data;
+    uint8_t ev[40] = {0};
+
+    if (sel->window != win->id || !(sel->mask & PRESENT_MASK_CONFIGURE))
+      continue;
+
+    put16(ev + 20, win->x);
+    put16(ev + 22, win->y);
+    put16(ev + 24, win->width);
+    put16(ev + 26, win->height);
+    put16(ev + 32, win->width);
+    put16(ev + 34, win->height);
+    send_present_event(srv, sel, ev, sizeof(ev), PRESENT_CONFIGURE_NOTIFY);
+  }
+}
+
+/*
+ * vblank model
+ */
+
+static uint64_t
+splitmix64(uint64_t x)
+{
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+
+  return x ^ (x >> 31);
+}
+
+/* the same msc always gets the same timestamp */
+static uint64_t
+vblank_ust(FakeXServer *srv, uint64_t msc)
+{
+  const FakeXConfig *config = &srv->config;
+  uint64_t ust;
+
+  if (!config->refresh_hz)
+    return get_time_us();
+
+  ust = srv->start_ust + msc * 1000000ULL / config->refresh_hz;
+
+  if (config->jitter_us)
+  {
+    ust += splitmix64(config->seed ^ msc) % (2 * config->jitter_us + 1);
+    ust -= config->jitter_us;
+  }
+
+  return ust;
+}
+
+static void
+pixmap_idle(FakeXServer *srv, uint32_t window, uint32_t serial,
+            uint32_t pixmap)
+{
+  if (srv->config.drop_idle_every &&
+      ++srv->idle_count % srv->config.drop_idle_every == 0)
+  {
+    stats_inc(&srv->stats.dropped_idles);
+    return;
+  }
+
+  send_idle_notify(srv, window, serial, pixmap);
+}
+
+/* like the real server, IDLE goes out before COMPLETE */
+static void
+execute_present(FakeXServer *srv, FakePresent *present, uint64_t ust)
+{
+  FakeWindow *win = find_window(srv, present->window);
+  uint8_t mode = PRESENT_MODE_COPY;
+
+  if (!present->pixmap)
+  {
+    send_complete_notify(srv, present->window, PRESENT_KIND_NOTIFY_MSC,
+                         PRESENT_MODE_COPY, present->serial, ust, srv->msc);
+    return;
+  }
+
+  if (srv->config.flip && win)
+  {
+    if (win->flip_pixmap)
+      pixmap_idle(srv, win->id, win->flip_serial, win->flip_pixmap);
+
+    win->flip_pixmap = present->pixmap;
+    win->flip_serial = present->serial;
+    mode = PRESENT_MODE_FLIP;
+    stats_inc(&srv->stats.flips);
+  }
+  else
+    pixmap_idle(srv, present->window, present->serial, present->pixmap);
+
+  send_complete_notify(srv, present->window, PRESENT_KIND_PIXMAP, mode,
+                       present->serial, ust, srv->msc);
+}
+
+static void
+run_vblank(FakeXServer *srv, uint64_t msc)
+{
+  uint64_t ust;
+  slist *l = srv->presents;
+
+  srv->msc = msc;
+  __atomic_store_n(&srv->stats.msc, msc, __ATOMIC_RELAXED);
+  ust = vblank_ust(srv, msc);
+
+  while (l)
+  {
+    FakePresent *present = l->data;
+
+    l = l->next;
+
+    if (present->msc <= msc)
+    {
+      execute_present(srv, present, ust);
+      srv->presents = slist_remove(srv->presents, present, free);
+    }
+  }
+}
+
+static uint64_t
+vblank_period_ns(FakeXServer *srv)
+{
+  return 1000000000ULL / srv->config.refresh_hz / srv->config.speedup;
+}
+
+/* time until the next real time vblank, -1 if there is no such clock */
+static int64_t
+next_vblank_timeout_ns(FakeXServer *srv)
+{
+  uint64_t next, now;
+
+  if (!srv->config.refresh_hz)
+    return -1;
+
+  now = get_time_ns();
+
+  if (!srv->config.speedup)
+  {
+    if (!srv->presents)
+      return -1;
+
+    next = srv->last_request_ns + LOCKSTEP_QUIET_NS;
+  }
+  else
+    next = srv->start_ns + (srv->msc + 1) * vblank_period_ns(srv);
+
+
+  return next > now ? next - now : 0;
+}
+
+static void
+update_clock(FakeXServer *srv)
+{
+  uint64_t msc;
+
+  if (!srv->config.refresh_hz)
+    return;
+
+  /* one vblank at a time, so presents can still be queued for the next one */
+  if (!srv->config.speedup)
+  {
+    if (srv->presents &&
+        get_time_ns() - srv->last_request_ns >= LOCKSTEP_QUIET_NS)
+    {
+      run_vblank(srv, srv->msc + 1);
+    }
+
+    return;
+  }
+
+  msc = (get_time_ns() - srv->start_ns) / vblank_period_ns(srv);
+
+  while (srv->msc < msc)
+    run_vblank(srv, srv->msc + 1);
+}
+
+static void
+queue_present(FakeXServer *srv, uint32_t window, uint32_t pixmap,
+              uint32_t serial, uint64_t target_msc)
+{
+  FakePresent *present;
+  uint64_t msc = srv->msc + 1;
+  slist *l;
+
+  if (pixmap)
+  {
+    stats_inc(&srv->stats.presents);
+    msc += srv->config.latency_frames;
+  }
+
+  if (srv->config.refresh_hz && target_msc > msc)
+    msc = target_msc;
+
+  /* a newer present for the same vblank replaces the queued one */
+  l = srv->presents;
+
+  while (pixmap && l)
+  {
+    present = l->data;
+    l = l->next;
+
+    if (present->window != window || present->msc != msc || !present->pixmap)
+      continue;
+
+    pixmap_idle(srv, window, present->serial, present->pixmap);
+    send_complete_notify(srv, window, PRESENT_KIND_PIXMAP, PRESENT_MODE_SKIP,
+                         present->serial, vblank_ust(srv, srv->msc),
+                         srv->msc);
+    srv->presents = slist_remove(srv->presents, present, free);
+    stats_inc(&srv->stats.skips);
+  }
+
+  present = calloc(1, sizeof(*present));
+  present->window = window;
+  present->pixmap = pixmap;
+  present->serial = serial;
+  present->msc = msc;
+  srv->presents = slist_append(srv->presents, present);
+
+  if (!srv->config.refresh_hz)
+    run_vblank(srv, msc);
+}
+
+static void
+remove_presents(FakeXServer *srv, uint32_t window)
+{
+  slist *l = srv->presents;
+
+  while (l)
+  {
+    FakePresent *present = l->data;
+
+    l = l->next;
+
+    if (present->window == window)
+      srv->presents = slist_remove(srv->presents, present, free);
+  }
+}
+
+static void
+remove_selections(FakeXServer *srv, FakeXClient *c, uint32_t window)
+{
+  slist *l = srv->selections;
+
+  while (l)
+  {
+    FakeSelection *sel = l->data;
+
+    l = l->next;
+
+    if ((c && sel->client == c) || (window && sel->window == window))
+      srv->selections = slist_remove(srv->selections, sel, free);
+  }
+}
+
+static void
+select_input(FakeXServer *srv, FakeXClient *c, uint32_t eid,
+             uint32_t window, uint32_t mask)
+{
+  slist *l;
+  FakeSelection *sel;
+
+  slist_for_each(srv->selections, l)
+  {
+    sel = l->data;
+
+    if (sel->client == c && sel->eid == eid)
+    {
+      if (mask)
+        sel->mask = mask;
+      else
+        srv->selections = slist_remove(srv->selections, sel, free);
+
+      return;
+    }
+  }
+
+  if (!mask)
+    return;
+
+  sel = calloc(1, sizeof(*sel));
+  sel->client = c;
+  sel->eid = eid;
+  sel->window = window;
+  sel->mask = mask;
+  srv->selections = slist_append(srv->selections, sel);
+}
+
+static void
+handle_present(FakeXServer *srv, FakeXClient *c, const uint8_t *req,
+               size_t len)
+{
+  uint8_t rep[32] = {0};
+
+  switch (req[1])
+  {
+    case X_PresentQueryVersion:
+    {
+      put32(rep + 8, 1);
+      put32(rep + 12, 2);
+      send_reply(srv, c, rep, sizeof(rep), -1);
+      break;
+    }
+    case X_PresentPixmap:
+    {
+      if (len < 72)
+        send_error(srv, c, BAD_LENGTH, 0, req[0], req[1]);
+      else if (!find_window(srv, get32(req + 4)))
+        send_error(srv, c, BAD_WINDOW, get32(req + 4), req[0], req[1]);
+      else if (!find_pixmap(srv, get32(req + 8)))
+        send_error(srv, c, BAD_DRAWABLE, get32(req + 8), req[0], req[1]);
+      else
+      {
+        queue_present(srv, get32(req + 4), get32(req + 8), get32(req + 12),
+                      get64(req + 48));
+      }
+
+      break;
+    }
+    case X_PresentNotifyMSC:
+    {
+      if (!find_window(srv, get32(req + 4)))
+        send_error(srv, c, BAD_WINDOW, get32(req + 4), req[0], req[1]);
+      else
+        queue_present(srv, get32(req + 4), 0, get32(req + 8), get64(req + 16));
+
+      break;
+    }
+    case X_PresentSelectInput:
+    {
+      if (!find_window(srv, get32(req + 8)))
+        send_error(srv, c, BAD_WINDOW, get32(req + 8), req[0], req[1]);
+      else
+        select_input(srv, c, get32(req + 4), get32(req + 8), get32(req + 12));
+
+      break;
+    }
+    case X_PresentQueryCapabilities:
+    {
+      send_reply(srv, c, rep, sizeof(rep), -1);
+      break;
+    }
+    default:
+      send_error(srv, c, BAD_REQUEST, 0, req[0], req[1]);
+  }
+}
+
+/*
+ * DRI3
+ */
+
+static void
+handle_dri3(FakeXServer *srv, FakeXClient *c, const uint8_t *req, size_t len)
+{
+  uint8_t rep[32] = {0};
+
+  switch (req[1])
+  {
+    case X_DRI3QueryVersion:
+    {
+      put32(rep + 8, 1);
+      put32(rep + 12, 0);
+      send_reply(srv, c, rep, sizeof(rep), -1);
+      break;
+    }
+    case X_DRI3Open:
+    {
+      /* no device behind it, the stub gbm never touches the fd */
+      int fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+
+      rep[1] = 1;
+      send_reply(srv, c, rep, sizeof(rep), fd);
+      close(fd);
+      break;
+    }
+    case X_DRI3PixmapFromBuffer:
+    {
+      int fd = client_take_fd(c);
+      FakePixmap *pixmap;
+
+      if (fd == -1)
+      {
+        send_error(srv, c, BAD_LENGTH, 0, req[0], req[1]);
+        break;
+      }
+
+      close(fd);
+
+      pixmap = calloc(1, sizeof(*pixmap));
+      pixmap->id = get32(req + 4);
+      pixmap->drawable = get32(req + 8);
+      pixmap->width = get16(req + 16);
+      pixmap->height = get16(req + 18);
+      pixmap->depth = req[22];
+      srv->pixmaps = slist_append(srv->pixmaps, pixmap);
+      stats_inc(&srv->stats.pixmaps);
+      break;
+    }
+    default:
+      send_error(srv, c, BAD_REQUEST, 0, req[0], req[1]);
+  }
+}
+
+/*
+ * core protocol
+ */
+
+static uint32_t
+intern_atom(FakeXServer *srv, const char *name, size_t len, Bool only_if_exists)
+{
+  FakeAtom *atom;
+  slist *l;
+
+  slist_for_each(srv->atoms, l)
+  {
+    atom = l->data;
+
+    if (strlen(atom->name) == len && !memcmp(atom->name, name, len))
+      return atom->atom;
+  }
+
+  if (only_if_exists)
+    return 0;
+
+  atom = calloc(1, sizeof(*atom));
+  atom->name = strndup(name, len);
+  atom->atom = srv->next_atom++;
+  srv->atoms = slist_append(srv->atoms, atom);
+
+  return atom->atom;
+}
+
+static void
+configure_window(FakeXServer *srv, FakeWindow *win, const uint8_t *req)
+{
+  uint16_t mask = get16(req + 8);
+  const uint8_t *v = req + 12;
+  Bool resized = False;
+
+  if (mask & XCB_CONFIG_WINDOW_X)
+  {
+    win->x = get32(v);
+    v += 4;
+  }
+
+  if (mask & XCB_CONFIG_WINDOW_Y)
+  {
+    win->y = get32(v);
+    v += 4;
+  }
+
+  if (mask & XCB_CONFIG_WINDOW_WIDTH)
+  {
+    resized |= win->width != get32(v);
+    win->width = get32(v);
+    v += 4;
+  }
+
+  if (mask & XCB_CONFIG_WINDOW_HEIGHT)
+  {
+    resized |= win->height != get32(v);
+    win->height = get32(v);
+    v += 4;
+  }
+
+  if (resized)
+    send_configure_notify(srv, win);
+}
+
+static void
+destroy_window(FakeXServer *srv, FakeWindow *win)
+{
+  remove_presents(srv, win->id);
+  remove_selections(srv, NULL, win->id);
+  srv->windows = slist_remove(srv->windows, win, free);
+}
+
+static void
+handle_core(FakeXServer *srv, FakeXClient *c, const uint8_t *req, size_t len)
+{
+  uint8_t rep[64] = {0};
+  FakeWindow *win;
+  int i;
+
+  switch (req[0])
+  {
+    case X_CreateWindow:
+    {
+      FakeWindow *parent = find_window(srv, get32(req + 8));
+      uint32_t visual = get32(req + 24);
+
+      if (!parent)
+      {
+        send_error(srv, c, BAD_WINDOW, get32(req + 8), req[0], 0);
+        break;
+      }
+
+      win = add_window(srv, get32(req + 4), parent->id,
+                       visual ? visual : parent->visual, get16(req + 16),
+                       get16(req + 18), req[1] ? req[1] : parent->depth);
+      win->x = get16(req + 12);
+      win->y = get16(req + 14);
+      break;
+    }
+    case X_GetWindowAttributes:
+    {
+      if (!(win = find_window(srv, get32(req + 4))))
+      {
+        send_error(srv, c, BAD_WINDOW, get32(req + 4), req[0], 0);
+        break;
+      }
+
+      put32(rep + 8, win->visual);
+      put16(rep + 12, XCB_WINDOW_CLASS_INPUT_OUTPUT);
+      rep[26] = win->mapped ? XCB_MAP_STATE_VIEWABLE : XCB_MAP_STATE_UNMAPPED;
+      put32(rep + 28, ROOT_COLORMAP);
+      send_reply(srv, c, rep, 44, -1);
+      break;
+    }
+    case X_DestroyWindow:
+    {
+      if ((win = find_window(srv, get32(req + 4))) && win->id != ROOT_WINDOW)
+        destroy_window(srv, win);
+
+      break;
+    }
+    case X_MapWindow:
+    case X_UnmapWindow:
+    {
+      if ((win = find_window(srv, get32(req + 4))))
+        win->mapped = req[0] == X_MapWindow;
+
+      break;
+    }
+    case X_ConfigureWindow:
+    {
+      if ((win = find_window(srv, get32(req + 4))))
+        configure_window(srv, win, req);
+      else
+        send_error(srv, c, BAD_WINDOW, get32(req + 4), req[0], 0);
+
+      break;
+    }
+    case X_GetGeometry:
+    {
+      uint32_t drawable = get32(req + 4);
+      FakePixmap *pixmap;
+
+      if ((win = find_window(srv, drawable)))
+      {
+        rep[1] = win->depth;
+        put16(rep + 12, win->x);
+        put16(rep + 14, win->y);
+        put16(rep + 16, win->width);
+        put16(rep + 18, win->height);
+      }
+      else if ((pixmap = find_pixmap(srv, drawable)))
+      {
+        rep[1] = pixmap->depth;
+        put16(rep + 16, pixmap->width);
+        put16(rep + 18, pixmap->height);
+      }
+      else
+      {
+        send_error(srv, c, BAD_DRAWABLE, drawable, req[0], 0);
+        break;
+      }
+
+      put32(rep + 8, ROOT_WINDOW);
+      send_reply(srv, c, rep, 32, -1);
+      break;
+    }
+    case X_InternAtom:
+    {
+      uint16_t name_len = get16(req + 4);
+
+      if (8 + name_len > len)
+      {
+        send_error(srv, c, BAD_LENGTH, 0, req[0], 0);
+        break;
+      }
+
+      put32(rep + 8, intern_atom(srv, (const char *)req + 8, name_len,
+                                 req[1]));
+      send_reply(srv, c, rep, 32, -1);
+      break;
+    }
+    case X_GetProperty:
+    {
+      /* no properties anywhere, type None */
+      send_reply(srv, c, rep, 32, -1);
+      break;
+    }
+    case X_GetInputFocus:
+    {
+      rep[1] = XCB_INPUT_FOCUS_POINTER_ROOT;
+      put32(rep + 8, ROOT_WINDOW);
+      send_reply(srv, c, rep, 32, -1);
+      break;
+    }
+    case X_FreePixmap:
+    {
+      FakePixmap *pixmap = find_pixmap(srv, get32(req + 4));
+
+      if (pixmap)
+        srv->pixmaps = slist_remove(srv->pixmaps, pixmap, free);
+
+      break;
+    }
+    case X_QueryExtension:
+    {
+      uint16_t name_len = get16(req + 4);
+
+      for (i = 0; i < ARRAY_SIZE(extensions); i++)
+      {
+        if (strlen(extensions[i].name) == name_len &&
+            !memcmp(extensions[i].name, req + 8, name_len))
+        {
+          rep[8] = 1;
+          rep[9] = extensions[i].major;
+        }
+      }
+
+      send_reply(srv, c, rep, 32, -1);
+      break;
+    }
+    case X_ListExtensions:
+    {
+      uint8_t *p = rep + 32;
+
+      for (i = 0; i < ARRAY_SIZE(extensions); i++)
+      {
+        *p++ = strlen(extensions[i].name);
+        memcpy(p, extensions[i].name, strlen(extensions[i].name));
+        p += strlen(extensions[i].name);
+      }
+
+      rep[1] = ARRAY_SIZE(extensions);
+      send_reply(srv, c, rep, PAD4(p - rep), -1);
+      break;
+    }
+    case X_ChangeWindowAttributes:
+    case X_ChangeProperty:
+    case X_DeleteProperty:
+    case X_CreateGC:
+    case X_ChangeGC:
+    case X_FreeGC:
+    case X_CreateColormap:
+    case X_FreeColormap:
+    case X_Bell:
+    case X_NoOperation:
+      break;
+    default:
+      send_error(srv, c, BAD_REQUEST, 0, req[0], 0);
+  }
+}
+
+static void
+send_setup(FakeXServer *srv, FakeXClient *c)
+{
+  static const char vendor[] = "egl-shim fake server";
+  static const xcb_format_t formats[] =
+  {
+    {1, 1, 32},
+    {16, 16, 32},
+    {24, 32, 32},
+    {32, 32, 32},
+  };
+  static const struct
+  {
+    uint8_t depth;
+    xcb_visualtype_t visual;
+  } visuals[] =
+  {
+    {24, {VISUAL_RGB888, XCB_VISUAL_CLASS_TRUE_COLOR, 8, 256,
+          0xff0000, 0x00ff00, 0x0000ff}},
+    {32, {VISUAL_ARGB8888, XCB_VISUAL_CLASS_TRUE_COLOR, 8, 256,
+          0xff0000, 0x00ff00, 0x0000ff}},
+    {16, {VISUAL_RGB565, XCB_VISUAL_CLASS_TRUE_COLOR, 6, 64,
+          0xf800, 0x07e0, 0x001f}},
+  };
+  uint8_t buf[1024] = {0};
+  xcb_setup_t *setup = (xcb_setup_t *)buf;
+  xcb_screen_t *screen;
+  uint8_t *p = buf + sizeof(*setup);
+  int i;
+
+  setup->status = 1;
+  setup->protocol_major_version = 11;
+  setup->release_number = 1;
+  setup->resource_id_base = (c->index + 1) << CLIENT_ID_SHIFT;
+  setup->resource_id_mask = CLIENT_ID_MASK;
+  setup->vendor_len = strlen(vendor);
+  setup->maximum_request_length = 0xffff;
+  setup->roots_len = 1;
+  setup->pixmap_formats_len = ARRAY_SIZE(formats);
+  setup->image_byte_order = XCB_IMAGE_ORDER_LSB_FIRST;
+  setup->bitmap_format_bit_order = XCB_IMAGE_ORDER_LSB_FIRST;
+  setup->bitmap_format_scanline_unit = 32;
+  setup->bitmap_format_scanline_pad = 32;
+  setup->min_keycode = 8;
+  setup->max_keycode = 255;
+
+  memcpy(p, vendor, strlen(vendor));
+  p += PAD4(strlen(vendor));
+
+  memcpy(p, formats, sizeof(formats));
+  p += sizeof(formats);
+
+  screen = (xcb_screen_t *)p;
+  screen->root = ROOT_WINDOW;
+  screen->default_colormap = ROOT_COLORMAP;
+  screen->white_pixel = 0xffffff;
+  screen->width_in_pixels = ROOT_WIDTH;
+  screen->height_in_pixels = ROOT_HEIGHT;
+  screen->width_in_millimeters = ROOT_WIDTH / 4;
+  screen->height_in_millimeters = ROOT_HEIGHT / 4;
+  screen->min_installed_maps = 1;
+  screen->max_installed_maps = 1;
+  screen->root_visual = VISUAL_RGB888;
+  screen->root_depth = 24;
+  screen->allowed_depths_len = ARRAY_SIZE(visuals);
+  p += sizeof(*screen);
+
+  for (i = 0; i < ARRAY_SIZE(visuals); i++)
+  {
+    xcb_depth_t *depth = (xcb_depth_t *)p;
+
+    depth->depth = visuals[i].depth;
+    depth->visuals_len = 1;
+    p += sizeof(*depth);
+    memcpy(p, &visuals[i].visual, sizeof(visuals[i].visual));
+    p += sizeof(visuals[i].visual);
+  }
+
+  setup->length = (p - buf - 8) / 4;
+  client_send(c, buf, p - buf, -1);
+  c->setup_done = True;
+}
+
+/* returns the number of bytes consumed, 0 if the request is incomplete */
+static size_t
+handle_request(FakeXServer *srv, FakeXClient *c, const uint8_t *req,
+               size_t avail)
+{
+  size_t len;
+
+  if (!c->setup_done)
+  {
+    if (avail < 12)
+      return 0;
+
+    len = 12 + PAD4(get16(req + 6)) + PAD4(get16(req + 8));
+
+    if (avail < len)
+      return 0;
+
+    if (req[0] != 'l')
+    {
+      fprintf(stderr, "fake X server: big-endian clients not supported\n");
+      shutdown(c->fd, SHUT_RDWR);
+      return avail;
+    }
+
+    send_setup(srv, c);
+
+    return len;
+  }
+
+  if (avail < 4)
+    return 0;
+
+  len = get16(req + 2) * 4;
+
+  /* BIG-REQUESTS is not advertised, so this is a broken client */
+  if (!len)
+  {
+    shutdown(c->fd, SHUT_RDWR);
+    return avail;
+  }
+
+  if (avail < len)
+    return 0;
+
+  c->seq++;
+  stats_inc(&srv->stats.requests);
+
+  if (req[0] == DRI3_MAJOR)
+    handle_dri3(srv, c, req, len);
+  else if (req[0] == PRESENT_MAJOR)
+    handle_present(srv, c, req, len);
+  else
+    handle_core(srv, c, req, len);
+
+  return len;
+}
+
+static Bool
+client_read(FakeXServer *srv, FakeXClient *c)
+{
+  union
+  {
+    struct cmsghdr hdr;
+    char buf[CMSG_SPACE(sizeof(int) * MAX_CLIENT_FDS)];
+  } cmsg;
+  struct msghdr msg = {0};
+  struct iovec iov;
+  struct cmsghdr *hdr;
+  size_t done = 0;
+  ssize_t n;
+
+  if (c->size - c->len < 4096)
+  {
+    c->size = c->size ? c->size * 2 : 65536;
+    c->buf = realloc(c->buf, c->size);
+  }
+
+  iov.iov_base = c->buf + c->len;
+  iov.iov_len = c->size - c->len;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cmsg.buf;
+  msg.msg_controllen = sizeof(cmsg.buf);
+
+  n = recvmsg(c->fd, &msg, MSG_CMSG_CLOEXEC);
+
+  if (n < 0 && (errno == EINTR || errno == EAGAIN))
+    return True;
+
+  if (n <= 0)
+    return False;
+
+  for (hdr = CMSG_FIRSTHDR(&msg); hdr; hdr = CMSG_NXTHDR(&msg, hdr))
+  {
+    if (hdr->cmsg_level == SOL_SOCKET && hdr->cmsg_type == SCM_RIGHTS)
+    {
+      int count = (hdr->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      int *fds = (int *)CMSG_DATA(hdr);
+      int i;
+
+      for (i = 0; i < count; i++)
+      {
+        if (c->nfds < MAX_CLIENT_FDS)
+          c->fds[c->nfds++] = fds[i];
+        else
+          close(fds[i]);
+      }
+    }
+  }
+
+  c->len += n;
+  srv->last_request_ns = get_time_ns();
+
+  while (done < c->len)
+  {
+    size_t used = handle_request(srv, c, c->buf + done, c->len - done);
+
+    if (!used)
+      break;
+
+    done += used;
+  }
+
+  memmove(c->buf, c->buf + done, c->len - done);
+  c->len -= done;
+
+  return True;
+}
+
+static void
+client_destroy(FakeXServer *srv, FakeXClient *c)
+{
+  remove_selections(srv, c, 0);
+
+  while (c->nfds)
+    close(client_take_fd(c));
+
+  srv->clients[c->index] = NULL;
+  close(c->fd);
+  free(c->buf);
+  free(c);
+}
+
+static void
+accept_client(FakeXServer *srv)
+{
+  int fd = accept4(srv->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+  int i;
+
+  if (fd == -1)
+    return;
+
+  for (i = 0; i < MAX_CLIENTS; i++)
+  {
+    if (!srv->clients[i])
+    {
+      FakeXClient *c = calloc(1, sizeof(*c));
+
+      c->fd = fd;
+      c->index = i;
+      srv->clients[i] = c;
+
+      return;
+    }
+  }
+
+  fprintf(stderr, "fake X server: too many clients\n");
+  close(fd);
+}
+
+static void *
+server_thread(void *data)
+{
+  FakeXServer *srv = data;
+
+  while (1)
+  {
+    struct pollfd pfds[MAX_CLIENTS + 2];
+    FakeXClient *polled[MAX_CLIENTS];
+    struct timespec ts, *timeout = NULL;
+    int64_t timeout_ns = next_vblank_timeout_ns(srv);
+    int n = 0, count = 0, i;
+
+    pfds[n].fd = srv->wake_fd[0];
+    pfds[n++].events = POLLIN;
+    pfds[n].fd = srv->listen_fd;
+    pfds[n++].events = POLLIN;
+
+    for (i = 0; i < MAX_CLIENTS; i++)
+    {
+      if (srv->clients[i])
+      {
+        polled[count++] = srv->clients[i];
+        pfds[n].fd = srv->clients[i]->fd;
+        pfds[n++].events = POLLIN;
+      }
+    }
+
+    if (timeout_ns >= 0)
+    {
+      ts.tv_sec = timeout_ns / 1000000000;
+      ts.tv_nsec = timeout_ns % 1000000000;
+      timeout = &ts;
+    }
+
+    if (ppoll(pfds, n, timeout, NULL) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+
+      break;
+    }
+
+    if (pfds[0].revents)
+      break;
+
+    if (pfds[1].revents & POLLIN)
+      accept_client(srv);
+
+    for (i = 0; i < count; i++)
+    {
+      if (pfds[i + 2].revents && !client_read(srv, polled[i]))
+        client_destroy(srv, polled[i]);
+    }
+
+    update_clock(srv);
+  }
+
+  return NULL;
+}
+
+static int
+listen_abstract(char *display_name, size_t size)
+{
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  int display;
+
+  if (fd == -1)
+    return -1;
+
+  for (display = 100 + getpid() % 500; display < 1000; display++)
+  {
+    struct sockaddr_un addr = {0};
+    socklen_t addr_len;
+
+    addr.sun_family = AF_UNIX;
+    addr_len = offsetof(struct sockaddr_un, sun_path) + 1 +
+        snprintf(addr.sun_path + 1, sizeof(addr.sun_path) - 1,
+                 "/tmp/.X11-unix/X%d", display);
+
+    if (!bind(fd, (struct sockaddr *)&addr, addr_len) && !listen(fd, 8))
+    {
+      snprintf(display_name, size, ":%d", display);
+      return fd;
+    }
+  }
+
+  close(fd);
+
+  return -1;
+}
+
+static void
+free_atom(void *data)
+{
+  FakeAtom *atom = data;
+
+  free(atom->name);
+  free(atom);
+}
+
+FakeXServer *
+fake_x_server_start(const FakeXConfig *config)
+{
+  FakeXServer *srv = calloc(1, sizeof(*srv));
+
+  if (config)
+    srv->config = *config;
+
+  if (srv->config.refresh_hz)
+  {
+    int half_period = 500000 / srv->config.refresh_hz;
+
+    if (srv->config.jitter_us > half_period)
+      srv->config.jitter_us = half_period;
+  }
+
+  srv->start_ns = get_time_ns();
+  srv->start_ust = srv->start_ns / 1000;
+  srv->next_atom = FIRST_ATOM;
+  add_window(srv, ROOT_WINDOW, 0, VISUAL_RGB888, ROOT_WIDTH, ROOT_HEIGHT,
+             24)->mapped = True;
+
+  srv->listen_fd = listen_abstract(srv->display_name,
+                                   sizeof(srv->display_name));
+
+  if (srv->listen_fd == -1)
+  {
+    fprintf(stderr, "fake X server: failed to listen\n");
+    goto err;
+  }
+
+  if (pipe2(srv->wake_fd, O_CLOEXEC))
+    goto err_listen;
+
+  if (pthread_create(&srv->thread, NULL, server_thread, srv))
+    goto err_pipe;
+
+  return srv;
+
+err_pipe:
+  close(srv->wake_fd[0]);
+  close(srv->wake_fd[1]);
+err_listen:
+  close(srv->listen_fd);
+err:
+  srv->windows = slist_remove(srv->windows, srv->windows->data, free);
+  free(srv);
+
+  return NULL;
+}
+
+void
+fake_x_server_stop(FakeXServer *srv)
+{
+  int i;
+
+  if (write(srv->wake_fd[1], "q", 1) != 1)
+    fprintf(stderr, "fake X server: failed to wake server thread\n");
+
+  pthread_join(srv->thread, NULL);
+
+  for (i = 0; i < MAX_CLIENTS; i++)
+  {
+    if (srv->clients[i])
+      client_destroy(srv, srv->clients[i]);
+  }
+
+  while (srv->windows)
+    srv->windows = slist_remove(srv->windows, srv->windows->data, free);
+
+  while (srv->pixmaps)
+    srv->pixmaps = slist_remove(srv->pixmaps, srv->pixmaps->data, free);
+
+  while (srv->presents)
+    srv->presents = slist_remove(srv->presents, srv->presents->data, free);
+
+  while (srv->atoms)
+    srv->atoms = slist_remove(srv->atoms, srv->atoms->data, free_atom);
+
+  close(srv->wake_fd[0]);
+  close(srv->wake_fd[1]);
+  close(srv->listen_fd);
+  free(srv);
+}
+
+const char *
+fake_x_server_display_name(FakeXServer *srv)
+{
+  return srv->display_name;
+}
+
+void
+fake_x_server_get_stats(FakeXServer *srv, FakeXStats *stats)
+{
+  stats->requests = __atomic_load_n(&srv->stats.requests, __ATOMIC_RELAXED);
+  stats->replies = __atomic_load_n(&srv->stats.replies, __ATOMIC_RELAXED);
+  stats->events = __atomic_load_n(&srv->stats.events, __ATOMIC_RELAXED);
+  stats->errors = __atomic_load_n(&srv->stats.errors, __ATOMIC_RELAXED);
+  stats->pixmaps = __atomic_load_n(&srv->stats.pixmaps, __ATOMIC_RELAXED);
+  stats->presents = __atomic_load_n(&srv->stats.presents, __ATOMIC_RELAXED);
+  stats->flips = __atomic_load_n(&srv->stats.flips, __ATOMIC_RELAXED);
+  stats->skips = __atomic_load_n(&srv->stats.skips, __ATOMIC_RELAXED);
+  stats->dropped_idles = __atomic_load_n(&srv->stats.dropped_idles,
+                                         __ATOMIC_RELAXED);
+  stats->msc = __atomic_load_n(&srv->stats.msc, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,99 @@
+/*
+ * fake_x_server.h
+ *
+ * Copyright (C) 2020 Ivaylo Dimitrov <ivo.g.dimitrov.75@gmail.com>
+ *
+ * This library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Minimal in-process X server, just enough of the core protocol for
+ * XOpenDisplay and window creation, plus the DRI3 and Present requests the
+ * shim uses. Runs in its own thread, clients connect through DISPLAY set to
+ * fake_x_server_display_name().
+ *
+ * Presents are executed on a simulated vblank clock. In lockstep mode MSC and
+ * UST are simulated, but the clock still advances on the wall clock: one
+ * vblank once no request has arrived for 500 us while a present is queued.
+ * A client that only goes quiet while it is blocked on a buffer sees the
+ * same events (serials, MSC, UST, modes, which IDLEs get lost) on every run.
+ * One that pauses mid-frame for longer, preempted or doing real work, can
+ * have a vblank land earlier in its request stream, so runs are only
+ * reproducible on a machine that keeps up.
+ */
+
+#ifndef FAKE_X_SERVER_H
+#define FAKE_X_SERVER_H
+
+#include <stdint.h>
+
+typedef struct _FakeXServer FakeXServer;
+
+typedef struct
+{
+  /*
+   * vblanks per second, 0 means there is no vblank clock and every present
+   * is executed as soon as it arrives
+   */
+  int refresh_hz;
+  /* vblank timestamps are off by up to +-jitter_us, at most half a period */
+  int jitter_us;
+  /* vblanks a present spends in the pipeline before it can be shown */
+  int latency_frames;
+  /*
+   * flip instead of copy: a pixmap stays on screen, and busy, until the next
+   * present on the window replaces it
+   */
+  int flip;
+  /* every Nth IDLE_NOTIFY is never sent, 0 to deliver all of them */
+  int drop_idle_every;
+  /*
+   * how many times faster than real time the vblank clock runs. 0 runs in
+   * lockstep with the clients instead: while a present is queued, the clock
+   * moves to the next vblank once the clients have sent no request for
+   * 500 us of wall clock time.
+   */
+  int speedup;
+  /* for the jitter */
+  uint64_t seed;
+} FakeXConfig;
+
+typedef struct
+{
+  uint64_t requests;
+  uint64_t replies;   /* every reply is a round trip the client waited for */
+  uint64_t events;
+  uint64_t errors;
+  uint64_t pixmaps;   /* DRI3 PixmapFromBuffer */
+  uint64_t presents;
+  uint64_t flips;
+  uint64_t skips;     /* replaced by a newer present for the same vblank */
+  uint64_t dropped_idles;
+  uint64_t msc;
+} FakeXStats;
+
+/* config can be NULL, for no vblank clock and copies */
+FakeXServer *
+fake_x_server_start(const FakeXConfig *config);
+
+void
+fake_x_server_stop(FakeXServer *srv);
+
+const char *
+fake_x_server_display_name(FakeXServer *srv);
+
+void
+fake_x_server_get_stats(FakeXServer *srv, FakeXStats *stats);
+
+#endif // FAKE_X_SERVER_H
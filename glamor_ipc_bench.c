@@ -0,0 +1,452 @@
+/*
+ * glamor_ipc_bench.c
+ *
+ * Copyright (C) 2020 Ivaylo Dimitrov <ivo.g.dimitrov.75@gmail.com>
+ *
+ * This library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Compares the glamor test's two transports for presents and their
+ * acknowledgements, without any GL: a forked echo server answers every
+ * CMD_PIXMAP_PRESENT with GLAMOR_EVENT_PRESENTED, over the socket or over the
+ * shared memory rings. Reports the round trip of a single present (average
+ * and 99th percentile) and how many presents per second get through with up
+ * to PIPELINE_DEPTH of them in flight.
+ *
+ * Then, over the socket, what announcing a swapchain of SWAPCHAIN two-plane
+ * pixmaps and presenting one of them costs, with a packet per pixmap, with
+ * the same packets in one sendmmsg, and with all of it in one packet.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "glamor_ring.h"
+#include "glamor_test.h"
+
+#define ROUND_TRIPS 20000
+#define PIPELINED 200000
+#define PIPELINE_DEPTH 64
+#define ANNOUNCEMENTS 20000
+#define SWAPCHAIN 4
+#define PLANES 2
+
+struct transport
+{
+  const char *name;
+  int sock;
+  struct glamor_ring_shm *ring;
+  int server_doorbell;
+  int client_doorbell;
+};
+
+static uint64_t
+time_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int
+send_present(struct transport *t, uint32_t serial)
+{
+  struct glamor_msg_pixmap_present *msg;
+  struct glamor_batch batch;
+
+  if (t->ring)
+  {
+    struct glamor_ring_cmd cmd = {CMD_PIXMAP_PRESENT, 1, serial};
+
+    return glamor_ring_push(&t->ring->to_server, &cmd, t->server_doorbell);
+  }
+
+  glamor_batch_init(&batch);
+  msg = glamor_batch_add(&batch, CMD_PIXMAP_PRESENT, sizeof(*msg));
+  msg->id = htole32(1);
+  msg->serial = htole32(serial);
+
+  return glamor_batch_send(t->sock, &batch) < 0 ? -1 : 0;
+}
+
+/* waits for acks, returns the newest serial acknowledged, -1 on errors */
+static int64_t
+wait_presented(struct transport *t)
+{
+  uint32_t packet[GLAMOR_MAX_PACKET / sizeof(uint32_t)];
+  struct iovec iov = {packet, sizeof(packet)};
+  struct glamor_msg_header *hdr;
+  int64_t serial = -1;
+  size_t offset = 0;
+  ssize_t len;
+
+  if (t->ring)
+  {
+    struct pollfd pfd = {t->client_doorbell, POLLIN, 0};
+    struct glamor_ring_cmd cmd;
+    int ret;
+
+    while (serial < 0)
+    {
+      if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+        return -1;
+
+      glamor_doorbell_clear(t->client_doorbell);
+
+      while ((ret = glamor_ring_pop(&t->ring->to_client, &cmd)) > 0)
+        serial = cmd.serial;
+
+      if (ret < 0)
+        return -1;
+    }
+
+    return serial;
+  }
+
+  if ((len = read_fd(t->sock, &iov, 1, NULL, NULL)) <= 0)
+    return -1;
+
+  while ((hdr = glamor_msg_next(packet, len, &offset)))
+  {
+    struct glamor_msg_presented *msg =
+        glamor_msg_cast(hdr, struct glamor_msg_presented);
+
+    if (msg)
+      serial = le32toh(msg->serial);
+  }
+
+  return serial;
+}
+
+/* the server side, until the socket is closed */
+static void
+echo(struct transport *t)
+{
+  static struct glamor_packet packets[GLAMOR_RECV_PACKETS];
+  struct pollfd pfd[2] =
+  {
+    {t->sock, POLLIN, 0},
+    {t->server_doorbell, POLLIN, 0}
+  };
+  struct glamor_batch reply;
+
+  glamor_batch_init(&reply);
+
+  for (;;)
+  {
+    if (poll(pfd, t->ring ? 2 : 1, -1) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+
+      return;
+    }
+
+    if (pfd[0].revents)
+    {
+      int count = glamor_recv_packets(t->sock, packets, GLAMOR_RECV_PACKETS);
+      int i;
+
+      if (count < 0)
+        return;
+
+      for (i = 0; i < count; i++)
+      {
+        struct glamor_msg_header *hdr;
+        size_t offset = 0;
+
+        while ((hdr = glamor_msg_next(packets[i].data, packets[i].length,
+                                      &offset)))
+        {
+          struct glamor_msg_pixmap_present *msg =
+              glamor_msg_cast(hdr, struct glamor_msg_pixmap_present);
+          struct glamor_msg_presented *presented;
+
+          if (hdr->type != CMD_PIXMAP_PRESENT || !msg)
+            continue;
+
+          presented = glamor_batch_add(&reply, GLAMOR_EVENT_PRESENTED,
+                                       sizeof(*presented));
+          presented->id = msg->id;
+          presented->serial = msg->serial;
+        }
+
+        /* pixmaps are not imported here */
+        glamor_packet_close_fds(&packets[i]);
+      }
+
+      glamor_batch_send(t->sock, &reply);
+    }
+
+    if (t->ring && pfd[1].revents)
+    {
+      struct glamor_ring_cmd cmd;
+
+      glamor_doorbell_clear(t->server_doorbell);
+
+      while (glamor_ring_pop(&t->ring->to_server, &cmd) > 0)
+      {
+        cmd.type = GLAMOR_EVENT_PRESENTED;
+        glamor_ring_push(&t->ring->to_client, &cmd, t->client_doorbell);
+      }
+    }
+  }
+}
+
+static int
+compare_u64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+static int
+run_presents(struct transport *t)
+{
+  static uint64_t rtt[ROUND_TRIPS];
+  uint64_t sum = 0, start, elapsed;
+  uint32_t sent = 0, last;
+  int64_t acked;
+  int i;
+
+  for (i = 0; i < ROUND_TRIPS; i++)
+  {
+    start = time_ns();
+
+    if (send_present(t, ++sent) || wait_presented(t) != sent)
+      return -1;
+
+    rtt[i] = time_ns() - start;
+    sum += rtt[i];
+  }
+
+  qsort(rtt, ROUND_TRIPS, sizeof(rtt[0]), compare_u64);
+
+  acked = sent;
+  last = sent + PIPELINED;
+  start = time_ns();
+
+  while ((uint32_t)acked != last)
+  {
+    while (sent - (uint32_t)acked < PIPELINE_DEPTH && sent != last)
+    {
+      if (send_present(t, ++sent))
+        return -1;
+    }
+
+    if ((acked = wait_presented(t)) < 0)
+      return -1;
+  }
+
+  elapsed = time_ns() - start;
+
+  printf("%-8s %10.0f %10llu %12.0f\n", t->name, (double)sum / ROUND_TRIPS,
+         (unsigned long long)rtt[ROUND_TRIPS * 99 / 100],
+         PIPELINED * 1000000000.0 / elapsed);
+
+  return 0;
+}
+
+enum announce_mode
+{
+  ANNOUNCE_PACKETS,   /* a sendmsg per pixmap */
+  ANNOUNCE_SENDMMSG,  /* the same packets in one sendmmsg */
+  ANNOUNCE_ONE_PACKET
+};
+
+static const char *announce_names[] =
+{
+  "packets", "sendmmsg", "1 packet"
+};
+
+static void
+add_create(struct glamor_batch *batch, uint32_t id, int buf_fd)
+{
+  struct glamor_msg_pixmap_create *msg;
+  int i;
+
+  msg = glamor_batch_add(batch, CMD_PIXMAP_CREATE, sizeof(*msg));
+  msg->id = htole32(id);
+  msg->width = htole32(64);
+  msg->height = htole32(64);
+  msg->num_planes = htole32(PLANES);
+
+  for (i = 0; i < PLANES; i++)
+  {
+    msg->planes[i].offset = htole32(i * 64 * 64 * 4);
+    msg->planes[i].stride = htole32(64 * 4);
+    batch->fds[batch->nfds++] = buf_fd;
+  }
+}
+
+/* the swapchain, then a present to know the server has seen all of it */
+static int
+announce(struct transport *t, enum announce_mode mode, int buf_fd,
+         uint32_t serial)
+{
+  static struct glamor_batch batches[SWAPCHAIN];
+  struct glamor_msg_pixmap_present *msg;
+  struct glamor_batch *last;
+  int i;
+
+  for (i = 0; i < SWAPCHAIN; i++)
+  {
+    glamor_batch_init(&batches[i]);
+    add_create(mode == ANNOUNCE_ONE_PACKET ? &batches[0] : &batches[i], i,
+               buf_fd);
+  }
+
+  last = mode == ANNOUNCE_ONE_PACKET ? &batches[0] : &batches[SWAPCHAIN - 1];
+  msg = glamor_batch_add(last, CMD_PIXMAP_PRESENT, sizeof(*msg));
+  msg->id = htole32(0);
+  msg->serial = htole32(serial);
+
+  if (mode == ANNOUNCE_PACKETS)
+  {
+    for (i = 0; i < SWAPCHAIN; i++)
+    {
+      if (glamor_batch_send(t->sock, &batches[i]) < 0)
+        return -1;
+    }
+  }
+  else if (glamor_batch_send_many(t->sock, batches, SWAPCHAIN))
+    return -1;
+
+  return wait_presented(t) == serial ? 0 : -1;
+}
+
+static int
+run_announce(struct transport *t)
+{
+  int buf_fd = memfd_create("glamor-bench", MFD_CLOEXEC);
+  uint32_t serial = 0;
+  int mode, i;
+
+  if (buf_fd < 0)
+  {
+    perror("memfd_create");
+    return -1;
+  }
+
+  for (mode = ANNOUNCE_PACKETS; mode <= ANNOUNCE_ONE_PACKET; mode++)
+  {
+    uint64_t start = time_ns();
+
+    for (i = 0; i < ANNOUNCEMENTS; i++)
+    {
+      if (announce(t, mode, buf_fd, ++serial))
+      {
+        close(buf_fd);
+        return -1;
+      }
+    }
+
+    printf("%-8s %10.0f\n", announce_names[mode],
+           (double)(time_ns() - start) / ANNOUNCEMENTS);
+  }
+
+  close(buf_fd);
+
+  return 0;
+}
+
+static int
+bench(struct transport *t, int (*run)(struct transport *t))
+{
+  int sv[2];
+  pid_t pid;
+  int ret;
+
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv))
+  {
+    perror("socketpair");
+    return -1;
+  }
+
+  if ((pid = fork()) < 0)
+  {
+    perror("fork");
+    return -1;
+  }
+
+  if (!pid)
+  {
+    close(sv[0]);
+    t->sock = sv[1];
+    echo(t);
+    _exit(0);
+  }
+
+  close(sv[1]);
+  t->sock = sv[0];
+  ret = run(t);
+  close(t->sock);
+  waitpid(pid, NULL, 0);
+
+  return ret;
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct transport sock = {"socket"};
+  struct transport ring = {"ring"};
+  int shm_fd;
+
+  if (!(ring.ring = glamor_ring_shm_create(&shm_fd)))
+    return 1;
+
+  close(shm_fd);
+  ring.server_doorbell = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  ring.client_doorbell = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+  if (ring.server_doorbell < 0 || ring.client_doorbell < 0)
+  {
+    perror("eventfd");
+    return 1;
+  }
+
+  printf("%-8s %10s %10s %12s\n", "", "rtt ns", "p99 ns", "presents/s");
+
+  if (bench(&sock, run_presents) || bench(&ring, run_presents))
+  {
+    fprintf(stderr, "benchmark failed\n");
+    return 1;
+  }
+
+  printf("\n%d pixmaps of %d planes %10s\n", SWAPCHAIN, PLANES, "ns");
+
+  if (bench(&sock, run_announce))
+  {
+    fprintf(stderr, "benchmark failed\n");
+    return 1;
+  }
+
+  return 0;
+}
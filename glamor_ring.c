@@ -0,0 +1,193 @@
+/*
+ * glamor_ring.c
+ *
+ * Copyright (C) 2020 Ivaylo Dimitrov <ivo.g.dimitrov.75@gmail.com>
+ *
+ * This library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "glamor_ring.h"
+
+struct glamor_ring_shm *
+glamor_ring_shm_create(int *fd)
+{
+  struct glamor_ring_shm *shm;
+
+  *fd = memfd_create("glamor-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+
+  if (*fd < 0)
+  {
+    perror("memfd_create");
+    return NULL;
+  }
+
+  if (ftruncate(*fd, sizeof(*shm)))
+  {
+    perror("ftruncate");
+    close(*fd);
+    return NULL;
+  }
+
+  /* so the server can trust the size */
+  fcntl(*fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+
+  shm = mmap(NULL, sizeof(*shm), PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+
+  if (shm == MAP_FAILED)
+  {
+    perror("mmap");
+    close(*fd);
+    return NULL;
+  }
+
+  return shm;
+}
+
+struct glamor_ring_shm *
+glamor_ring_shm_map(int fd)
+{
+  struct glamor_ring_shm *shm;
+  struct stat st;
+  int seals = fcntl(fd, F_GET_SEALS);
+
+  if (fstat(fd, &st) || st.st_size != sizeof(*shm) || seals < 0 ||
+      !(seals & F_SEAL_SHRINK))
+  {
+    fprintf(stderr, "not a ring shm\n");
+    return NULL;
+  }
+
+  shm = mmap(NULL, sizeof(*shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+  if (shm == MAP_FAILED)
+  {
+    perror("mmap");
+    return NULL;
+  }
+
+  return shm;
+}
+
+void
+glamor_ring_shm_unmap(struct glamor_ring_shm *shm)
+{
+  munmap(shm, sizeof(*shm));
+}
+
+static void
+ring_doorbell(int fd)
+{
+  uint64_t one = 1;
+
+  if (write(fd, &one, sizeof(one)) != sizeof(one))
+    perror("doorbell");
+}
+
+int
+glamor_ring_push_slot(struct glamor_ring_index *index, void *slots,
+                      uint32_t count, size_t size, const void *elem,
+                      int doorbell_fd)
+{
+  uint32_t head = atomic_load_explicit(&index->head, memory_order_relaxed);
+  uint32_t tail = atomic_load_explicit(&index->tail, memory_order_acquire);
+
+  if (head - tail >= count)
+    return -1;
+
+  memcpy((char *)slots + (head % count) * size, elem, size);
+  atomic_store_explicit(&index->head, head + 1, memory_order_release);
+
+  /*
+   * Pairs with the fences in glamor_ring_pop_slot(): either the consumer
+   * sees the new head before it goes to sleep, or we see that it had
+   * consumed everything before, and wake it. The same goes the other way
+   * for a producer that finds the ring full and waits for space_fd.
+   */
+  atomic_thread_fence(memory_order_seq_cst);
+
+  if (atomic_load_explicit(&index->tail, memory_order_relaxed) == head)
+    ring_doorbell(doorbell_fd);
+
+  return 0;
+}
+
+int
+glamor_ring_pop_slot(struct glamor_ring_index *index, const void *slots,
+                     uint32_t count, size_t size, void *elem, int space_fd)
+{
+  uint32_t tail = atomic_load_explicit(&index->tail, memory_order_relaxed);
+  uint32_t head = atomic_load_explicit(&index->head, memory_order_acquire);
+
+  if (head == tail)
+  {
+    atomic_thread_fence(memory_order_seq_cst);
+    head = atomic_load_explicit(&index->head, memory_order_acquire);
+
+    if (head == tail)
+      return 0;
+  }
+
+  if (head - tail > count)
+    return -1;
+
+  memcpy(elem, (const char *)slots + (tail % count) * size, size);
+  atomic_store_explicit(&index->tail, tail + 1, memory_order_release);
+
+  if (space_fd != -1)
+  {
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if (atomic_load_explicit(&index->head, memory_order_relaxed) - tail ==
+        count)
+    {
+      ring_doorbell(space_fd);
+    }
+  }
+
+  return 1;
+}
+
+int
+glamor_ring_push(struct glamor_ring *ring, const struct glamor_ring_cmd *cmd,
+                 int doorbell_fd)
+{
+  return glamor_ring_push_slot(&ring->index, ring->cmds, GLAMOR_RING_SIZE,
+                               sizeof(*cmd), cmd, doorbell_fd);
+}
+
+int
+glamor_ring_pop(struct glamor_ring *ring, struct glamor_ring_cmd *cmd)
+{
+  return glamor_ring_pop_slot(&ring->index, ring->cmds, GLAMOR_RING_SIZE,
+                              sizeof(*cmd), cmd, -1);
+}
+
+void
+glamor_doorbell_clear(int doorbell_fd)
+{
+  uint64_t count;
+
+  /* the eventfds are non-blocking, it may have been cleared already */
+  if (read(doorbell_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+    perror("doorbell");
+}
@@ -0,0 +1,124 @@
+/*
+ * glamor_ring.h
+ *
+ * Copyright (C) 2020 Ivaylo Dimitrov <ivo.g.dimitrov.75@gmail.com>
+ *
+ * This library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Shared memory transport for the glamor test's hot path. The client creates
+ * a memfd holding two single-producer single-consumer rings of fixed size
+ * commands, one each way, plus an eventfd per direction, and hands all of
+ * them to the server with CMD_RING_ATTACH. After that presents, their
+ * acknowledgements and buffer releases go through the rings, the socket only
+ * carries what needs an fd (creating pixmaps) and the rare commands that have
+ * to stay ordered with those.
+ *
+ * A producer writes the consumer's eventfd only when a ring goes from empty
+ * to non-empty, a consumer drains the ring after every wakeup. Both sides are
+ * on the same machine, so commands are in host byte order.
+ */
+
+#ifndef GLAMOR_RING_H
+#define GLAMOR_RING_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define GLAMOR_RING_SIZE 256
+
+struct glamor_ring_cmd
+{
+  /* CMD_PIXMAP_PRESENT, GLAMOR_EVENT_PRESENTED, GLAMOR_EVENT_BUFFER_RELEASED */
+  uint32_t type;
+  uint32_t id;
+  uint32_t serial;
+  uint32_t reserved;
+};
+
+/*
+ * The producer and consumer ends of a ring, whatever its slots hold, so the
+ * server's queues between its own threads work the same way.
+ */
+struct glamor_ring_index
+{
+  /* free running, the producer owns head and the consumer tail */
+  _Atomic uint32_t head __attribute__((aligned(64)));
+  _Atomic uint32_t tail __attribute__((aligned(64)));
+};
+
+struct glamor_ring
+{
+  struct glamor_ring_index index;
+  struct glamor_ring_cmd cmds[GLAMOR_RING_SIZE] __attribute__((aligned(64)));
+};
+
+struct glamor_ring_shm
+{
+  struct glamor_ring to_server;
+  struct glamor_ring to_client;
+};
+
+/* a new, empty shm in a memfd, returned in *fd */
+struct glamor_ring_shm *
+glamor_ring_shm_create(int *fd);
+
+/* maps the shm the peer sent, NULL if fd is not one */
+struct glamor_ring_shm *
+glamor_ring_shm_map(int fd);
+
+void
+glamor_ring_shm_unmap(struct glamor_ring_shm *shm);
+
+/*
+ * Copies elem into the next of count slots of size bytes and rings
+ * doorbell_fd if the consumer might be waiting for it. count has to be a
+ * power of two. Returns -1 if the ring is full.
+ */
+int
+glamor_ring_push_slot(struct glamor_ring_index *index, void *slots,
+                      uint32_t count, size_t size, const void *elem,
+                      int doorbell_fd);
+
+/*
+ * Copies the oldest slot into elem. If the ring was full, rings space_fd
+ * unless it is -1, for a producer waiting for room. Returns 0 if the ring is
+ * empty, -1 if the producer corrupted it.
+ */
+int
+glamor_ring_pop_slot(struct glamor_ring_index *index, const void *slots,
+                     uint32_t count, size_t size, void *elem, int space_fd);
+
+/*
+ * Queues cmd and rings doorbell_fd if the consumer might be waiting for it.
+ * Returns -1 if the ring is full.
+ */
+int
+glamor_ring_push(struct glamor_ring *ring, const struct glamor_ring_cmd *cmd,
+                 int doorbell_fd);
+
+/*
+ * Takes the oldest command into *cmd. Returns 0 if the ring is empty, -1 if
+ * the peer corrupted it.
+ */
+int
+glamor_ring_pop(struct glamor_ring *ring, struct glamor_ring_cmd *cmd);
+
+/* acknowledges a wakeup, before draining the ring */
+void
+glamor_doorbell_clear(int doorbell_fd);
+
+#endif // GLAMOR_RING_H
@@ -17,9 +17,11 @@
  *
  */
 
+#define _GNU_SOURCE
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <errno.h>
 #include <signal.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -30,117 +32,275 @@
 
 #include "glamor_test.h"
 
-ssize_t
-write_fd(int sock, void *buf, ssize_t buflen, int fd)
+/* room for the most fds a packet can carry */
+union fd_control
+{
+  struct cmsghdr cmsghdr;
+  char control[CMSG_SPACE(GLAMOR_MAX_FDS * sizeof(int))];
+};
+
+static void
+set_fds(struct msghdr *msg, union fd_control *cmsgu, const int *fds, int nfds)
 {
-  ssize_t		size;
-  struct msghdr	msg;
-  struct iovec	iov;
-  union {
-    struct cmsghdr cmsghdr;
-    char control[CMSG_SPACE(sizeof (int))];
-  } cmsgu;
   struct cmsghdr *cmsg;
 
-  iov.iov_base = buf;
-  iov.iov_len = buflen;
+  if (!nfds)
+  {
+    msg->msg_control = NULL;
+    msg->msg_controllen = 0;
+    return;
+  }
+
+  msg->msg_control = cmsgu->control;
+  msg->msg_controllen = CMSG_SPACE(nfds * sizeof(int));
 
-  msg.msg_name = NULL;
-  msg.msg_namelen = 0;
-  msg.msg_iov = &iov;
-  msg.msg_iovlen = 1;
+  cmsg = CMSG_FIRSTHDR(msg);
+  cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+
+  memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+}
+
+/*
+ * Takes the fds that came with a received message into fds, up to *nfds of
+ * them, and closes the rest. fds can be NULL to close them all. The count is
+ * returned in *nfds. -1 if the message or its fds were truncated, nothing is
+ * kept then.
+ */
+static int
+get_fds(struct msghdr *msg, int *fds, int *nfds)
+{
+  struct cmsghdr *cmsg;
+  int max = fds ? *nfds : 0;
+  int count = 0;
 
-  if (fd != -1)
+  for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg))
   {
-    msg.msg_control = cmsgu.control;
-    msg.msg_controllen = sizeof(cmsgu.control);
+    int *received = (int *)CMSG_DATA(cmsg);
+    int i, n;
+
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+    {
+      fprintf(stderr, "invalid cmsg %d/%d\n", cmsg->cmsg_level,
+              cmsg->cmsg_type);
+      continue;
+    }
+
+    n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+
+    for (i = 0; i < n; i++)
+    {
+      int fd;
 
-    cmsg = CMSG_FIRSTHDR(&msg);
-    cmsg->cmsg_len = CMSG_LEN(sizeof (int));
-    cmsg->cmsg_level = SOL_SOCKET;
-    cmsg->cmsg_type = SCM_RIGHTS;
+      memcpy(&fd, &received[i], sizeof(fd));
 
-    *((int *) CMSG_DATA(cmsg)) = fd;
+      if (count < max)
+        fds[count++] = fd;
+      else
+        close(fd);
+    }
   }
-  else
+
+  if (msg->msg_flags & (MSG_TRUNC | MSG_CTRUNC))
   {
-    msg.msg_control = NULL;
-    msg.msg_controllen = 0;
+    fprintf(stderr, "truncated packet\n");
+
+    while (count)
+      close(fds[--count]);
+
+    if (nfds)
+      *nfds = 0;
+
+    return -1;
   }
 
-  size = sendmsg(sock, &msg, 0);
+  if (nfds)
+    *nfds = count;
 
-  if (size < 0)
+  return 0;
+}
+
+/* sends one packet with nfds fds, up to GLAMOR_MAX_FDS */
+ssize_t
+write_fd(int sock, const struct iovec *iov, int iovcnt, const int *fds,
+         int nfds)
+{
+  ssize_t size;
+  struct msghdr msg = {0};
+  union fd_control cmsgu;
+
+  msg.msg_iov = (struct iovec *)iov;
+  msg.msg_iovlen = iovcnt;
+  set_fds(&msg, &cmsgu, fds, nfds);
+
+  size = sendmsg(sock, &msg, MSG_NOSIGNAL);
+
+  /* a non-blocking socket's owner handles a full one */
+  if (size < 0 && errno != EAGAIN)
     perror ("sendmsg");
 
   return size;
 }
 
+/*
+ * Receives one packet into iov. Received fds are returned in fds, *nfds says
+ * how many fit there and is set to how many came. They are all closed if fds
+ * is NULL. Returns 0 when the peer went away, or on errors, and for packets
+ * that did not fit.
+ */
 ssize_t
-read_fd(int sock, void *buf, ssize_t bufsize, int *fd)
+read_fd(int sock, const struct iovec *iov, int iovcnt, int *fds, int *nfds)
 {
-  ssize_t		size;
-
-  if (fd) {
-    struct msghdr	msg;
-    struct iovec	iov;
-    union {
-      struct cmsghdr	cmsghdr;
-      char		control[CMSG_SPACE(sizeof (int))];
-    } cmsgu;
-    struct cmsghdr	*cmsg;
-
-    iov.iov_base = buf;
-    iov.iov_len = bufsize;
-
-    msg.msg_name = NULL;
-    msg.msg_namelen = 0;
-    msg.msg_iov = &iov;
-    msg.msg_iovlen = 1;
-    msg.msg_control = cmsgu.control;
-    msg.msg_controllen = sizeof(cmsgu.control);
-    size = recvmsg (sock, &msg, 0);
-
-    if (size < 0)
-    {
-      perror ("recvmsg");
-      return 0;
-    }
+  ssize_t size;
+  struct msghdr msg = {0};
+  union fd_control cmsgu;
 
-    cmsg = CMSG_FIRSTHDR(&msg);
+  msg.msg_iov = (struct iovec *)iov;
+  msg.msg_iovlen = iovcnt;
+  msg.msg_control = cmsgu.control;
+  msg.msg_controllen = sizeof(cmsgu.control);
+  size = recvmsg (sock, &msg, MSG_CMSG_CLOEXEC);
 
-    if (cmsg && cmsg->cmsg_len == CMSG_LEN(sizeof(int)))
-    {
-      if (cmsg->cmsg_level != SOL_SOCKET) {
-        fprintf (stderr, "invalid cmsg_level %d\n",
-                 cmsg->cmsg_level);
-        return 0;
-      }
-
-      if (cmsg->cmsg_type != SCM_RIGHTS)
-      {
-        fprintf (stderr, "invalid cmsg_type %d\n",
-                 cmsg->cmsg_type);
-        exit(1);
-      }
-
-      *fd = *((int *) CMSG_DATA(cmsg));
-      fprintf (stderr, "received fd %d\n", *fd);
-    }
-    else
-      *fd = -1;
+  if (size < 0)
+  {
+    perror ("recvmsg");
+    return 0;
+  }
+
+  if (get_fds(&msg, fds, nfds))
+    return 0;
+
+  return size;
+}
+
+/*
+ * Receives up to count packets with one recvmmsg, waiting only for the
+ * first. Returns how many came, 0 if a non-blocking socket has nothing, -1
+ * when the peer went away, on errors, and if a packet did not fit. The rest
+ * of the packets are dropped then, the peer is expected to be disconnected.
+ */
+int
+glamor_recv_packets(int sock, struct glamor_packet *packets, int count)
+{
+  struct mmsghdr msgs[GLAMOR_RECV_PACKETS];
+  struct iovec iovs[GLAMOR_RECV_PACKETS];
+  union fd_control cmsgus[GLAMOR_RECV_PACKETS];
+  int i, n, bad = 0;
+
+  if (count > GLAMOR_RECV_PACKETS)
+    count = GLAMOR_RECV_PACKETS;
+
+  memset(msgs, 0, count * sizeof(msgs[0]));
+
+  for (i = 0; i < count; i++)
+  {
+    iovs[i].iov_base = packets[i].data;
+    iovs[i].iov_len = sizeof(packets[i].data);
+    msgs[i].msg_hdr.msg_iov = &iovs[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+    msgs[i].msg_hdr.msg_control = cmsgus[i].control;
+    msgs[i].msg_hdr.msg_controllen = sizeof(cmsgus[i].control);
+  }
+
+  n = recvmmsg(sock, msgs, count, MSG_CMSG_CLOEXEC | MSG_WAITFORONE, NULL);
+
+  /* nothing there yet on a non-blocking socket */
+  if (n < 0 && errno == EAGAIN)
+    return 0;
+
+  if (n < 0)
+  {
+    perror("recvmmsg");
+    return -1;
+  }
+
+  for (i = 0; i < n; i++)
+  {
+    packets[i].length = msgs[i].msg_len;
+    packets[i].nfds = GLAMOR_MAX_FDS;
+
+    if (get_fds(&msgs[i].msg_hdr, packets[i].fds, &packets[i].nfds))
+      bad = 1;
+
+    /* hang-up, every packet has at least a header */
+    if (!packets[i].length)
+      bad = 1;
+  }
+
+  if (!n || bad)
+  {
+    for (i = 0; i < n; i++)
+      glamor_packet_close_fds(&packets[i]);
+
+    return -1;
+  }
+
+  return n;
+}
+
+/* sends the batch as one packet and empties it, the fds are not closed */
+ssize_t
+glamor_batch_send(int sock, struct glamor_batch *batch)
+{
+  struct iovec iov = {batch->data, batch->length};
+  ssize_t size;
+
+  if (!batch->length)
+    return 0;
+
+  size = write_fd(sock, &iov, 1, batch->fds, batch->nfds);
+  glamor_batch_init(batch);
+
+  return size;
+}
+
+/*
+ * Sends count batches as that many packets, with as few sendmmsg as the
+ * socket allows, and empties them. The fds are not closed.
+ */
+int
+glamor_batch_send_many(int sock, struct glamor_batch *batches, int count)
+{
+  struct mmsghdr msgs[GLAMOR_SEND_BATCHES];
+  struct iovec iovs[GLAMOR_SEND_BATCHES];
+  union fd_control cmsgus[GLAMOR_SEND_BATCHES];
+  int i, n = 0, sent = 0;
+
+  if (count > GLAMOR_SEND_BATCHES)
+    return -1;
+
+  for (i = 0; i < count; i++)
+  {
+    if (!batches[i].length)
+      continue;
+
+    memset(&msgs[n], 0, sizeof(msgs[n]));
+    iovs[n].iov_base = batches[i].data;
+    iovs[n].iov_len = batches[i].length;
+    msgs[n].msg_hdr.msg_iov = &iovs[n];
+    msgs[n].msg_hdr.msg_iovlen = 1;
+    set_fds(&msgs[n].msg_hdr, &cmsgus[n], batches[i].fds, batches[i].nfds);
+    n++;
   }
-  else
+
+  while (sent < n)
   {
-    size = read (sock, buf, bufsize);
+    int ret = sendmmsg(sock, &msgs[sent], n - sent, MSG_NOSIGNAL);
 
-    if (size < 0)
+    if (ret < 0)
     {
-      perror("read");
-      return 0;
+      perror("sendmmsg");
+      return -1;
     }
+
+    sent += ret;
   }
-  return size;
+
+  for (i = 0; i < count; i++)
+    glamor_batch_init(&batches[i]);
+
+  return 0;
 }
 
 int
@@ -150,7 +310,7 @@ bind_named_socket(const char *filename)
   int sock;
 
   /* Create the socket. */
-  sock = socket(PF_LOCAL, SOCK_STREAM, 0);
+  sock = socket(PF_LOCAL, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
 
   if (sock < 0)
   {
@@ -179,7 +339,7 @@ connect_named_socket(const char *filename)
   int sock;
 
   /* Create the socket. */
-  sock = socket(PF_LOCAL, SOCK_STREAM, 0);
+  sock = socket(PF_LOCAL, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
 
   if (sock < 0)
   {
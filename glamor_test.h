@@ -17,54 +17,276 @@
  *
  */
 
+/*
+ * Client/server protocol of the glamor test. Everything goes over a
+ * SOCK_SEQPACKET socket, so a packet is always received whole and on its
+ * own. A packet carries one or more messages, each starting with a
+ * struct glamor_msg_header whose length covers the whole message, so
+ * several commands (create and present a pixmap, say) go out in one sendmsg.
+ * Fields are little-endian 32-bit integers and messages are padded to a
+ * multiple of 4 bytes.
+ *
+ * File descriptors travel as SCM_RIGHTS with the packet, up to
+ * GLAMOR_MAX_FDS of them, and are handed out in order to the messages in it
+ * that take them. A pixmap takes one per plane. Senders with several packets
+ * at hand send them with one sendmmsg, the server receives as many as are
+ * queued with one recvmmsg.
+ *
+ * Pixmap ids are chosen by the client, like X resource ids: a table index
+ * in the low 16 bits and the generation of that slot above it. A slot starts
+ * at generation 0 and moves to the next one when its pixmap is destroyed, so
+ * the server can tell a stale id from a live one. Indices are meant to be
+ * reused, there are only GLAMOR_MAX_PIXMAPS of them per client.
+ *
+ * Presents carry a client chosen serial, the server acknowledges each of
+ * them with a GLAMOR_EVENT_PRESENTED with the same serial once it has been
+ * composed, or replaced by a newer one, in the order the presents arrived.
+ * Clients do not have to wait for that before sending the next present.
+ *
+ * A presented pixmap belongs to the server until GLAMOR_EVENT_BUFFER_RELEASED
+ * with its id: the server keeps drawing the pixmap a client showed last
+ * until it presents another one, and the GPU may still read it after that.
+ * Clients must not render to a pixmap before it is released. A destroyed
+ * pixmap is never released.
+ *
+ * Optionally presents and acknowledgements go through shared memory rings
+ * instead, see glamor_ring.h. The client attaches them with three
+ * CMD_RING_ATTACH, the rings are used once the server has all of them.
+ *
+ * The first packet on a connection is the server's GLAMOR_EVENT_SERVER_INFO,
+ * a client must disconnect if the version there is not the one it speaks.
+ */
+
 #ifndef GLAMOR_TEST_H
 #define GLAMOR_TEST_H
 
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <endian.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
-#include <stdlib.h>
+#include <unistd.h>
+
+#define GLAMOR_PROTOCOL_VERSION 6
+
+/* no packet is ever bigger */
+#define GLAMOR_MAX_PACKET 4096
+/* the kernel's SCM_MAX_FD, the most fds a packet can carry */
+#define GLAMOR_MAX_FDS 253
+/* packets glamor_recv_packets() and glamor_batch_send_many() handle at once */
+#define GLAMOR_RECV_PACKETS 16
+#define GLAMOR_SEND_BATCHES 8
+
+/* client to server */
+#define CMD_PIXMAP_CREATE 1     /* takes an fd per plane */
+#define CMD_PIXMAP_PRESENT 2
+#define CMD_PIXMAP_DESTROY 3
+#define CMD_RING_ATTACH 4       /* takes an fd */
+
+/* server to client */
+#define GLAMOR_EVENT_SERVER_INFO 0x100
+#define GLAMOR_EVENT_PRESENTED 0x101
+#define GLAMOR_EVENT_ERROR 0x102
+#define GLAMOR_EVENT_BUFFER_RELEASED 0x103
+
+#define GLAMOR_MAX_PIXMAPS 4096
+
+#define GLAMOR_ID(index, generation) \
+  ((uint32_t)(generation) << 16 | (index))
+#define GLAMOR_ID_INDEX(id) ((id) & 0xffff)
+#define GLAMOR_ID_GENERATION(id) ((uint16_t)((id) >> 16))
+
+struct glamor_msg_header
+{
+  uint32_t type;
+  uint32_t length;
+};
+
+/* planes of a multi-planar format, or with a compression (CCS) plane */
+#define GLAMOR_MAX_PLANES 4
+/* DRM_FORMAT_MOD_INVALID */
+#define GLAMOR_MOD_INVALID 0x00ffffffffffffffULL
+
+struct glamor_plane
+{
+  uint32_t offset;
+  uint32_t stride;
+};
+
+struct glamor_msg_pixmap_create
+{
+  struct glamor_msg_header hdr;
+  uint32_t id;
+  uint32_t width;
+  uint32_t height;
+  uint32_t format;
+  uint32_t num_planes;
+  /* GLAMOR_MOD_INVALID if the buffer has no explicit modifier */
+  uint32_t modifier_lo;
+  uint32_t modifier_hi;
+  struct glamor_plane planes[GLAMOR_MAX_PLANES];
+};
+
+struct glamor_msg_pixmap_present
+{
+  struct glamor_msg_header hdr;
+  uint32_t id;
+  uint32_t serial;
+};
+
+struct glamor_msg_pixmap_destroy
+{
+  struct glamor_msg_header hdr;
+  uint32_t id;
+};
+
+/* what a CMD_RING_ATTACH fd is */
+#define GLAMOR_RING_SHM 0
+#define GLAMOR_RING_SERVER_DOORBELL 1
+#define GLAMOR_RING_CLIENT_DOORBELL 2
+#define GLAMOR_RING_FDS 3
+
+struct glamor_msg_ring_attach
+{
+  struct glamor_msg_header hdr;
+  uint32_t what;
+};
+
+struct glamor_msg_server_info
+{
+  struct glamor_msg_header hdr;
+  uint32_t version;
+  uint32_t width;
+  uint32_t height;
+};
 
-#define CMD_PIXMAP_CREATE '1'
-#define CMD_PIXMAP_PRESENT '2'
+struct glamor_msg_presented
+{
+  struct glamor_msg_header hdr;
+  uint32_t id;
+  uint32_t serial;
+};
 
-#define hexstrntoul(s) _hexstrntoul(s, sizeof(s))
+struct glamor_msg_buffer_released
+{
+  struct glamor_msg_header hdr;
+  uint32_t id;
+};
 
-static inline uint32_t
-_hexstrntoul(const char *s, int nchars)
+struct glamor_msg_error
 {
-  char tmp[nchars + 1];
+  struct glamor_msg_header hdr;
+  uint32_t cmd;   /* the command that failed */
+  uint32_t id;
+};
 
-  memcpy(tmp, s, nchars);
-  tmp[nchars] = 0;
+/* messages to send in one packet, and the fds going with them */
+struct glamor_batch
+{
+  uint8_t data[GLAMOR_MAX_PACKET] __attribute__((aligned(4)));
+  uint32_t length;
+  int fds[GLAMOR_MAX_FDS];
+  int nfds;
+};
 
-  return strtoul(tmp, NULL, 16);
+/* a received packet, and the fds that came with it */
+struct glamor_packet
+{
+  uint32_t data[GLAMOR_MAX_PACKET / sizeof(uint32_t)];
+  size_t length;
+  int fds[GLAMOR_MAX_FDS];
+  int nfds;
+};
+
+static inline void
+glamor_batch_init(struct glamor_batch *batch)
+{
+  batch->length = 0;
+  batch->nfds = 0;
 }
 
-struct msg
+/* if a message of size taking nfds fds still goes into the batch */
+static inline int
+glamor_batch_fits(const struct glamor_batch *batch, uint32_t size, int nfds)
 {
-  char cmd;
-  union
+  return batch->length + ((size + 3) & ~3) <= sizeof(batch->data) &&
+      batch->nfds + nfds <= GLAMOR_MAX_FDS;
+}
+
+/*
+ * Appends a message of type and size (including the header) to the batch
+ * and returns it, with the header filled in and the rest zeroed. NULL if it
+ * does not fit, the batch has to be sent first.
+ */
+static inline void *
+glamor_batch_add(struct glamor_batch *batch, uint32_t type, uint32_t size)
+{
+  struct glamor_msg_header *hdr;
+
+  if (!glamor_batch_fits(batch, size, 0))
+    return NULL;
+
+  size = (size + 3) & ~3;
+
+  hdr = (struct glamor_msg_header *)&batch->data[batch->length];
+  memset(hdr, 0, size);
+  hdr->type = htole32(type);
+  hdr->length = htole32(size);
+  batch->length += size;
+
+  return hdr;
+}
+
+/*
+ * Returns the message at *offset in a received packet of len bytes and moves
+ * *offset past it, NULL at the end of the packet or if the message there is
+ * malformed. The header is converted to host byte order in place.
+ */
+static inline struct glamor_msg_header *
+glamor_msg_next(void *packet, size_t len, size_t *offset)
+{
+  struct glamor_msg_header *hdr;
+
+  if (*offset + sizeof(*hdr) > len)
+    return NULL;
+
+  hdr = (struct glamor_msg_header *)((uint8_t *)packet + *offset);
+  hdr->type = le32toh(hdr->type);
+  hdr->length = le32toh(hdr->length);
+
+  if (hdr->length < sizeof(*hdr) || hdr->length & 3 ||
+      hdr->length > len - *offset)
   {
-    struct
-    {
-      char id[8];
-      char width[8];
-      char height[8];
-      char stride[8];
-      char format[8];
-    } create;
-    struct
-    {
-      char id[8];
-    } present;
-  } u;
-};
+    return NULL;
+  }
+
+  *offset += hdr->length;
+
+  return hdr;
+}
+
+/* closes the fds of a packet nobody took */
+static inline void
+glamor_packet_close_fds(struct glamor_packet *packet)
+{
+  while (packet->nfds)
+    close(packet->fds[--packet->nfds]);
+}
+
+/* NULL if the message is too short to be of type */
+#define glamor_msg_cast(hdr, type) \
+  ((hdr)->length >= sizeof(type) ? (type *)(hdr) : NULL)
 
 #define SOCKET_NAME "glamor"
 
-ssize_t write_fd(int sock, void *buf, ssize_t buflen, int fd);
-ssize_t read_fd(int sock, void *buf, ssize_t bufsize, int *fd);
+ssize_t write_fd(int sock, const struct iovec *iov, int iovcnt, const int *fds,
+                 int nfds);
+ssize_t read_fd(int sock, const struct iovec *iov, int iovcnt, int *fds,
+                int *nfds);
+int glamor_recv_packets(int sock, struct glamor_packet *packets, int count);
+ssize_t glamor_batch_send(int sock, struct glamor_batch *batch);
+int glamor_batch_send_many(int sock, struct glamor_batch *batches, int count);
 int bind_named_socket(const char *filename);
 int connect_named_socket(const char *filename);
 
@@ -1,4 +1,36 @@
 #!/bin/sh
 
-./glamor_srv 
-./glamor_cli 
\ No newline at end of file
+# frames/s with 1 to 4 presents in flight, over the socket and over the
+# shared memory rings, then with more and more clients.
+# The server's per-second composition stats end up in glamor_srv.log.
+#
+# "glamor_test.sh soak" instead keeps a client recreating its surface every
+# second until interrupted, the pixmap memory in the log must not grow.
+#
+# DRM_DEVICE picks the card, the vkms one works when there is no GPU around
+# (modprobe vkms, Mesa renders with kms_swrast then).
+FRAMES=${FRAMES:-600}
+DEV=${DRM_DEVICE:-/dev/dri/card1}
+
+./glamor_srv -d $DEV 2>glamor_srv.log &
+SRV=$!
+sleep 1
+
+if [ "$1" = soak ]; then
+  trap 'kill $SRV' INT TERM
+  ./glamor_cli -d $DEV -q 2 -r 60 2>/dev/null
+  kill $SRV
+  exit
+fi
+
+for ring in "" -R; do
+  for n in 1 2 3 4; do
+    ./glamor_cli -d $DEV -q $n -n $FRAMES $ring 2>/dev/null
+  done
+done
+
+for k in 1 2 4 8 16 32; do
+  ./glamor_cli -d $DEV -q 2 -n $FRAMES -c $k 2>/dev/null
+done
+
+kill $SRV
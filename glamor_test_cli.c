@@ -28,6 +28,9 @@
 #include <time.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <sys/eventfd.h>
 
 #include <gbm.h>
 
@@ -39,6 +42,7 @@
 #include <GLES/egl.h>
 #include <GLES/glext.h>
 
+#include "glamor_ring.h"
 #include "glamor_test.h"
 
 static struct {
@@ -56,12 +60,13 @@ static struct {
 static uint32_t hdisplay;
 static uint32_t vdisplay;
 static int drm_fd = -1;
+static const char *drm_device = "/dev/dri/card1";
 static int SHOW_FPS = 1;
 
 static int
 init_drm(void)
 {
-  drm_fd = open("/dev/dri/card1", O_RDWR);
+  drm_fd = open(drm_device, O_RDWR);
 
   if (drm_fd < 0)
   {
@@ -168,52 +173,422 @@ draw(uint32_t i)
   glFinish();
 }
 
+int s;
+
+/*
+ * What is to be sent, packets filled one after the other and sent with one
+ * sendmmsg. A single packet is enough most of the time, recreating the
+ * surface destroys and creates a whole swapchain at once.
+ */
+static struct glamor_batch batches[GLAMOR_SEND_BATCHES];
+static int batch_count = 1;
+
+/* presents and acks go through these if -R is given */
+static int use_ring;
+static struct glamor_ring_shm *ring;
+static int ring_fds[GLAMOR_RING_FDS] = {-1, -1, -1};
+
+/* sends what is batched, the fds were dup'ed for us by gbm and are ours */
+static int
+flush_batch(void)
+{
+  int fds[GLAMOR_SEND_BATCHES][GLAMOR_MAX_FDS];
+  int nfds[GLAMOR_SEND_BATCHES];
+  int ret, i, j;
+
+  /* sending empties the batches */
+  for (i = 0; i < batch_count; i++)
+  {
+    nfds[i] = batches[i].nfds;
+    memcpy(fds[i], batches[i].fds, nfds[i] * sizeof(int));
+  }
+
+  ret = glamor_batch_send_many(s, batches, batch_count);
+
+  for (i = 0; i < batch_count; i++)
+  {
+    for (j = 0; j < nfds[i]; j++)
+      close(fds[i][j]);
+  }
+
+  batch_count = 1;
+
+  return ret;
+}
+
+/*
+ * Room for a message of type and size taking nfds fds, the caller appends
+ * them to the returned batch. Moves on to the next packet if needed.
+ */
+static struct glamor_batch *
+batch_add(uint32_t type, uint32_t size, int nfds, void **msg)
+{
+  struct glamor_batch *batch = &batches[batch_count - 1];
+
+  if (!glamor_batch_fits(batch, size, nfds))
+  {
+    if (batch_count == GLAMOR_SEND_BATCHES)
+      flush_batch();
+    else
+      batch_count++;
+
+    batch = &batches[batch_count - 1];
+  }
+
+  *msg = glamor_batch_add(batch, type, size);
+
+  return batch;
+}
+
+/* pixmap ids, see glamor_test.h */
+static uint16_t generations[GLAMOR_MAX_PIXMAPS];
+static uint16_t free_indices[GLAMOR_MAX_PIXMAPS];
+static int free_count;
+static uint32_t next_index;
+
+/* by pixmap index, the buffers the server has not released yet */
+static struct gbm_bo *held[GLAMOR_MAX_PIXMAPS];
+static int held_count;
+
+static int
+pixmap_id_alloc(uint32_t *id)
+{
+  uint32_t index;
+
+  if (free_count)
+    index = free_indices[--free_count];
+  else if (next_index < GLAMOR_MAX_PIXMAPS)
+    index = next_index++;
+  else
+    return -1;
+
+  *id = GLAMOR_ID(index, generations[index]);
+
+  return 0;
+}
+
 static void
-destroy_data(struct gbm_bo *bo, void *data)
+pixmap_id_free(uint32_t id)
 {
-  free(data);
+  uint32_t index = GLAMOR_ID_INDEX(id);
+
+  generations[index]++;
+  free_indices[free_count++] = index;
 }
 
-int s;
+/* gbm is done with the bo, so is the server */
+static void
+destroy_data(struct gbm_bo *bo, void *data)
+{
+  uint32_t *id = data;
+  struct glamor_msg_pixmap_destroy *msg;
+
+  /* the server never releases a destroyed pixmap */
+  if (held[GLAMOR_ID_INDEX(*id)] == bo)
+  {
+    held[GLAMOR_ID_INDEX(*id)] = NULL;
+    held_count--;
+  }
+
+  batch_add(CMD_PIXMAP_DESTROY, sizeof(*msg), 0, (void **)&msg);
+  msg->id = htole32(*id);
+  pixmap_id_free(*id);
+  free(id);
+}
 
 uint32_t *
-pixmap_create(struct gbm_bo *bo, uint32_t pixmap_id)
+pixmap_create(struct gbm_bo *bo)
 {
   uint32_t *id = malloc(sizeof(*id));
-  char buf[256];
-  int fd = gbm_bo_get_fd(bo);
+  struct glamor_msg_pixmap_create *msg;
+  struct glamor_batch *batch;
+  uint64_t modifier = gbm_bo_get_modifier(bo);
+  int planes = gbm_bo_get_plane_count(bo);
+  int i;
 
-  *id = pixmap_id;
-  gbm_bo_set_user_data(bo, id, destroy_data);
+  if (planes < 1 || planes > GLAMOR_MAX_PLANES)
+  {
+    fprintf(stderr, "unsupported number of planes %d\n", planes);
+    free(id);
+    return NULL;
+  }
 
-  sprintf(buf,
-         "%c%08x%08x%08x%08x%08x\n",
-         CMD_PIXMAP_CREATE,
-         pixmap_id,
-         gbm_bo_get_width(bo),
-         gbm_bo_get_height(bo),
-         gbm_bo_get_stride(bo),
-         gbm_bo_get_format(bo));
+  if (pixmap_id_alloc(id))
+  {
+    fprintf(stderr, "out of pixmap ids\n");
+    free(id);
+    return NULL;
+  }
 
-  write_fd(s, buf, strlen(buf), fd);
-  read_fd(s, buf, sizeof(buf), NULL);
+  gbm_bo_set_user_data(bo, id, destroy_data);
 
-  fprintf(stderr, buf);
+  batch = batch_add(CMD_PIXMAP_CREATE, sizeof(*msg), planes, (void **)&msg);
+  msg->id = htole32(*id);
+  msg->width = htole32(gbm_bo_get_width(bo));
+  msg->height = htole32(gbm_bo_get_height(bo));
+  msg->format = htole32(gbm_bo_get_format(bo));
+  msg->num_planes = htole32(planes);
+  msg->modifier_lo = htole32(modifier);
+  msg->modifier_hi = htole32(modifier >> 32);
+
+  /* every plane of a gbm bo is in the one dma-buf */
+  for (i = 0; i < planes; i++)
+  {
+    msg->planes[i].offset = htole32(gbm_bo_get_offset(bo, i));
+    msg->planes[i].stride = htole32(gbm_bo_get_stride_for_plane(bo, i));
+    batch->fds[batch->nfds++] = gbm_bo_get_fd(bo);
+  }
 
   return id;
 }
 
+/*
+ * Goes out together with a pixmap_create still in the batch. With rings the
+ * batch is sent first, the server reads the socket before the ring.
+ */
 int
-pixmap_present(uint32_t id)
+pixmap_present(uint32_t id, uint32_t serial)
+{
+  struct glamor_msg_pixmap_present *msg;
+
+  if (ring)
+  {
+    struct glamor_ring_cmd cmd = {CMD_PIXMAP_PRESENT, id, serial};
+
+    if (flush_batch())
+      return -1;
+
+    if (!glamor_ring_push(&ring->to_server, &cmd,
+                          ring_fds[GLAMOR_RING_SERVER_DOORBELL]))
+    {
+      return 0;
+    }
+  }
+
+  batch_add(CMD_PIXMAP_PRESENT, sizeof(*msg), 0, (void **)&msg);
+  msg->id = htole32(id);
+  msg->serial = htole32(serial);
+
+  return flush_batch();
+}
+
+/*
+ * Presents not acknowledged yet, oldest first. Their buffers, and the one
+ * the server shows, are held by the server and stay locked until it releases
+ * them.
+ */
+#define MAX_IN_FLIGHT 8
+
+static struct
+{
+  struct gbm_bo *bo;
+  uint32_t serial;
+} in_flight[MAX_IN_FLIGHT];
+static int in_flight_head;
+static int in_flight_count;
+static int max_in_flight = 1;
+static int recreate_every;
+
+static void
+in_flight_push(struct gbm_bo *bo, uint32_t serial)
+{
+  int i = (in_flight_head + in_flight_count++) % MAX_IN_FLIGHT;
+
+  in_flight[i].bo = bo;
+  in_flight[i].serial = serial;
+}
+
+/* acks come in order, everything up to serial is done */
+static void
+presented(uint32_t serial)
+{
+  while (in_flight_count &&
+         (int32_t)(serial - in_flight[in_flight_head].serial) >= 0)
+  {
+    in_flight_head = (in_flight_head + 1) % MAX_IN_FLIGHT;
+    in_flight_count--;
+  }
+}
+
+static void
+hold(struct gbm_bo *bo, uint32_t id)
+{
+  held[GLAMOR_ID_INDEX(id)] = bo;
+  held_count++;
+}
+
+/* the server is done with the buffer, it can be rendered to again */
+static void
+released(uint32_t id)
+{
+  uint32_t index = GLAMOR_ID_INDEX(id);
+  struct gbm_bo *bo = index < GLAMOR_MAX_PIXMAPS ? held[index] : NULL;
+  uint32_t *bo_id;
+
+  /* destroyed meanwhile */
+  if (!bo || !(bo_id = gbm_bo_get_user_data(bo)) || *bo_id != id)
+    return;
+
+  held[index] = NULL;
+  held_count--;
+  gbm_surface_release_buffer(gbm.surface, bo);
+}
+
+static int
+dispatch_ring(void)
 {
-  char buf[256];
+  struct glamor_ring_cmd cmd;
+  int ret;
 
-  sprintf(buf, "%c%08x\n", CMD_PIXMAP_PRESENT, id);
+  glamor_doorbell_clear(ring_fds[GLAMOR_RING_CLIENT_DOORBELL]);
+
+  while ((ret = glamor_ring_pop(&ring->to_client, &cmd)) > 0)
+  {
+    if (cmd.type == GLAMOR_EVENT_PRESENTED)
+      presented(cmd.serial);
+    else if (cmd.type == GLAMOR_EVENT_BUFFER_RELEASED)
+      released(cmd.id);
+  }
+
+  return ret;
+}
+
+/*
+ * Handles one packet of events from the server, or what is on the ring,
+ * waiting for it if block is set. Returns 1 if there was nothing to read, -1
+ * on errors.
+ */
+static int
+dispatch_events(int block)
+{
+  uint32_t packet[GLAMOR_MAX_PACKET / sizeof(uint32_t)];
+  struct iovec iov = {packet, sizeof(packet)};
+  struct pollfd pfd[2] =
+  {
+    {s, POLLIN, 0},
+    {ring_fds[GLAMOR_RING_CLIENT_DOORBELL], POLLIN, 0}
+  };
+  struct glamor_msg_header *hdr;
+  size_t offset = 0;
+  ssize_t len;
+
+  if (poll(pfd, ring ? 2 : 1, block ? -1 : 0) <= 0)
+    return block ? -1 : 1;
+
+  if (pfd[1].revents & POLLIN)
+  {
+    if (dispatch_ring())
+      return -1;
+
+    /* the socket is looked at next time */
+    return 0;
+  }
+
+  if ((len = read_fd(s, &iov, 1, NULL, NULL)) <= 0)
+    return -1;
+
+  while ((hdr = glamor_msg_next(packet, len, &offset)))
+  {
+    if (hdr->type == GLAMOR_EVENT_PRESENTED)
+    {
+      struct glamor_msg_presented *msg =
+          glamor_msg_cast(hdr, struct glamor_msg_presented);
+
+      if (msg)
+        presented(le32toh(msg->serial));
+    }
+    else if (hdr->type == GLAMOR_EVENT_BUFFER_RELEASED)
+    {
+      struct glamor_msg_buffer_released *msg =
+          glamor_msg_cast(hdr, struct glamor_msg_buffer_released);
+
+      if (msg)
+        released(le32toh(msg->id));
+    }
+    else if (hdr->type == GLAMOR_EVENT_ERROR)
+    {
+      struct glamor_msg_error *msg =
+          glamor_msg_cast(hdr, struct glamor_msg_error);
+
+      if (msg)
+      {
+        fprintf(stderr, "server failed command %d on id %d\n",
+                le32toh(msg->cmd), le32toh(msg->id));
+      }
+
+      return -1;
+    }
+  }
 
-  write_fd(s, buf, strlen(buf), -1);
   return 0;
 }
 
+static int
+read_server_info(void)
+{
+  uint32_t packet[GLAMOR_MAX_PACKET / sizeof(uint32_t)];
+  struct iovec iov = {packet, sizeof(packet)};
+  struct glamor_msg_header *hdr;
+  struct glamor_msg_server_info *info;
+  size_t offset = 0;
+  ssize_t len;
+
+  if ((len = read_fd(s, &iov, 1, NULL, NULL)) <= 0 ||
+      !(hdr = glamor_msg_next(packet, len, &offset)) ||
+      hdr->type != GLAMOR_EVENT_SERVER_INFO ||
+      !(info = glamor_msg_cast(hdr, struct glamor_msg_server_info)))
+  {
+    fprintf(stderr, "no server info\n");
+    return -1;
+  }
+
+  if (le32toh(info->version) != GLAMOR_PROTOCOL_VERSION)
+  {
+    fprintf(stderr, "server speaks protocol version %d, we need %d\n",
+            le32toh(info->version), GLAMOR_PROTOCOL_VERSION);
+    return -1;
+  }
+
+  hdisplay = le32toh(info->width);
+  vdisplay = le32toh(info->height);
+
+  return 0;
+}
+
+/* sends the rings to the server, all in one packet */
+static int
+attach_ring(void)
+{
+  struct glamor_batch *batch = &batches[0];
+  int i;
+
+  if (!(ring = glamor_ring_shm_create(&ring_fds[GLAMOR_RING_SHM])))
+    return -1;
+
+  ring_fds[GLAMOR_RING_SERVER_DOORBELL] =
+      eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  ring_fds[GLAMOR_RING_CLIENT_DOORBELL] =
+      eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+  for (i = 0; i < GLAMOR_RING_FDS; i++)
+  {
+    struct glamor_msg_ring_attach *msg;
+
+    if (ring_fds[i] == -1)
+    {
+      perror("eventfd");
+      return -1;
+    }
+
+    msg = glamor_batch_add(batch, CMD_RING_ATTACH, sizeof(*msg));
+    msg->what = htole32(i);
+    batch->fds[batch->nfds++] = ring_fds[i];
+  }
+
+  /* we keep our copies */
+  return glamor_batch_send(s, batch) < 0 ? -1 : 0;
+}
+
 static uint32_t
 TimeElapsedMs(const struct timespec *tStartTime,
               const struct timespec *tEndTime)
@@ -254,17 +629,77 @@ CalculateFrameRate()
   }
 }
 
-int
-main(int argc, char *argv[])
+static void
+usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [-q max_in_flight] [-n frames] [-c clients] "
+          "[-r recreate_every] [-d drm_device] [-R]\n", name);
+}
+
+static uint64_t
+time_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Throws away the surface and makes a new one, like a resize would. Its
+ * buffers are destroyed on the server through destroy_data.
+ */
+static int
+recreate_surface(void)
+{
+  while (in_flight_count)
+  {
+    if (dispatch_events(1) < 0)
+      return -1;
+  }
+
+  eglMakeCurrent(gl.display, EGL_NO_SURFACE, EGL_NO_SURFACE, gl.context);
+  eglDestroySurface(gl.display, gl.surface);
+  gbm_surface_destroy(gbm.surface);
+
+  if (flush_batch())
+    return -1;
+
+  gbm.surface = gbm_surface_create(
+        gbm.dev, hdisplay, vdisplay, GBM_FORMAT_ARGB8888,
+        GBM_BO_USE_RENDERING | GBM_BO_USE_SCANOUT);
+
+  if (!gbm.surface)
+  {
+    fprintf(stderr, "failed to create gbm bo\n");
+    return -1;
+  }
+
+  gl.surface = eglCreateWindowSurface(gl.display, gl.config, gbm.surface, NULL);
+
+  if (gl.surface == EGL_NO_SURFACE)
+  {
+    fprintf(stderr, "failed to create egl surface\n");
+    return -1;
+  }
+
+  eglMakeCurrent(gl.display, gl.surface, gl.surface, gl.context);
+
+  return 0;
+}
+
+/* renders and presents frames (forever if 0), the rate is returned in fps */
+static int
+run_client(int frames, double *fps)
 {
-  char buf[256];
   int ret;
-  int i = 0;
+  int i = 0, b;
   uint32_t *id;
-  uint32_t pixmap_id = 0;
+  uint32_t serial = 0;
+  uint64_t start;
 
   struct gbm_bo *bo = NULL;
-  struct gbm_bo *next_bo = NULL;
 
   s = connect_named_socket(SOCKET_NAME);
   if (s == -1)
@@ -275,8 +710,17 @@ main(int argc, char *argv[])
 
   fprintf(stderr, "client socket connected %d\n", s);
 
-  read_fd(s, &hdisplay, sizeof(hdisplay), NULL);
-  read_fd(s, &vdisplay, sizeof(vdisplay), NULL);
+  for (b = 0; b < GLAMOR_SEND_BATCHES; b++)
+    glamor_batch_init(&batches[b]);
+
+  if (read_server_info())
+    return -1;
+
+  if (use_ring && attach_ring())
+  {
+    fprintf(stderr, "failed to attach rings\n");
+    return -1;
+  }
 
   if ((ret = init_drm()))
   {
@@ -298,26 +742,184 @@ main(int argc, char *argv[])
     return ret;
   }
 
-  while(1)
+  start = time_ns();
+
+  while (!frames || i < frames)
   {
+    /* pick up acks that are already there, without waiting */
+    while ((ret = dispatch_events(0)) == 0)
+      ;
+
+    if (ret < 0)
+      return -1;
+
+    /*
+     * then wait for as many as needed to get a buffer to render to, only
+     * released ones come back
+     */
+    while (in_flight_count >= max_in_flight ||
+           !gbm_surface_has_free_buffers(gbm.surface))
+    {
+      if (!held_count || dispatch_events(1) < 0)
+      {
+        fprintf(stderr, "out of buffers\n");
+        return -1;
+      }
+    }
+
+    if (recreate_every && i && !(i % recreate_every) && recreate_surface())
+      return -1;
+
     draw(i++);
     eglSwapBuffers(gl.display, gl.surface);
-    next_bo = gbm_surface_lock_front_buffer(gbm.surface);
-
-    id = gbm_bo_get_user_data(next_bo);
+    bo = gbm_surface_lock_front_buffer(gbm.surface);
 
-    if (!id)
-      id = pixmap_create(next_bo, pixmap_id++);
+    id = gbm_bo_get_user_data(bo);
 
-    pixmap_present(*id);
-    read_fd(s, buf, sizeof(buf), NULL);
+    if (!id && !(id = pixmap_create(bo)))
+      return -1;
 
-    if (bo)
-      gbm_surface_release_buffer(gbm.surface, bo);
+    if (pixmap_present(*id, ++serial))
+      return -1;
 
-    bo = next_bo;
+    hold(bo, *id);
+    in_flight_push(bo, serial);
     CalculateFrameRate();
   }
 
-  return ret;
+  while (in_flight_count)
+  {
+    if (dispatch_events(1) < 0)
+      return -1;
+  }
+
+  *fps = frames * 1e9 / (time_ns() - start);
+
+  return 0;
+}
+
+/*
+ * Load generator: every client is a process of its own, with its own
+ * connection, gbm device and context, just like separate applications.
+ */
+static int
+run_clients(int count, int frames)
+{
+  double total = 0, min = 0, fps;
+  int pipe_fds[2];
+  int i, failed = 0;
+
+  if (pipe(pipe_fds))
+  {
+    perror("pipe");
+    return -1;
+  }
+
+  for (i = 0; i < count; i++)
+  {
+    pid_t pid = fork();
+
+    if (pid < 0)
+    {
+      perror("fork");
+      count = i;
+      break;
+    }
+
+    if (!pid)
+    {
+      close(pipe_fds[0]);
+      SHOW_FPS = 0;
+
+      if (run_client(frames, &fps))
+        _exit(1);
+
+      write(pipe_fds[1], &fps, sizeof(fps));
+      _exit(0);
+    }
+  }
+
+  close(pipe_fds[1]);
+
+  for (i = 0; i < count && read(pipe_fds[0], &fps, sizeof(fps)) == sizeof(fps);
+       i++)
+  {
+    total += fps;
+
+    if (!i || fps < min)
+      min = fps;
+  }
+
+  failed = count - i;
+
+  while (wait(NULL) > 0)
+    ;
+
+  printf("%d clients, %d frames, %d in flight: %.1f frames/s total, "
+         "%.1f per client, slowest %.1f, %d failed\n", count, frames,
+         max_in_flight, total, i ? total / i : 0, min, failed);
+
+  return failed ? -1 : 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int frames = 0;
+  int clients = 0;
+  int opt;
+  double fps;
+
+  while ((opt = getopt(argc, argv, "q:n:c:r:d:R")) != -1)
+  {
+    switch (opt)
+    {
+      case 'q':
+        max_in_flight = atoi(optarg);
+        break;
+      case 'n':
+        frames = atoi(optarg);
+        break;
+      case 'c':
+        clients = atoi(optarg);
+        break;
+      case 'r':
+        recreate_every = atoi(optarg);
+        break;
+      case 'd':
+        drm_device = optarg;
+        break;
+      case 'R':
+        use_ring = 1;
+        break;
+      default:
+        usage(argv[0]);
+        return -1;
+    }
+  }
+
+  if (max_in_flight < 1 || max_in_flight > MAX_IN_FLIGHT)
+  {
+    fprintf(stderr, "max_in_flight must be 1 to %d\n", MAX_IN_FLIGHT);
+    return -1;
+  }
+
+  if (clients)
+  {
+    if (frames <= 0)
+    {
+      fprintf(stderr, "-c needs -n\n");
+      return -1;
+    }
+
+    return run_clients(clients, frames);
+  }
+
+  if (run_client(frames, &fps))
+    return -1;
+
+  printf("%d frames, %d in flight: %.1f frames/s\n", frames, max_in_flight,
+         fps);
+
+  return 0;
 }
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -9,6 +10,14 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
 
 #include <xf86drm.h>
 #include <xf86drmMode.h>
@@ -22,7 +31,9 @@
 #include <GLES/egl.h>
 #include <GLES/glext.h>
 
+#include "glamor_ring.h"
 #include "glamor_test.h"
+#include "list.h"
 
 static struct
 {
@@ -35,7 +46,6 @@ static struct
 static struct
 {
   struct gbm_device *dev;
-  struct gbm_bo *bo;
 } gbm;
 
 struct drm_fb {
@@ -43,11 +53,40 @@ struct drm_fb {
   uint32_t fb_id;
 };
 
+#define MAX_SCANOUTS 3
+
+/*
+ * Buffers the screen is composed into and flipped to. At any time one is on
+ * screen, at most one has a flip queued, and with three of them one more can
+ * be composed and wait for that flip to finish.
+ */
+struct scanout
+{
+  struct gbm_bo *bo;
+  struct drm_fb *fb;
+  GLuint tex;
+  GLuint fbo;
+  /* the client presents composed into it, for the latency */
+  uint32_t presents;
+  uint64_t present_ns_sum;
+  uint64_t oldest_present_ns;
+};
+
+static struct scanout scanouts[MAX_SCANOUTS];
+static int num_scanouts = 2;
+static struct scanout *front;
+static struct scanout *flipping;
+static struct scanout *ready;
+
+static const char *drm_device = "/dev/dri/card1";
+
 static struct
 {
   EGLDisplay display;
   EGLConfig config;
   EGLContext context;
+  /* the IPC thread's, imports there show up in context's share group */
+  EGLContext import_context;
   GLuint program;
   GLint modelviewmatrix, modelviewprojectionmatrix, normalmatrix;
   GLuint vbo;
@@ -111,7 +150,7 @@ init_drm(void)
   drmModeEncoder *encoder = NULL;
   int i, area;
 
-  drm.fd = open("/dev/dri/card1", O_RDWR);
+  drm.fd = open(drm_device, O_RDWR);
 
   if (drm.fd < 0)
   {
@@ -214,16 +253,21 @@ init_drm(void)
 static int
 init_gbm()
 {
-  gbm.dev = gbm_create_device(drm.fd);
+  int i;
 
-  gbm.bo = gbm_bo_create(
-        gbm.dev, drm.mode->hdisplay, drm.mode->vdisplay, GBM_FORMAT_XRGB8888,
-        GBM_BO_USE_SCANOUT | GBM_BO_USE_RENDERING);
+  gbm.dev = gbm_create_device(drm.fd);
 
-  if (!gbm.bo)
+  for (i = 0; i < num_scanouts; i++)
   {
-    printf("failed to create gbm bo\n");
-    return -1;
+    scanouts[i].bo = gbm_bo_create(
+          gbm.dev, drm.mode->hdisplay, drm.mode->vdisplay, GBM_FORMAT_XRGB8888,
+          GBM_BO_USE_SCANOUT | GBM_BO_USE_RENDERING);
+
+    if (!scanouts[i].bo)
+    {
+      printf("failed to create gbm bo\n");
+      return -1;
+    }
   }
 
   return 0;
@@ -274,6 +318,11 @@ drm_fb_get_from_bo(struct gbm_bo *bo)
 }
 
 PFNEGLCREATEIMAGEKHRPROC eglCreateImageKHR;
+PFNEGLDESTROYIMAGEKHRPROC eglDestroyImageKHR;
+PFNEGLCREATESYNCKHRPROC eglCreateSyncKHR;
+PFNEGLDESTROYSYNCKHRPROC eglDestroySyncKHR;
+PFNEGLCLIENTWAITSYNCKHRPROC eglClientWaitSyncKHR;
+PFNEGLDUPNATIVEFENCEFDANDROIDPROC eglDupNativeFenceFDANDROID;
 PFNGLEGLIMAGETARGETTEXTURE2DOESPROC _glEGLImageTargetTexture2DOES;
 void GL_APIENTRY (*_glDiscardFramebufferEXT)(GLenum target, GLsizei numAttachments, const GLenum *attachments);
 
@@ -378,10 +427,28 @@ LoadProgram(const char *vertShaderSrc, const char *fragShaderSrc)
     return programObject;
 }
 
+static int
+has_extension(const char *extensions, const char *name)
+{
+  size_t len = strlen(name);
+  const char *p = extensions;
+
+  while (p && (p = strstr(p, name)))
+  {
+    if ((p == extensions || p[-1] == ' ') && (p[len] == ' ' || !p[len]))
+      return 1;
+
+    p += len;
+  }
+
+  return 0;
+}
+
 static int
 init_gl(void)
 {
   EGLint major, minor, n;
+  const char *extensions;
 
   static const EGLint context_attribs[] =
   {
@@ -405,6 +472,11 @@ init_gl(void)
 
   assert(eglCreateImageKHR != NULL);
 
+  eglDestroyImageKHR =
+      (void *) eglGetProcAddress("eglDestroyImageKHR");
+
+  assert(eglDestroyImageKHR != NULL);
+
   _glEGLImageTargetTexture2DOES =
       (void *) eglGetProcAddress("glEGLImageTargetTexture2DOES");
 
@@ -413,6 +485,11 @@ init_gl(void)
   _glDiscardFramebufferEXT =
             (void *) eglGetProcAddress("glDiscardFramebufferEXT");
 
+  /* without fences compositions are waited for with glFinish */
+  eglCreateSyncKHR = (void *) eglGetProcAddress("eglCreateSyncKHR");
+  eglDestroySyncKHR = (void *) eglGetProcAddress("eglDestroySyncKHR");
+  eglClientWaitSyncKHR = (void *) eglGetProcAddress("eglClientWaitSyncKHR");
+
   gl.display = get_platform_display(EGL_PLATFORM_GBM_KHR, gbm.dev, NULL);
 
   if (!eglInitialize(gl.display, &major, &minor))
@@ -421,6 +498,26 @@ init_gl(void)
     return -1;
   }
 
+  extensions = eglQueryString(gl.display, EGL_EXTENSIONS);
+
+  if (!has_extension(extensions, "EGL_KHR_fence_sync") ||
+      !eglDestroySyncKHR || !eglClientWaitSyncKHR)
+  {
+    eglCreateSyncKHR = NULL;
+  }
+
+  /* fence fds tell the epoll loop when a composition is done */
+  if (eglCreateSyncKHR &&
+      has_extension(extensions, "EGL_ANDROID_native_fence_sync"))
+  {
+    eglDupNativeFenceFDANDROID =
+        (void *) eglGetProcAddress("eglDupNativeFenceFDANDROID");
+  }
+
+  fprintf(stderr, "composition completion: %s\n",
+          eglDupNativeFenceFDANDROID ? "native fences" :
+          eglCreateSyncKHR ? "polled fences" : "glFinish");
+
   if (!eglBindAPI(EGL_OPENGL_ES_API))
   {
     fprintf(stderr, "failed to bind api EGL_OPENGL_ES_API\n");
@@ -441,6 +538,14 @@ init_gl(void)
     return -1;
   }
 
+  gl.import_context = eglCreateContext(gl.display, gl.config, gl.context,
+                                       context_attribs);
+  if (gl.import_context == EGL_NO_CONTEXT)
+  {
+    fprintf(stderr, "failed to create import context\n");
+    return -1;
+  }
+
   /* connect the context to the surface */
   eglMakeCurrent(gl.display, EGL_NO_SURFACE, EGL_NO_SURFACE, gl.context);
 
@@ -506,9 +611,6 @@ texture_from_image(EGLImageKHR image)
 }
 
 
-GLuint bo_fbo = 0;
-GLuint tex;
-
 GLuint
 texture_from_bo(struct gbm_bo *bo)
 {
@@ -533,13 +635,318 @@ GLuint fbo_from_tex(GLuint tex)
   return fbo;
 }
 
-static struct {
+#define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
+
+/*
+ * An imported dma-buf, shared by every pixmap created from it: by a client
+ * that sends the same buffer again, say after reconnecting, or by clients
+ * sharing a buffer. Found by the inode of every plane's dma-buf, which cannot
+ * be reused by another buffer while the EGLImage holds a reference to it.
+ */
+struct import_plane_id
+{
+  dev_t dev;
+  ino_t ino;
+};
+
+struct import
+{
+  struct import_plane_id ids[GLAMOR_MAX_PLANES];
+  uint32_t width;
+  uint32_t height;
+  uint32_t format;
+  uint32_t num_planes;
+  uint64_t modifier;
+  struct glamor_plane planes[GLAMOR_MAX_PLANES];
+  EGLImageKHR image;
   GLuint tex;
+  uint64_t size;
+  int refs;
+};
+
+struct pixmap
+{
+  /* of the live pixmap, or the one the next create must use */
+  uint16_t generation;
+  int live;
+  struct import *import;
+  /* not needed any more, released when the GPU is done with last_used */
+  int release_pending;
+  /* the last composition that drew it */
+  uint64_t last_used;
+};
+
+/* what an epoll event of a client is about */
+enum watch_kind
+{
+  WATCH_SOCKET,
+  WATCH_DOORBELL
+};
+
+struct watch
+{
+  enum watch_kind kind;
+  struct client *client;
+};
+
+/*
+ * The IPC thread owns the socket and the rings, the render thread everything
+ * from pixmaps on. Both send on fd, each with its own batch.
+ */
+struct client
+{
+  int fd;
+  /* hung up, freed once the render thread let go of it */
+  int dead;
+  struct watch socket_watch;
+  struct watch doorbell_watch;
+  /* rings, once all of ring_fds are there */
+  struct glamor_ring_shm *ring;
+  int ring_fds[GLAMOR_RING_FDS];
+  /* the server info and errors in what the client sent */
+  struct glamor_batch ipc_reply;
+  /* the render thread's end of the rings, NULL until they are attached */
+  struct glamor_ring *events;
+  int events_doorbell;
+  /* indexed by GLAMOR_ID_INDEX(), grows on demand */
+  struct pixmap *pixmaps;
+  uint32_t pixmap_slots;
+  uint32_t live_pixmaps;
+  uint64_t pixmap_bytes;
+  uint64_t peak_pixmap_bytes;
+  uint32_t pending_releases;
+  /* latest present, shown at the next tick */
+  int has_present;
+  uint32_t present_id;
+  uint32_t present_serial;
+  uint64_t present_ns;
+  /* what was shown last, redrawn if nothing new comes */
+  int has_shown;
+  uint32_t shown_id;
+  /* replies go out once everything a packet or a tick did is done */
+  struct glamor_batch reply;
+  /* replies the socket did not take yet, oldest first, retried every tick */
+  slist *backlog;
+  int backlog_len;
+  /* stopped reading, disconnected, nothing is sent to it anymore */
+  int dropped;
+};
+
+/*
+ * Client sockets never block either thread. A client that falls this many
+ * packets behind on reading is disconnected.
+ */
+#define CLIENT_BACKLOG_MAX 64
+
+/* the render thread's */
+static slist *clients;
+static int epoll_fd;
+
+/* the IPC thread's */
+static int ipc_epoll_fd;
+static slist *imports;
+
+/*
+ * What the IPC thread hands the render thread, and what comes back once the
+ * render thread is done with it.
+ */
+enum thread_cmd_type
+{
+  /* to the render thread */
+  RENDER_CLIENT_NEW,
+  RENDER_CLIENT_GONE,
+  RENDER_RING_ATTACH,
+  RENDER_PIXMAP_CREATE,
+  RENDER_PIXMAP_PRESENT,
+  RENDER_PIXMAP_DESTROY,
+  /* to the IPC thread */
+  IPC_IMPORT_PUT,
+  IPC_CLIENT_FREE
+};
+
+struct thread_cmd
+{
+  enum thread_cmd_type type;
+  struct client *client;
+  uint32_t id;
+  uint32_t serial;
+  struct import *import;
+};
+
+#define THREAD_QUEUE_SIZE 1024
+
+/* a glamor ring of commands that carry pointers */
+struct thread_queue
+{
+  struct glamor_ring_index index;
+  struct thread_cmd cmds[THREAD_QUEUE_SIZE] __attribute__((aligned(64)));
+  /* eventfd, rung when the queue stops being empty */
+  int doorbell;
+  /* eventfd, rung when the queue stops being full */
+  int space;
+};
+
+static struct thread_queue to_render;
+static struct thread_queue to_ipc;
+/* what did not fit in to_ipc, the render thread does not wait for it */
+static slist *ipc_backlog;
+
+/* something changed since the last composition */
+static int needs_compose = 1;
+
+/* last flip, the refresh period and how long compositions take lately */
+static uint64_t vblank_ns;
+/* when the timer is set to go off for the next composition */
+static uint64_t compose_at_ns;
+static uint64_t period_ns;
+static uint64_t compose_budget_ns;
+
+/* margin for the flip to make it to the vblank */
+#define COMPOSE_SLACK_NS 1000000ULL
+
+/*
+ * Compositions the GPU may still be busy with, oldest first. A flip only
+ * completes after the GPU is done with its buffer, so there are never more
+ * of them than scanout buffers.
+ */
+struct frame
+{
+  uint64_t seq;
+  EGLSyncKHR sync;
+  /* readable once the frame is done, -1 without native fences */
+  int fence_fd;
+  uint64_t start_ns;
+};
+
+static struct frame frames[MAX_SCANOUTS];
+static int frames_head;
+static int frames_count;
+/* of the last composition, and up to which all of them are done */
+static uint64_t frame_seq;
+static uint64_t completed_seq;
+
+static struct
+{
+  uint64_t frames;
+  uint64_t flips;
+  uint64_t no_buffer;
+  uint64_t compose_ns;
+  double compose_sq_ns;
+  uint64_t compose_max_ns;
+  /* how late the render thread got to the timer */
+  uint64_t ticks;
+  uint64_t wake_ns;
+  double wake_sq_ns;
+  uint64_t wake_max_ns;
+  uint64_t done_ns;
+  uint64_t done_max_ns;
+  uint64_t done_count;
+  uint64_t releases;
+  uint64_t latency_ns;
+  uint64_t latency_count;
+  uint64_t latency_max_ns;
+  uint64_t presents;
+  uint64_t skipped;
+  uint64_t start_ns;
+} stats;
+
+/* kept by the IPC thread, reported by the render thread */
+static struct
+{
+  _Atomic uint64_t bytes;
+  _Atomic int count;
+  _Atomic uint64_t imports;
+  _Atomic uint64_t import_ns;
+  _Atomic uint64_t hits;
+} import_stats;
+
+static uint64_t
+time_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* -1 if the queue is full */
+static int
+thread_queue_push(struct thread_queue *q, const struct thread_cmd *cmd)
+{
+  return glamor_ring_push_slot(&q->index, q->cmds, THREAD_QUEUE_SIZE,
+                               sizeof(*cmd), cmd, q->doorbell);
+}
+
+/* 0 if the queue is empty */
+static int
+thread_queue_pop(struct thread_queue *q, struct thread_cmd *cmd)
+{
+  return glamor_ring_pop_slot(&q->index, q->cmds, THREAD_QUEUE_SIZE,
+                              sizeof(*cmd), cmd, q->space);
+}
+
+static int
+thread_queue_init(struct thread_queue *q)
+{
+  q->doorbell = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  q->space = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+  if (q->doorbell < 0 || q->space < 0)
+  {
+    perror("eventfd");
+    return -1;
+  }
+
+  return 0;
+}
+
+/*
+ * IPC thread. With a whole queue of work for the render thread already
+ * waiting, the clients wait too.
+ */
+static void
+render_push(enum thread_cmd_type type, struct client *c, uint32_t id,
+            uint32_t serial, struct import *imp)
+{
+  struct thread_cmd cmd = {type, c, id, serial, imp};
+
+  while (thread_queue_push(&to_render, &cmd))
+  {
+    struct pollfd pfd = {to_render.space, POLLIN, 0};
+
+    /* the render thread rings it once it took something from a full queue */
+    if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+      perror("poll");
+
+    glamor_doorbell_clear(to_render.space);
+  }
+}
+
+/* render thread, never waits for the IPC thread */
+static void
+ipc_push(enum thread_cmd_type type, struct client *c, struct import *imp)
+{
+  struct thread_cmd cmd = {type, c, 0, 0, imp}, *copy;
+
+  if (!ipc_backlog && !thread_queue_push(&to_ipc, &cmd))
+    return;
+
+  copy = malloc(sizeof(*copy));
+  *copy = cmd;
+  ipc_backlog = slist_append(ipc_backlog, copy);
 }
-pixmap[8] = {0};
 
 static void
-draw_pixmap(uint32_t id)
+ipc_backlog_flush(void)
+{
+  while (ipc_backlog && !thread_queue_push(&to_ipc, ipc_backlog->data))
+    ipc_backlog = slist_remove(ipc_backlog, ipc_backlog->data, free);
+}
+
+/* draws tex into the given rectangle of the scanout bo */
+static void
+draw_pixmap(GLuint tex, int x, int y, int width, int height)
 {
   GLushort indices[] =
       { 0, 1, 2, 0, 2, 3 };
@@ -553,11 +960,7 @@ draw_pixmap(uint32_t id)
                               1.0f,   0.0f         // TexCoord 3
   };
 
-  glBindFramebuffer(GL_FRAMEBUFFER, bo_fbo);
-  glViewport(0, 0, drm.mode->hdisplay, drm.mode->vdisplay);
-
-  // Use the program object
-  glUseProgram(programObject);
+  glViewport(x, y, width, height);
 
   // Load the vertex position
   glVertexAttribPointer(positionLoc, 3, GL_FLOAT, GL_FALSE,
@@ -570,138 +973,1671 @@ draw_pixmap(uint32_t id)
   glEnableVertexAttribArray(texCoordLoc);
 
   // Bind the texture
-  glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_EXTERNAL_OES, pixmap[id].tex);
-
-  // Set the sampler texture unit to 0
-  glUniform1i(samplerLoc, 0);
+  glBindTexture(GL_TEXTURE_EXTERNAL_OES, tex);
 
   glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, indices);
+}
 
-    static const GLenum attachments[] = {
-        GL_DEPTH_ATTACHMENT,
-        GL_STENCIL_ATTACHMENT
-    };
+/* NULL unless id is a live pixmap of the client */
+static struct pixmap *
+pixmap_lookup(struct client *c, uint32_t id)
+{
+  uint32_t index = GLAMOR_ID_INDEX(id);
+  struct pixmap *pix;
 
-  _glDiscardFramebufferEXT(GL_FRAMEBUFFER, 2, attachments);
+  if (index >= c->pixmap_slots)
+    return NULL;
+
+  pix = &c->pixmaps[index];
+
+  if (!pix->live || pix->generation != GLAMOR_ID_GENERATION(id))
+    return NULL;
+
+  return pix;
 }
 
-int
-main(int argc, char *argv[])
+/* the free slot for id, the table grows to make room */
+static struct pixmap *
+pixmap_slot(struct client *c, uint32_t id)
 {
-  int ret;
-  struct drm_fb *fb;
-  char buf[256];
+  uint32_t index = GLAMOR_ID_INDEX(id);
+  struct pixmap *pix;
 
-  unlink(SOCKET_NAME);
+  if (index >= GLAMOR_MAX_PIXMAPS)
+    return NULL;
 
-  int s = bind_named_socket(SOCKET_NAME);
-  if (s == -1)
+  if (index >= c->pixmap_slots)
   {
-    fprintf(stdout, "failed to bind to socket\n");
-    return -1;
+    uint32_t slots = c->pixmap_slots ? c->pixmap_slots : 8;
+    struct pixmap *pixmaps;
+
+    while (slots <= index)
+      slots *= 2;
+
+    if (slots > GLAMOR_MAX_PIXMAPS)
+      slots = GLAMOR_MAX_PIXMAPS;
+
+    if (!(pixmaps = realloc(c->pixmaps, slots * sizeof(*pixmaps))))
+      return NULL;
+
+    memset(&pixmaps[c->pixmap_slots], 0,
+           (slots - c->pixmap_slots) * sizeof(*pixmaps));
+    c->pixmaps = pixmaps;
+    c->pixmap_slots = slots;
   }
 
-  listen(s, 5);
-  s = accept(s, 0, 0);
+  pix = &c->pixmaps[index];
 
-  fprintf(stderr, "server socket connected %d\n", s);
+  if (pix->live || pix->generation != GLAMOR_ID_GENERATION(id))
+    return NULL;
 
-  if ((ret = init_drm()))
+  return pix;
+}
+
+static int
+match_import(const void *data, const void *user_data)
+{
+  const struct import *imp = data;
+  const struct import *key = user_data;
+  uint32_t i;
+
+  if (imp->width != key->width || imp->height != key->height ||
+      imp->format != key->format || imp->num_planes != key->num_planes ||
+      imp->modifier != key->modifier ||
+      memcmp(imp->planes, key->planes,
+             key->num_planes * sizeof(key->planes[0])))
   {
-    fprintf(stdout, "failed to initialize DRM\n");
-    return ret;
+    return 0;
   }
 
-  if ((ret = init_gbm()))
+  for (i = 0; i < key->num_planes; i++)
   {
-    fprintf(stdout, "failed to initialize GBM\n");
-    return ret;
+    if (imp->ids[i].dev != key->ids[i].dev ||
+        imp->ids[i].ino != key->ids[i].ino)
+    {
+      return 0;
+    }
   }
 
-  if ((ret = init_gl()))
+  return 1;
+}
+
+static void
+close_fds(int *fds, int count)
+{
+  while (count)
+    close(fds[--count]);
+}
+
+static struct gbm_bo *
+import_bo(const struct import *key, int *fds)
+{
+  struct gbm_import_fd_modifier_data modifier_data =
   {
-    fprintf(stdout, "failed to initialize EGL\n");
-    return ret;
+    .width = key->width,
+    .height = key->height,
+    .format = key->format,
+    .num_fds = key->num_planes,
+    .modifier = key->modifier
+  };
+  uint32_t i;
+
+  /* drivers without modifier support still take the plain import */
+  if (key->num_planes == 1 && key->modifier == GLAMOR_MOD_INVALID)
+  {
+    struct gbm_import_fd_data import_data =
+    {
+      .fd = fds[0],
+      .width = key->width,
+      .height = key->height,
+      .stride = key->planes[0].stride,
+      .format = key->format
+    };
+
+    return gbm_bo_import(gbm.dev, GBM_BO_IMPORT_FD, &import_data, 0);
   }
 
-  fb = drm_fb_get_from_bo(gbm.bo);
+  for (i = 0; i < key->num_planes; i++)
+  {
+    modifier_data.fds[i] = fds[i];
+    modifier_data.strides[i] = key->planes[i].stride;
+    modifier_data.offsets[i] = key->planes[i].offset;
+  }
 
-  tex = texture_from_bo(gbm.bo);
-  bo_fbo = fbo_from_tex(tex);
+  return gbm_bo_import(gbm.dev, GBM_BO_IMPORT_FD_MODIFIER, &modifier_data, 0);
+}
 
-  glClearColor(0, 1, 0, 1.0f);
-  glClear(GL_COLOR_BUFFER_BIT);
+/*
+ * Takes a reference to the import of the dma-buf msg describes, with the fd
+ * of every plane in fds. The fds are closed. Planes usually share a dma-buf,
+ * but need not, so each one is part of the key. IPC thread, on
+ * gl.import_context.
+ */
+static struct import *
+import_get(const struct glamor_msg_pixmap_create *msg, int *fds)
+{
+  struct import key = {0}, *imp;
+  struct gbm_bo *bo;
+  struct stat st;
+  uint64_t start;
+  slist *l;
+  uint32_t i;
+
+  key.width = le32toh(msg->width);
+  key.height = le32toh(msg->height);
+  key.format = le32toh(msg->format);
+  key.num_planes = le32toh(msg->num_planes);
+  key.modifier = (uint64_t)le32toh(msg->modifier_hi) << 32 |
+      le32toh(msg->modifier_lo);
+
+  for (i = 0; i < key.num_planes; i++)
+  {
+    key.planes[i].offset = le32toh(msg->planes[i].offset);
+    key.planes[i].stride = le32toh(msg->planes[i].stride);
 
-  /* set mode: */
-  ret = drmModeSetCrtc(drm.fd, drm.crtc_id, fb->fb_id, 0, 0,
-                       &drm.connector_id, 1, drm.mode);
-  if (ret)
+    if (fstat(fds[i], &st))
+    {
+      perror("fstat");
+      close_fds(fds, key.num_planes);
+      return NULL;
+    }
+
+    key.ids[i].dev = st.st_dev;
+    key.ids[i].ino = st.st_ino;
+  }
+
+  if ((l = slist_find(imports, match_import, &key)))
   {
-          fprintf(stdout, "failed to set mode: %s\n", strerror(errno));
-          return ret;
+    imp = l->data;
+    imp->refs++;
+    import_stats.hits++;
+    close_fds(fds, key.num_planes);
+
+    return imp;
   }
 
-  uint32_t tmp = drm.mode->hdisplay;
-  write_fd(s, &tmp, sizeof(tmp), -1);
-  tmp = drm.mode->vdisplay;
-  write_fd(s, &tmp, sizeof(tmp), -1);
+  start = time_ns();
+  bo = import_bo(&key, fds);
+  close_fds(fds, key.num_planes);
 
-  int fd;
+  if (!bo)
+    return NULL;
+
+  imp = calloc(1, sizeof(*imp));
+  *imp = key;
+  imp->image = image_from_bo(bo);
+  gbm_bo_destroy(bo);
 
-  while (read_fd(s, buf, sizeof(buf), &fd))
+  if (imp->image == EGL_NO_IMAGE_KHR)
   {
-    struct msg *msg = (struct msg *)buf;
+    free(imp);
+    return NULL;
+  }
 
-    switch (msg->cmd)
-    {
-      case CMD_PIXMAP_CREATE:
-      {
-        uint32_t id = hexstrntoul(msg->u.create.id);
-        struct gbm_bo *pixmap_bo;
-        struct gbm_import_fd_data import_data =
-        {
-          .fd = fd,
-          .width = hexstrntoul(msg->u.create.width),
-          .height = hexstrntoul(msg->u.create.height),
-          .stride = hexstrntoul(msg->u.create.stride),
-          .format = hexstrntoul(msg->u.create.format)
-        };
+  imp->tex = texture_from_image(imp->image);
 
-        fprintf(stderr, "id %d %d %d %d %d %x\n",
-                id,
-                import_data.fd,
-                import_data.width,
-                import_data.height,
-                import_data.stride,
-                import_data.format);
-        pixmap_bo = gbm_bo_import(gbm.dev, GBM_BO_IMPORT_FD, &import_data, 0);
+  /*
+   * The render thread's context sees the texture complete only once the
+   * commands setting it up are done. Nothing else runs on this context, so
+   * this waits for the import alone, and the render thread never does.
+   */
+  glFinish();
 
-        close(import_data.fd);
+  /* an upper bound, chroma planes are usually subsampled */
+  for (i = 0; i < key.num_planes; i++)
+    imp->size += (uint64_t)key.planes[i].stride * key.height;
+  imp->refs = 1;
 
-        if (!pixmap_bo)
-          return -1;
+  imports = slist_append(imports, imp);
+  import_stats.bytes += imp->size;
+  import_stats.count++;
+  import_stats.imports++;
+  import_stats.import_ns += time_ns() - start;
 
-        pixmap[id].tex = texture_from_bo(pixmap_bo);
-        gbm_bo_destroy(pixmap_bo);
+  return imp;
+}
 
-        sprintf(buf, "created pixmap id %d fd %d\n", id, fd);
-        write_fd(s, buf, strlen(buf) + 1, -1);
+static void
+import_put(struct import *imp)
+{
+  if (--imp->refs)
+    return;
 
-        break;
-      }
-      case CMD_PIXMAP_PRESENT:
-      {
-        uint32_t id = hexstrntoul(msg->u.create.id);
+  glDeleteTextures(1, &imp->tex);
+  eglDestroyImageKHR(gl.display, imp->image);
+  import_stats.bytes -= imp->size;
+  import_stats.count--;
 
-        draw_pixmap(id);
+  imports = slist_remove(imports, imp, free);
+}
 
-        sprintf(buf, "PRESENTED id %d\n", id);
-        write_fd(s, buf, strlen(buf) + 1, -1);
+/* takes over the reference to imp */
+static int
+pixmap_create(struct client *c, uint32_t id, struct import *imp)
+{
+  struct pixmap *pix;
 
-        break;
-      }
-    }
+  if (!(pix = pixmap_slot(c, id)))
+  {
+    fprintf(stderr, "bad pixmap id %x\n", id);
+    ipc_push(IPC_IMPORT_PUT, NULL, imp);
+    return -1;
+  }
+
+  pix->import = imp;
+  pix->live = 1;
+
+  c->live_pixmaps++;
+  c->pixmap_bytes += pix->import->size;
+
+  if (c->pixmap_bytes > c->peak_pixmap_bytes)
+    c->peak_pixmap_bytes = c->pixmap_bytes;
+
+  return 0;
+}
+
+static void
+pixmap_free(struct client *c, struct pixmap *pix)
+{
+  if (pix->release_pending)
+    c->pending_releases--;
+
+  pix->release_pending = 0;
+  c->live_pixmaps--;
+  c->pixmap_bytes -= pix->import->size;
+
+  ipc_push(IPC_IMPORT_PUT, NULL, pix->import);
+
+  pix->import = NULL;
+  pix->live = 0;
+  pix->generation++;
+}
+
+static void
+send_error(struct glamor_batch *reply, uint32_t cmd, uint32_t id)
+{
+  struct glamor_msg_error *err =
+      glamor_batch_add(reply, GLAMOR_EVENT_ERROR, sizeof(*err));
+
+  if (err)
+  {
+    err->cmd = htole32(cmd);
+    err->id = htole32(id);
+  }
+}
+
+/*
+ * Either thread. The IPC thread sees the hang-up and the client goes away as
+ * if it had disconnected itself.
+ */
+static void
+client_drop(struct client *c)
+{
+  fprintf(stderr, "client %d does not read its socket, disconnecting\n",
+          c->fd);
+  shutdown(c->fd, SHUT_RDWR);
+}
+
+/* 0 if the socket took it, or will never take anything again */
+static int
+batch_try_send(int fd, struct glamor_batch *batch)
+{
+  struct iovec iov = {batch->data, batch->length};
+
+  return write_fd(fd, &iov, 1, batch->fds, batch->nfds) < 0 &&
+      errno == EAGAIN;
+}
+
+/* IPC thread, what it replies is rare and small */
+static void
+ipc_reply_send(struct client *c)
+{
+  if (c->ipc_reply.length && batch_try_send(c->fd, &c->ipc_reply))
+    client_drop(c);
+
+  glamor_batch_init(&c->ipc_reply);
+}
+
+/* render thread, sends what waited for the socket to make room */
+static void
+client_backlog_flush(struct client *c)
+{
+  while (c->backlog && !batch_try_send(c->fd, c->backlog->data))
+  {
+    c->backlog = slist_remove(c->backlog, c->backlog->data, free);
+    c->backlog_len--;
+  }
+}
+
+static void
+client_backlog_free(struct client *c)
+{
+  while (c->backlog)
+    c->backlog = slist_remove(c->backlog, c->backlog->data, free);
+
+  c->backlog_len = 0;
+}
+
+/* render thread, retries what the sockets did not take */
+static void
+clients_backlog_flush(void)
+{
+  slist *l;
+
+  slist_for_each(clients, l)
+    client_backlog_flush(l->data);
+}
+
+/* render thread, sends the client's reply, or queues it behind the backlog */
+static void
+client_send(struct client *c)
+{
+  struct glamor_batch *copy;
+
+  if (!c->reply.length || c->dropped)
+  {
+    glamor_batch_init(&c->reply);
+    return;
+  }
+
+  client_backlog_flush(c);
+
+  if (!c->backlog && !batch_try_send(c->fd, &c->reply))
+  {
+    glamor_batch_init(&c->reply);
+    return;
+  }
+
+  if (c->backlog_len == CLIENT_BACKLOG_MAX)
+  {
+    client_drop(c);
+    client_backlog_free(c);
+    c->dropped = 1;
+    glamor_batch_init(&c->reply);
+    return;
+  }
+
+  copy = malloc(sizeof(*copy));
+  *copy = c->reply;
+  c->backlog = slist_append(c->backlog, copy);
+  c->backlog_len++;
+  glamor_batch_init(&c->reply);
+}
+
+/* 0 if the event went on the client's ring */
+static int
+ring_event(struct client *c, uint32_t type, uint32_t id, uint32_t serial)
+{
+  struct glamor_ring_cmd cmd = {type, id, serial};
+
+  /* the socket still works if the client does not keep up */
+  return !c->events ||
+      glamor_ring_push(c->events, &cmd, c->events_doorbell);
+}
+
+/* room for an event in the client's reply */
+static void *
+reply_add(struct client *c, uint32_t type, uint32_t size)
+{
+  void *msg = glamor_batch_add(&c->reply, type, size);
+
+  /* full, make room */
+  if (!msg)
+  {
+    client_send(c);
+    msg = glamor_batch_add(&c->reply, type, size);
+  }
+
+  return msg;
+}
+
+static void
+send_presented(struct client *c, uint32_t id, uint32_t serial)
+{
+  struct glamor_msg_presented *presented;
+
+  if (!ring_event(c, GLAMOR_EVENT_PRESENTED, id, serial))
+    return;
+
+  presented = reply_add(c, GLAMOR_EVENT_PRESENTED, sizeof(*presented));
+  presented->id = htole32(id);
+  presented->serial = htole32(serial);
+}
+
+static void
+send_released(struct client *c, uint32_t id)
+{
+  struct glamor_msg_buffer_released *released;
+
+  stats.releases++;
+
+  if (!ring_event(c, GLAMOR_EVENT_BUFFER_RELEASED, id, 0))
+    return;
+
+  released = reply_add(c, GLAMOR_EVENT_BUFFER_RELEASED, sizeof(*released));
+  released->id = htole32(id);
+}
+
+static uint32_t
+pixmap_id(struct client *c, struct pixmap *pix)
+{
+  return GLAMOR_ID(pix - c->pixmaps, pix->generation);
+}
+
+/*
+ * The server no longer needs pix, the client gets it back as soon as no
+ * composition in flight reads it.
+ */
+static void
+pixmap_unhold(struct client *c, struct pixmap *pix)
+{
+  if (pix->last_used > completed_seq)
+  {
+    pix->release_pending = 1;
+    c->pending_releases++;
+    return;
+  }
+
+  send_released(c, pixmap_id(c, pix));
+}
+
+/* releases what the compositions done by now were the last to read */
+static void
+release_pixmaps(void)
+{
+  slist *l;
+
+  slist_for_each(clients, l)
+  {
+    struct client *c = l->data;
+    uint32_t i;
+
+    if (!c->pending_releases)
+      continue;
+
+    for (i = 0; i < c->pixmap_slots; i++)
+    {
+      struct pixmap *pix = &c->pixmaps[i];
+
+      if (pix->release_pending && pix->last_used <= completed_seq)
+      {
+        pix->release_pending = 0;
+        c->pending_releases--;
+        pixmap_unhold(c, pix);
+      }
+    }
+
+    client_send(c);
+  }
+}
+
+static void
+pixmap_present(struct client *c, uint32_t id, uint32_t serial)
+{
+  struct pixmap *pix = pixmap_lookup(c, id);
+
+  if (!pix)
+  {
+    send_error(&c->reply, CMD_PIXMAP_PRESENT, id);
+    return;
+  }
+
+  stats.presents++;
+
+  /* presented again before the release went out, it stays */
+  if (pix->release_pending)
+  {
+    pix->release_pending = 0;
+    c->pending_releases--;
+  }
+
+  /* replaced before it was ever shown, the server is done with it */
+  if (c->has_present)
+  {
+    struct pixmap *old = pixmap_lookup(c, c->present_id);
+
+    send_presented(c, c->present_id, c->present_serial);
+    stats.skipped++;
+
+    if (old != pix && !(c->has_shown && c->shown_id == c->present_id))
+      pixmap_unhold(c, old);
+  }
+
+  c->has_present = 1;
+  c->present_ns = time_ns();
+  needs_compose = 1;
+  c->present_id = id;
+  c->present_serial = serial;
+}
+
+static void
+pixmap_destroy(struct client *c, uint32_t id)
+{
+  struct pixmap *pix = pixmap_lookup(c, id);
+
+  if (!pix)
+  {
+    send_error(&c->reply, CMD_PIXMAP_DESTROY, id);
+    return;
+  }
+
+  /* never going to be shown now */
+  if (c->has_present && c->present_id == id)
+  {
+    send_presented(c, c->present_id, c->present_serial);
+    c->has_present = 0;
+  }
+
+  if (c->has_shown && c->shown_id == id)
+  {
+    c->has_shown = 0;
+    needs_compose = 1;
+  }
+
+  pixmap_free(c, pix);
+}
+
+static int
+ring_attach(struct client *c, uint32_t what, int fd)
+{
+  struct epoll_event ev = {EPOLLIN};
+  int i;
+
+  if (fd == -1 || what >= GLAMOR_RING_FDS || c->ring_fds[what] != -1)
+    return -1;
+
+  /*
+   * The doorbells are read and written from the IPC and render threads, a
+   * blocking fd the client made could stall either of them.
+   */
+  if (what != GLAMOR_RING_SHM)
+  {
+    int flags = fcntl(fd, F_GETFL);
+
+    if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
+    {
+      perror("fcntl");
+      return -1;
+    }
+  }
+
+  c->ring_fds[what] = fd;
+
+  for (i = 0; i < GLAMOR_RING_FDS; i++)
+  {
+    if (c->ring_fds[i] == -1)
+      return 0;
+  }
+
+  if (!(c->ring = glamor_ring_shm_map(c->ring_fds[GLAMOR_RING_SHM])))
+    goto fail;
+
+  ev.data.ptr = &c->doorbell_watch;
+
+  if (epoll_ctl(ipc_epoll_fd, EPOLL_CTL_ADD,
+                c->ring_fds[GLAMOR_RING_SERVER_DOORBELL], &ev))
+  {
+    perror("epoll_ctl");
+    glamor_ring_shm_unmap(c->ring);
+    c->ring = NULL;
+    goto fail;
+  }
+
+  render_push(RENDER_RING_ATTACH, c, 0, 0, NULL);
+  fprintf(stderr, "client %d uses rings\n", c->fd);
+
+  return 0;
+
+fail:
+  /* the caller closes fd */
+  c->ring_fds[what] = -1;
+
+  return -1;
+}
+
+/*
+ * The next count fds of the packet, in order, NULL if there are not that
+ * many left. They belong to the caller then.
+ */
+static int *
+packet_take_fds(struct glamor_packet *packet, int *next_fd, uint32_t count)
+{
+  int *fds = &packet->fds[*next_fd];
+
+  if (count > packet->nfds - *next_fd)
+    return NULL;
+
+  *next_fd += count;
+
+  return fds;
+}
+
+/* hands every message in a packet to the render thread */
+static void
+handle_packet(struct client *c, struct glamor_packet *packet)
+{
+  struct glamor_msg_header *hdr;
+  size_t offset = 0;
+  int next_fd = 0;
+
+  while ((hdr = glamor_msg_next(packet->data, packet->length, &offset)))
+  {
+    switch (hdr->type)
+    {
+      case CMD_PIXMAP_CREATE:
+      {
+        struct glamor_msg_pixmap_create *msg =
+            glamor_msg_cast(hdr, struct glamor_msg_pixmap_create);
+        uint32_t planes = msg ? le32toh(msg->num_planes) : 0;
+        int *fds;
+
+        struct import *imp;
+
+        if (!planes || planes > GLAMOR_MAX_PLANES ||
+            !(fds = packet_take_fds(packet, &next_fd, planes)))
+        {
+          fprintf(stderr, "bad planes for pixmap id %x\n",
+                  msg ? le32toh(msg->id) : 0);
+          send_error(&c->ipc_reply, hdr->type, msg ? le32toh(msg->id) : 0);
+          break;
+        }
+
+        /* consumes the fds */
+        if (!(imp = import_get(msg, fds)))
+        {
+          fprintf(stderr, "failed to import pixmap id %x\n",
+                  le32toh(msg->id));
+          send_error(&c->ipc_reply, hdr->type, le32toh(msg->id));
+          break;
+        }
+
+        render_push(RENDER_PIXMAP_CREATE, c, le32toh(msg->id), 0, imp);
+        break;
+      }
+      case CMD_PIXMAP_PRESENT:
+      {
+        struct glamor_msg_pixmap_present *msg =
+            glamor_msg_cast(hdr, struct glamor_msg_pixmap_present);
+
+        if (msg)
+        {
+          render_push(RENDER_PIXMAP_PRESENT, c, le32toh(msg->id),
+                      le32toh(msg->serial), NULL);
+        }
+        else
+          send_error(&c->ipc_reply, hdr->type, 0);
+
+        break;
+      }
+      case CMD_PIXMAP_DESTROY:
+      {
+        struct glamor_msg_pixmap_destroy *msg =
+            glamor_msg_cast(hdr, struct glamor_msg_pixmap_destroy);
+
+        if (msg)
+          render_push(RENDER_PIXMAP_DESTROY, c, le32toh(msg->id), 0, NULL);
+        else
+          send_error(&c->ipc_reply, hdr->type, 0);
+
+        break;
+      }
+      case CMD_RING_ATTACH:
+      {
+        struct glamor_msg_ring_attach *msg =
+            glamor_msg_cast(hdr, struct glamor_msg_ring_attach);
+        int *fd = packet_take_fds(packet, &next_fd, 1);
+
+        if (!msg || !fd || ring_attach(c, le32toh(msg->what), *fd))
+        {
+          send_error(&c->ipc_reply, hdr->type, 0);
+
+          if (fd)
+            close(*fd);
+        }
+
+        break;
+      }
+      default:
+        fprintf(stderr, "unknown message type %x\n", hdr->type);
+        send_error(&c->ipc_reply, hdr->type, 0);
+        break;
+    }
+  }
+
+  if (offset != packet->length)
+    fprintf(stderr, "malformed message at offset %zu\n", offset);
+
+  /* nobody took them */
+  close_fds(&packet->fds[next_fd], packet->nfds - next_fd);
+  packet->nfds = 0;
+}
+
+/* render thread, the client hung up */
+static void
+client_destroy(struct client *c)
+{
+  uint32_t i;
+
+  fprintf(stderr, "client %d disconnected, %u pixmaps left, peak %.1f MiB\n",
+          c->fd, c->live_pixmaps, c->peak_pixmap_bytes / 1048576.0);
+
+  for (i = 0; i < c->pixmap_slots; i++)
+  {
+    if (c->pixmaps[i].live)
+      pixmap_free(c, &c->pixmaps[i]);
+  }
+
+  free(c->pixmaps);
+  client_backlog_free(c);
+
+  clients = slist_remove(clients, c, NULL);
+  needs_compose = 1;
+  ipc_push(IPC_CLIENT_FREE, c, NULL);
+}
+
+/* IPC thread, once the render thread is done with c */
+static void
+client_free(struct client *c)
+{
+  int i;
+
+  close(c->fd);
+
+  if (c->ring)
+    glamor_ring_shm_unmap(c->ring);
+
+  for (i = 0; i < GLAMOR_RING_FDS; i++)
+  {
+    if (c->ring_fds[i] != -1)
+      close(c->ring_fds[i]);
+  }
+
+  free(c);
+}
+
+/*
+ * IPC thread. Nothing more is read from the client, the render thread frees
+ * its pixmaps and hands it back to client_free().
+ */
+static void
+client_hangup(struct client *c)
+{
+  epoll_ctl(ipc_epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+
+  if (c->ring)
+  {
+    epoll_ctl(ipc_epoll_fd, EPOLL_CTL_DEL,
+              c->ring_fds[GLAMOR_RING_SERVER_DOORBELL], NULL);
+  }
+
+  /* there may be more events for it in the current batch */
+  c->dead = 1;
+  render_push(RENDER_CLIENT_GONE, c, 0, 0, NULL);
+}
+
+static void
+client_accept(int listen_fd)
+{
+  struct glamor_msg_server_info *info;
+  struct epoll_event ev = {EPOLLIN};
+  struct client *c;
+  int fd, i;
+
+  if ((fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK)) < 0)
+  {
+    perror("accept");
+    return;
+  }
+
+  c = calloc(1, sizeof(*c));
+  c->fd = fd;
+  c->socket_watch.kind = WATCH_SOCKET;
+  c->socket_watch.client = c;
+  c->doorbell_watch.kind = WATCH_DOORBELL;
+  c->doorbell_watch.client = c;
+
+  for (i = 0; i < GLAMOR_RING_FDS; i++)
+    c->ring_fds[i] = -1;
+
+  glamor_batch_init(&c->ipc_reply);
+  glamor_batch_init(&c->reply);
+
+  ev.data.ptr = &c->socket_watch;
+
+  if (epoll_ctl(ipc_epoll_fd, EPOLL_CTL_ADD, fd, &ev))
+  {
+    perror("epoll_ctl");
+    close(fd);
+    free(c);
+    return;
+  }
+
+  info = glamor_batch_add(&c->ipc_reply, GLAMOR_EVENT_SERVER_INFO,
+                          sizeof(*info));
+  info->version = htole32(GLAMOR_PROTOCOL_VERSION);
+  info->width = htole32(drm.mode->hdisplay);
+  info->height = htole32(drm.mode->vdisplay);
+  ipc_reply_send(c);
+
+  render_push(RENDER_CLIENT_NEW, c, 0, 0, NULL);
+}
+
+/* handles what the client queued, -1 if it is gone */
+static int
+client_dispatch(struct client *c)
+{
+  static struct glamor_packet packets[GLAMOR_RECV_PACKETS];
+  int count, i;
+
+  if ((count = glamor_recv_packets(c->fd, packets, GLAMOR_RECV_PACKETS)) < 0)
+  {
+    client_hangup(c);
+    return -1;
+  }
+
+  for (i = 0; i < count; i++)
+    handle_packet(c, &packets[i]);
+
+  ipc_reply_send(c);
+
+  return 0;
+}
+
+static void
+client_dispatch_ring(struct client *c)
+{
+  struct pollfd pfd = {c->fd, POLLIN, 0};
+  struct glamor_ring_cmd cmd;
+  int ret;
+
+  glamor_doorbell_clear(c->ring_fds[GLAMOR_RING_SERVER_DOORBELL]);
+
+  /*
+   * The client sends a pixmap's create on the socket before presenting it on
+   * the ring, so anything queued there goes first.
+   */
+  while (poll(&pfd, 1, 0) == 1)
+  {
+    if (client_dispatch(c))
+      return;
+  }
+
+  while ((ret = glamor_ring_pop(&c->ring->to_server, &cmd)) > 0)
+  {
+    if (cmd.type == CMD_PIXMAP_PRESENT)
+      render_push(RENDER_PIXMAP_PRESENT, c, cmd.id, cmd.serial, NULL);
+    else
+      send_error(&c->ipc_reply, cmd.type, cmd.id);
+  }
+
+  if (ret < 0)
+  {
+    fprintf(stderr, "client %d corrupted its ring\n", c->fd);
+    client_hangup(c);
+    return;
+  }
+
+  /* errors */
+  ipc_reply_send(c);
+}
+
+/* IPC thread, takes back what the render thread is done with */
+static void
+ipc_dispatch(void)
+{
+  struct thread_cmd cmd;
+
+  glamor_doorbell_clear(to_ipc.doorbell);
+
+  while (thread_queue_pop(&to_ipc, &cmd))
+  {
+    if (cmd.type == IPC_IMPORT_PUT)
+      import_put(cmd.import);
+    else if (cmd.type == IPC_CLIENT_FREE)
+      client_free(cmd.client);
+  }
+}
+
+/*
+ * Accepts clients and parses what they send, imports their buffers on
+ * gl.import_context and queues the rest for the render thread, so neither
+ * clients nor imports hold up a composition.
+ */
+static void *
+ipc_thread(void *data)
+{
+  int *listen_fd = data;
+
+  if (!eglMakeCurrent(gl.display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                      gl.import_context))
+  {
+    fprintf(stderr, "failed to make the import context current\n");
+    exit(1);
+  }
+
+  while (1)
+  {
+    struct epoll_event events[64];
+    int i, n = epoll_wait(ipc_epoll_fd, events, ARRAY_SIZE(events), -1);
+    int returned = 0;
+
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+
+      perror("epoll_wait");
+      exit(1);
+    }
+
+    for (i = 0; i < n; i++)
+    {
+      if (events[i].data.ptr == listen_fd)
+        client_accept(*listen_fd);
+      else if (events[i].data.ptr == &to_ipc)
+        returned = 1;
+      else
+      {
+        struct watch *w = events[i].data.ptr;
+
+        if (w->client->dead)
+          continue;
+
+        if (w->kind == WATCH_SOCKET)
+          client_dispatch(w->client);
+        else
+          client_dispatch_ring(w->client);
+      }
+    }
+
+    /* only now, clients freed there may still be in events */
+    if (returned)
+      ipc_dispatch();
+  }
+
+  return NULL;
+}
+
+/* render thread, executes what the IPC thread queued */
+static void
+render_dispatch(void)
+{
+  struct thread_cmd cmd;
+  slist *l;
+
+  glamor_doorbell_clear(to_render.doorbell);
+
+  while (thread_queue_pop(&to_render, &cmd))
+  {
+    struct client *c = cmd.client;
+
+    switch (cmd.type)
+    {
+      case RENDER_CLIENT_NEW:
+        clients = slist_append(clients, c);
+        needs_compose = 1;
+        fprintf(stderr, "client %d connected, %d clients\n", c->fd,
+                slist_size(clients));
+        break;
+      case RENDER_CLIENT_GONE:
+        client_destroy(c);
+        break;
+      case RENDER_RING_ATTACH:
+        /* mapped before this was queued, unmapped after the client is freed */
+        c->events = &c->ring->to_client;
+        c->events_doorbell = c->ring_fds[GLAMOR_RING_CLIENT_DOORBELL];
+        break;
+      case RENDER_PIXMAP_CREATE:
+        if (pixmap_create(c, cmd.id, cmd.import))
+          send_error(&c->reply, CMD_PIXMAP_CREATE, cmd.id);
+
+        break;
+      case RENDER_PIXMAP_PRESENT:
+        pixmap_present(c, cmd.id, cmd.serial);
+        break;
+      case RENDER_PIXMAP_DESTROY:
+        pixmap_destroy(c, cmd.id);
+        break;
+      default:
+        break;
+    }
+  }
+
+  /* errors and skipped presents */
+  slist_for_each(clients, l)
+  {
+    struct client *c = l->data;
+
+    client_send(c);
+  }
+}
+
+/* in ms, of count samples adding up to sum and their squares to sum_sq */
+static double
+stddev_ms(uint64_t sum, double sum_sq, uint64_t count)
+{
+  double mean;
+
+  if (!count)
+    return 0;
+
+  mean = (double)sum / count;
+
+  return sqrt(fmax(sum_sq / count - mean * mean, 0)) / 1e6;
+}
+
+static void
+report_stats(void)
+{
+  uint64_t imports, import_ns;
+  uint64_t now = time_ns();
+  struct client *largest = NULL;
+  slist *l;
+
+  if (now - stats.start_ns < 1000000000ULL)
+    return;
+
+  slist_for_each(clients, l)
+  {
+    struct client *c = l->data;
+
+    if (!largest || c->pixmap_bytes > largest->pixmap_bytes)
+      largest = c;
+  }
+
+  if (stats.frames && largest)
+  {
+    fprintf(stderr, "%d clients: %llu frames, %llu flips, %llu late, "
+            "compose avg %.3f ms sd %.3f ms max %.3f ms, "
+            "wakeup late avg %.3f ms sd %.3f ms max %.3f ms, "
+            "done avg %.3f ms max %.3f ms, "
+            "present to flip avg %.3f ms max %.3f ms, %llu presents, "
+            "%llu skipped, %llu released\n", slist_size(clients),
+            (unsigned long long)stats.frames,
+            (unsigned long long)stats.flips,
+            (unsigned long long)stats.no_buffer,
+            stats.compose_ns / 1e6 / stats.frames,
+            stddev_ms(stats.compose_ns, stats.compose_sq_ns, stats.frames),
+            stats.compose_max_ns / 1e6,
+            stats.ticks ? stats.wake_ns / 1e6 / stats.ticks : 0,
+            stddev_ms(stats.wake_ns, stats.wake_sq_ns, stats.ticks),
+            stats.wake_max_ns / 1e6,
+            stats.done_count ? stats.done_ns / 1e6 / stats.done_count : 0,
+            stats.done_max_ns / 1e6,
+            stats.latency_count ?
+                stats.latency_ns / 1e6 / stats.latency_count : 0,
+            stats.latency_max_ns / 1e6,
+            (unsigned long long)stats.presents,
+            (unsigned long long)stats.skipped,
+            (unsigned long long)stats.releases);
+    imports = atomic_exchange(&import_stats.imports, 0);
+    import_ns = atomic_exchange(&import_stats.import_ns, 0);
+
+    fprintf(stderr, "  pixmaps %.1f MiB in %d imports, largest client %d "
+            "%.1f MiB in %u, %llu imported avg %.3f ms, %llu cached\n",
+            import_stats.bytes / 1048576.0, import_stats.count,
+            largest->fd, largest->pixmap_bytes / 1048576.0,
+            largest->live_pixmaps, (unsigned long long)imports,
+            imports ? import_ns / 1e6 / imports : 0,
+            (unsigned long long)atomic_exchange(&import_stats.hits, 0));
+  }
+
+  memset(&stats, 0, sizeof(stats));
+  stats.start_ns = now;
+}
+
+static struct scanout *
+get_free_scanout(void)
+{
+  int i;
+
+  for (i = 0; i < num_scanouts; i++)
+  {
+    struct scanout *so = &scanouts[i];
+
+    if (so != front && so != flipping && so != ready)
+      return so;
+  }
+
+  return NULL;
+}
+
+static void
+queue_flip(struct scanout *so)
+{
+  if (drmModePageFlip(drm.fd, drm.crtc_id, so->fb->fb_id,
+                      DRM_MODE_PAGE_FLIP_EVENT, so))
+  {
+    fprintf(stderr, "failed to queue flip: %s\n", strerror(errno));
+    /*
+     * compose() already took the presents and nothing else would bring
+     * them to the screen, draw them again at the next vblank. The scanout
+     * is neither flipping nor ready, so it is free for that.
+     */
+    needs_compose = 1;
+    return;
+  }
+
+  flipping = so;
+}
+
+/* how early to start, follows the slowest recent composition */
+static void
+update_budget(uint64_t ns)
+{
+  compose_budget_ns -= compose_budget_ns / 16;
+
+  if (ns > compose_budget_ns)
+    compose_budget_ns = ns;
+}
+
+static void
+frame_complete(struct frame *f)
+{
+  uint64_t done = time_ns() - f->start_ns;
+
+  if (f->fence_fd != -1)
+  {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, f->fence_fd, NULL);
+    close(f->fence_fd);
+
+    /* only native fences say when exactly the GPU was done */
+    stats.done_ns += done;
+    stats.done_count++;
+
+    if (done > stats.done_max_ns)
+      stats.done_max_ns = done;
+
+    update_budget(done);
+  }
+
+  eglDestroySyncKHR(gl.display, f->sync);
+  completed_seq = f->seq;
+}
+
+/* retires the compositions the GPU is done with, and releases their pixmaps */
+static void
+frames_poll(void)
+{
+  uint64_t completed = completed_seq;
+
+  while (frames_count)
+  {
+    struct frame *f = &frames[frames_head];
+
+    if (eglClientWaitSyncKHR(gl.display, f->sync, 0, 0) !=
+        EGL_CONDITION_SATISFIED_KHR)
+    {
+      break;
+    }
+
+    frame_complete(f);
+    frames_head = (frames_head + 1) % MAX_SCANOUTS;
+    frames_count--;
+  }
+
+  if (completed_seq != completed)
+    release_pixmaps();
+}
+
+/*
+ * Tracks the composition just submitted with a fence, instead of waiting for
+ * it. The kernel holds the flip until the GPU is done with the buffer.
+ */
+static void
+frame_submit(uint64_t start_ns)
+{
+  struct epoll_event ev = {EPOLLIN};
+  struct frame *f;
+
+  if (!eglCreateSyncKHR || frames_count == MAX_SCANOUTS)
+  {
+    glFinish();
+    frames_poll();
+    completed_seq = frame_seq;
+    release_pixmaps();
+    return;
+  }
+
+  f = &frames[(frames_head + frames_count) % MAX_SCANOUTS];
+  f->seq = frame_seq;
+  f->start_ns = start_ns;
+  f->fence_fd = -1;
+  f->sync = eglCreateSyncKHR(gl.display, eglDupNativeFenceFDANDROID ?
+                             EGL_SYNC_NATIVE_FENCE_ANDROID :
+                             EGL_SYNC_FENCE_KHR, NULL);
+
+  if (f->sync == EGL_NO_SYNC_KHR)
+  {
+    glFinish();
+    completed_seq = frame_seq;
+    release_pixmaps();
+    return;
+  }
+
+  /* the native fence only exists once the commands are flushed */
+  glFlush();
+  frames_count++;
+
+  if (eglDupNativeFenceFDANDROID)
+  {
+    f->fence_fd = eglDupNativeFenceFDANDROID(gl.display, f->sync);
+    ev.data.ptr = f;
+
+    if (f->fence_fd != EGL_NO_NATIVE_FENCE_FD_ANDROID &&
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, f->fence_fd, &ev))
+    {
+      perror("epoll_ctl");
+      close(f->fence_fd);
+      f->fence_fd = -1;
+    }
+  }
+}
+
+/*
+ * Draws the latest pixmap of every client into its own tile of a free
+ * scanout buffer and flips to it, then acknowledges the presents that made
+ * it. The pixmaps a client replaced are released once the GPU is done with
+ * the compositions that read them.
+ */
+static void
+compose(void)
+{
+  int n = slist_size(clients);
+  int cols, rows, i = 0;
+  uint64_t start, elapsed;
+  struct scanout *so;
+  slist *l;
+
+  if (!needs_compose)
+    return;
+
+  /* all of them are busy, everything new waits for the next vblank */
+  if (!(so = get_free_scanout()))
+  {
+    stats.no_buffer++;
+    return;
+  }
+
+  start = time_ns();
+  needs_compose = 0;
+  frame_seq++;
+
+  for (cols = 1; cols * cols < n; cols++)
+    ;
+
+  rows = n ? (n + cols - 1) / cols : 1;
+
+  glBindFramebuffer(GL_FRAMEBUFFER, so->fbo);
+  glViewport(0, 0, drm.mode->hdisplay, drm.mode->vdisplay);
+  glClear(GL_COLOR_BUFFER_BIT);
+  glUseProgram(programObject);
+  glActiveTexture(GL_TEXTURE0);
+  glUniform1i(samplerLoc, 0);
+
+  so->presents = 0;
+  so->present_ns_sum = 0;
+  so->oldest_present_ns = 0;
+
+  slist_for_each(clients, l)
+  {
+    struct client *c = l->data;
+    int w = drm.mode->hdisplay / cols;
+    int h = drm.mode->vdisplay / rows;
+
+    if (c->has_present)
+    {
+      if (c->has_shown && c->shown_id != c->present_id)
+        pixmap_unhold(c, pixmap_lookup(c, c->shown_id));
+
+      c->shown_id = c->present_id;
+      c->has_shown = 1;
+
+      so->presents++;
+      so->present_ns_sum += c->present_ns;
+
+      if (!so->oldest_present_ns || c->present_ns < so->oldest_present_ns)
+        so->oldest_present_ns = c->present_ns;
+    }
+
+    if (c->has_shown)
+    {
+      struct pixmap *pix = pixmap_lookup(c, c->shown_id);
+
+      pix->last_used = frame_seq;
+      draw_pixmap(pix->import->tex, (i % cols) * w, (i / cols) * h, w, h);
+    }
+
+    i++;
+  }
+
+  {
+    static const GLenum attachments[] = {
+        GL_DEPTH_ATTACHMENT,
+        GL_STENCIL_ATTACHMENT
+    };
+
+    _glDiscardFramebufferEXT(GL_FRAMEBUFFER, 2, attachments);
+  }
+
+  frame_submit(start);
+
+  if (flipping)
+    ready = so;
+  else
+    queue_flip(so);
+
+  slist_for_each(clients, l)
+  {
+    struct client *c = l->data;
+
+    if (c->has_present)
+    {
+      send_presented(c, c->present_id, c->present_serial);
+      c->has_present = 0;
+    }
+
+    client_send(c);
+  }
+
+  elapsed = time_ns() - start;
+  stats.frames++;
+  stats.compose_ns += elapsed;
+  stats.compose_sq_ns += (double)elapsed * elapsed;
+
+  if (elapsed > stats.compose_max_ns)
+    stats.compose_max_ns = elapsed;
+
+  /* without native fences this is all there is to go by */
+  if (!eglDupNativeFenceFDANDROID)
+    update_budget(elapsed);
+}
+
+static void
+page_flip_handler(int fd, unsigned int sequence, unsigned int tv_sec,
+                  unsigned int tv_usec, void *data)
+{
+  struct scanout *so = data;
+  uint64_t flip_ns = (uint64_t)tv_sec * 1000000000ULL + tv_usec * 1000ULL;
+
+  stats.flips++;
+
+  if (so->presents)
+  {
+    uint64_t latency = flip_ns - so->oldest_present_ns;
+
+    stats.latency_ns += so->presents * flip_ns - so->present_ns_sum;
+    stats.latency_count += so->presents;
+
+    if (latency > stats.latency_max_ns)
+      stats.latency_max_ns = latency;
+  }
+
+  vblank_ns = flip_ns;
+  front = so;
+  flipping = NULL;
+
+  if (ready)
+  {
+    queue_flip(ready);
+    ready = NULL;
+  }
+}
+
+/*
+ * Arms the timer for the next vblank, minus the time a composition takes and
+ * some slack, predicted from the last flip.
+ */
+static void
+schedule_compose(int timer_fd)
+{
+  uint64_t lead = compose_budget_ns + COMPOSE_SLACK_NS;
+  uint64_t now = time_ns();
+  uint64_t next = vblank_ns + period_ns;
+  struct itimerspec its = {{0, 0}, {0, 0}};
+
+  if (lead > period_ns)
+    lead = period_ns;
+
+  if (next < now + lead)
+    next += ((now + lead - next) / period_ns + 1) * period_ns;
+
+  compose_at_ns = next - lead;
+  its.it_value.tv_sec = (next - lead) / 1000000000ULL;
+  its.it_value.tv_nsec = (next - lead) % 1000000000ULL;
+
+  if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL))
+    perror("timerfd_settime");
+}
+
+static int
+init_scanouts(void)
+{
+  uint64_t cap = 0;
+  int i;
+
+  for (i = 0; i < num_scanouts; i++)
+  {
+    struct scanout *so = &scanouts[i];
+
+    if (!(so->fb = drm_fb_get_from_bo(so->bo)))
+      return -1;
+
+    so->tex = texture_from_bo(so->bo);
+    so->fbo = fbo_from_tex(so->tex);
+
+    glClearColor(0, 1, 0, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+  }
+
+  glFinish();
+
+  if (drmGetCap(drm.fd, DRM_CAP_TIMESTAMP_MONOTONIC, &cap) || !cap)
+    fprintf(stderr, "flip timestamps are not monotonic, latency is off\n");
+
+  /* the exact refresh rate, vrefresh is rounded */
+  if (drm.mode->clock && drm.mode->htotal && drm.mode->vtotal)
+  {
+    period_ns = (uint64_t)drm.mode->htotal * drm.mode->vtotal * 1000000ULL /
+        drm.mode->clock;
+  }
+  else
+    period_ns = 1000000000ULL / 60;
+
+  front = &scanouts[0];
+  vblank_ns = time_ns();
+
+  return 0;
+}
+
+static void
+usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [-d drm_device] [-b 2|3]\n", name);
+}
+
+/* how late the render thread woke up for a composition */
+static void
+count_wakeup(void)
+{
+  uint64_t late = time_ns() - compose_at_ns;
+
+  stats.ticks++;
+  stats.wake_ns += late;
+  stats.wake_sq_ns += (double)late * late;
+
+  if (late > stats.wake_max_ns)
+    stats.wake_max_ns = late;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int ret;
+  struct epoll_event ev = {EPOLLIN};
+  drmEventContext evctx =
+  {
+    .version = DRM_EVENT_CONTEXT_VERSION,
+    .page_flip_handler = page_flip_handler,
+  };
+  int listen_fd, timer_fd;
+  pthread_t ipc;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "d:b:")) != -1)
+  {
+    switch (opt)
+    {
+      case 'd':
+        drm_device = optarg;
+        break;
+      case 'b':
+        num_scanouts = atoi(optarg);
+        break;
+      default:
+        usage(argv[0]);
+        return -1;
+    }
+  }
+
+  if (num_scanouts < 2 || num_scanouts > MAX_SCANOUTS)
+  {
+    usage(argv[0]);
+    return -1;
+  }
+
+  unlink(SOCKET_NAME);
+
+  listen_fd = bind_named_socket(SOCKET_NAME);
+  if (listen_fd == -1)
+  {
+    fprintf(stdout, "failed to bind to socket\n");
+    return -1;
+  }
+
+  listen(listen_fd, 64);
+
+  if ((ret = init_drm()))
+  {
+    fprintf(stdout, "failed to initialize DRM\n");
+    return ret;
+  }
+
+  if ((ret = init_gbm()))
+  {
+    fprintf(stdout, "failed to initialize GBM\n");
+    return ret;
+  }
+
+  if ((ret = init_gl()))
+  {
+    fprintf(stdout, "failed to initialize EGL\n");
+    return ret;
+  }
+
+  if ((ret = init_scanouts()))
+  {
+    fprintf(stdout, "failed to initialize scanout buffers\n");
+    return ret;
+  }
+
+  /* set mode: */
+  ret = drmModeSetCrtc(drm.fd, drm.crtc_id, front->fb->fb_id, 0, 0,
+                       &drm.connector_id, 1, drm.mode);
+  if (ret)
+  {
+          fprintf(stdout, "failed to set mode: %s\n", strerror(errno));
+          return ret;
+  }
+
+  timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+
+  if (timer_fd < 0)
+  {
+    perror("timerfd_create");
+    return -1;
+  }
+
+  schedule_compose(timer_fd);
+
+  if (thread_queue_init(&to_render) || thread_queue_init(&to_ipc))
+    return -1;
+
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  ipc_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+  /*
+   * clients have their struct watch as data, fence fds their struct frame,
+   * the queues themselves, the rest point to their fd
+   */
+  ev.data.ptr = &listen_fd;
+  epoll_ctl(ipc_epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev);
+  ev.data.ptr = &to_ipc;
+  epoll_ctl(ipc_epoll_fd, EPOLL_CTL_ADD, to_ipc.doorbell, &ev);
+  ev.data.ptr = &to_render;
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, to_render.doorbell, &ev);
+  ev.data.ptr = &timer_fd;
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev);
+  ev.data.ptr = &drm.fd;
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, drm.fd, &ev);
+
+  stats.start_ns = time_ns();
+
+  if ((ret = pthread_create(&ipc, NULL, ipc_thread, &listen_fd)))
+  {
+    fprintf(stderr, "failed to start the IPC thread: %s\n", strerror(ret));
+    return -1;
+  }
+
+  while (1)
+  {
+    struct epoll_event events[64];
+    /* retry what did not fit in to_ipc soon */
+    int i, n = epoll_wait(epoll_fd, events, ARRAY_SIZE(events),
+                          ipc_backlog ? 1 : -1);
+
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+
+      perror("epoll_wait");
+      return -1;
+    }
+
+    for (i = 0; i < n; i++)
+    {
+      if (events[i].data.ptr == &to_render)
+        render_dispatch();
+      else if (events[i].data.ptr >= (void *)frames &&
+               events[i].data.ptr < (void *)(frames + MAX_SCANOUTS))
+      {
+        /* fences signal in order, this retires it and those before it */
+        frames_poll();
+      }
+      else if (events[i].data.ptr == &timer_fd)
+      {
+        uint64_t expirations;
+
+        if (read(timer_fd, &expirations, sizeof(expirations)) > 0)
+        {
+          count_wakeup();
+          /* without fence fds, finished compositions are found here */
+          frames_poll();
+          clients_backlog_flush();
+          compose();
+          report_stats();
+          schedule_compose(timer_fd);
+        }
+      }
+      else if (events[i].data.ptr == &drm.fd)
+      {
+        drmHandleEvent(drm.fd, &evctx);
+        schedule_compose(timer_fd);
+      }
+    }
+
+    ipc_backlog_flush();
   }
 
   return ret;
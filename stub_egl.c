@@ -0,0 +1,275 @@
+/*
+ * stub_egl.c
+ *
+ * Copyright (C) 2020 Ivaylo Dimitrov <ivo.g.dimitrov.75@gmail.com>
+ *
+ * This library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * The part of a gbm platform EGL the shim sits on top of, without any
+ * rendering. Configs are laid out as the driver's _EGLConfig, because that
+ * is what the shim reads NativeVisualID from.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include "stub_gbm.h"
+
+#include "egl_pvr.h"
+
+typedef struct
+{
+  struct gbm_device *gbm;
+} StubDisplay;
+
+typedef struct
+{
+  struct gbm_surface *gbm_surface;
+} StubSurface;
+
+static _EGLConfig configs[] =
+{
+  {
+    .BufferSize = 32, .RedSize = 8, .GreenSize = 8, .BlueSize = 8,
+    .ConfigID = 1, .NativeVisualID = GBM_FORMAT_XRGB8888,
+    .SurfaceType = EGL_WINDOW_BIT, .RenderableType = EGL_OPENGL_ES2_BIT
+  },
+  {
+    .BufferSize = 32, .AlphaSize = 8, .RedSize = 8, .GreenSize = 8,
+    .BlueSize = 8, .ConfigID = 2, .NativeVisualID = GBM_FORMAT_ARGB8888,
+    .SurfaceType = EGL_WINDOW_BIT, .RenderableType = EGL_OPENGL_ES2_BIT
+  },
+  {
+    .BufferSize = 16, .RedSize = 5, .GreenSize = 6, .BlueSize = 5,
+    .ConfigID = 3, .NativeVisualID = GBM_FORMAT_RGB565,
+    .SurfaceType = EGL_WINDOW_BIT, .RenderableType = EGL_OPENGL_ES2_BIT
+  },
+};
+
+#define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
+
+static EGLint error = EGL_SUCCESS;
+
+static EGLBoolean
+set_error(EGLint err)
+{
+  error = err;
+
+  return err == EGL_SUCCESS ? EGL_TRUE : EGL_FALSE;
+}
+
+EGLAPI EGLDisplay EGLAPIENTRY
+eglGetDisplay(EGLNativeDisplayType display_id)
+{
+  StubDisplay *dpy = calloc(1, sizeof(*dpy));
+
+  dpy->gbm = (struct gbm_device *)display_id;
+
+  return dpy;
+}
+
+EGLAPI EGLBoolean EGLAPIENTRY
+eglInitialize(EGLDisplay dpy, EGLint *major, EGLint *minor)
+{
+  if (major)
+    *major = 1;
+
+  if (minor)
+    *minor = 4;
+
+  return set_error(EGL_SUCCESS);
+}
+
+EGLAPI EGLBoolean EGLAPIENTRY
+eglTerminate(EGLDisplay dpy)
+{
+  return set_error(EGL_SUCCESS);
+}
+
+EGLAPI EGLint EGLAPIENTRY
+eglGetError(void)
+{
+  EGLint err = error;
+
+  error = EGL_SUCCESS;
+
+  return err;
+}
+
+EGLAPI EGLBoolean EGLAPIENTRY
+eglBindAPI(EGLenum api)
+{
+  return set_error(EGL_SUCCESS);
+}
+
+EGLAPI EGLBoolean EGLAPIENTRY
+eglGetConfigs(EGLDisplay dpy, EGLConfig *out, EGLint size, EGLint *num)
+{
+  EGLint i;
+
+  if (!out)
+  {
+    *num = ARRAY_SIZE(configs);
+    return set_error(EGL_SUCCESS);
+  }
+
+  for (i = 0; i < size && i < ARRAY_SIZE(configs); i++)
+    out[i] = &configs[i];
+
+  *num = i;
+
+  return set_error(EGL_SUCCESS);
+}
+
+/* everything matches, callers are expected to check the attributes */
+EGLAPI EGLBoolean EGLAPIENTRY
+eglChooseConfig(EGLDisplay dpy, const EGLint *attrib_list, EGLConfig *out,
+                EGLint size, EGLint *num)
+{
+  return eglGetConfigs(dpy, out, size, num);
+}
+
+EGLAPI EGLBoolean EGLAPIENTRY
+eglGetConfigAttrib(EGLDisplay dpy, EGLConfig config, EGLint attribute,
+                   EGLint *value)
+{
+  const _EGLConfig *conf = config;
+
+  switch (attribute)
+  {
+    case EGL_BUFFER_SIZE:
+      *value = conf->BufferSize;
+      break;
+    case EGL_RED_SIZE:
+      *value = conf->RedSize;
+      break;
+    case EGL_GREEN_SIZE:
+      *value = conf->GreenSize;
+      break;
+    case EGL_BLUE_SIZE:
+      *value = conf->BlueSize;
+      break;
+    case EGL_ALPHA_SIZE:
+      *value = conf->AlphaSize;
+      break;
+    case EGL_CONFIG_ID:
+      *value = conf->ConfigID;
+      break;
+    case EGL_NATIVE_VISUAL_ID:
+      *value = conf->NativeVisualID;
+      break;
+    case EGL_SURFACE_TYPE:
+      *value = conf->SurfaceType;
+      break;
+    case EGL_RENDERABLE_TYPE:
+      *value = conf->RenderableType;
+      break;
+    default:
+      return set_error(EGL_BAD_ATTRIBUTE);
+  }
+
+  return set_error(EGL_SUCCESS);
+}
+
+EGLAPI EGLSurface EGLAPIENTRY
+eglCreateWindowSurface(EGLDisplay dpy, EGLConfig config,
+                       EGLNativeWindowType win, const EGLint *attrib_list)
+{
+  StubSurface *surface;
+
+  if (!win)
+  {
+    set_error(EGL_BAD_NATIVE_WINDOW);
+    return EGL_NO_SURFACE;
+  }
+
+  surface = calloc(1, sizeof(*surface));
+  surface->gbm_surface = (struct gbm_surface *)win;
+
+  return surface;
+}
+
+/* the gbm surface belongs to whoever passed it in */
+EGLAPI EGLBoolean EGLAPIENTRY
+eglDestroySurface(EGLDisplay dpy, EGLSurface surface)
+{
+  free(surface);
+
+  return set_error(EGL_SUCCESS);
+}
+
+EGLAPI EGLContext EGLAPIENTRY
+eglCreateContext(EGLDisplay dpy, EGLConfig config, EGLContext share_context,
+                 const EGLint *attrib_list)
+{
+  static int context;
+
+  return &context;
+}
+
+EGLAPI EGLBoolean EGLAPIENTRY
+eglDestroyContext(EGLDisplay dpy, EGLContext ctx)
+{
+  return set_error(EGL_SUCCESS);
+}
+
+EGLAPI EGLBoolean EGLAPIENTRY
+eglMakeCurrent(EGLDisplay dpy, EGLSurface draw, EGLSurface read,
+               EGLContext ctx)
+{
+  return set_error(EGL_SUCCESS);
+}
+
+EGLAPI EGLBoolean EGLAPIENTRY
+eglSwapBuffers(EGLDisplay dpy, EGLSurface surface)
+{
+  StubSurface *surf = surface;
+
+  if (!stub_gbm_surface_swap(surf->gbm_surface))
+    return set_error(EGL_BAD_ALLOC);
+
+  return set_error(EGL_SUCCESS);
+}
+
+EGLAPI const char * EGLAPIENTRY
+eglQueryString(EGLDisplay dpy, EGLint name)
+{
+  switch (name)
+  {
+    case EGL_VENDOR:
+      return "stub";
+    case EGL_VERSION:
+      return "1.4 stub";
+    case EGL_EXTENSIONS:
+      return "";
+    case EGL_CLIENT_APIS:
+      return "OpenGL_ES";
+  }
+
+  set_error(EGL_BAD_PARAMETER);
+
+  return NULL;
+}
+
+EGLAPI __eglMustCastToProperFunctionPointerType EGLAPIENTRY
+eglGetProcAddress(const char *procname)
+{
+  return NULL;
+}
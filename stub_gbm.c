@@ -0,0 +1,385 @@
+/*
+ * stub_gbm.c
+ *
+ * Copyright (C) 2020 Ivaylo Dimitrov <ivo.g.dimitrov.75@gmail.com>
+ *
+ * This library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * gbm without a GPU, for benchmarking the shim. Buffers are memfds, so they
+ * can be passed to the (fake) X server and mapped like linear bos.
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "stub_gbm.h"
+
+/* what mesa allocates at most for a window surface */
+#define STUB_SURFACE_BUFFERS 4
+
+struct gbm_device
+{
+  int fd;
+};
+
+struct gbm_bo
+{
+  struct gbm_device *gbm;
+  uint32_t width;
+  uint32_t height;
+  uint32_t stride;
+  uint32_t format;
+  uint32_t bpp;
+  int fd;
+  int locked;
+  void *user_data;
+  void (*destroy_user_data)(struct gbm_bo *, void *);
+};
+
+struct gbm_surface
+{
+  struct gbm_device *gbm;
+  uint32_t width;
+  uint32_t height;
+  uint32_t format;
+  struct gbm_bo bos[STUB_SURFACE_BUFFERS];
+  struct gbm_bo *front;
+};
+
+static uint32_t
+format_bpp(uint32_t format)
+{
+  switch (format)
+  {
+    case GBM_FORMAT_RGB565:
+    case GBM_FORMAT_BGR565:
+    case GBM_FORMAT_XRGB1555:
+    case GBM_FORMAT_ARGB1555:
+      return 16;
+    case GBM_FORMAT_RGB888:
+    case GBM_FORMAT_BGR888:
+      return 24;
+    default:
+      return 32;
+  }
+}
+
+static int
+bo_init(struct gbm_bo *bo, struct gbm_device *gbm, uint32_t width,
+        uint32_t height, uint32_t format)
+{
+  bo->gbm = gbm;
+  bo->width = width;
+  bo->height = height;
+  bo->format = format;
+  bo->bpp = format_bpp(format);
+  bo->stride = (width * bo->bpp / 8 + 63) & ~63;
+  bo->fd = memfd_create("stub-gbm-bo", MFD_CLOEXEC);
+
+  if (bo->fd == -1)
+    return 0;
+
+  /* sparse, nothing gets allocated unless the bo is mapped and written */
+  if (ftruncate(bo->fd, (off_t)bo->stride * height))
+  {
+    close(bo->fd);
+    bo->fd = -1;
+    return 0;
+  }
+
+  return 1;
+}
+
+static void
+bo_fini(struct gbm_bo *bo)
+{
+  if (bo->destroy_user_data)
+    bo->destroy_user_data(bo, bo->user_data);
+
+  if (bo->fd != -1)
+    close(bo->fd);
+
+  memset(bo, 0, sizeof(*bo));
+  bo->fd = -1;
+}
+
+struct gbm_device *
+gbm_create_device(int fd)
+{
+  struct gbm_device *gbm = calloc(1, sizeof(*gbm));
+
+  gbm->fd = fd;
+
+  return gbm;
+}
+
+void
+gbm_device_destroy(struct gbm_device *gbm)
+{
+  free(gbm);
+}
+
+int
+gbm_device_get_fd(struct gbm_device *gbm)
+{
+  return gbm->fd;
+}
+
+struct gbm_bo *
+gbm_bo_create(struct gbm_device *gbm, uint32_t width, uint32_t height,
+              uint32_t format, uint32_t flags)
+{
+  struct gbm_bo *bo = calloc(1, sizeof(*bo));
+
+  if (!bo_init(bo, gbm, width, height, format))
+  {
+    free(bo);
+    return NULL;
+  }
+
+  return bo;
+}
+
+struct gbm_bo *
+gbm_bo_import(struct gbm_device *gbm, uint32_t type, void *buffer,
+              uint32_t usage)
+{
+  struct gbm_import_fd_data *data = buffer;
+  struct gbm_bo *bo;
+
+  if (type != GBM_BO_IMPORT_FD)
+    return NULL;
+
+  bo = calloc(1, sizeof(*bo));
+  bo->gbm = gbm;
+  bo->width = data->width;
+  bo->height = data->height;
+  bo->stride = data->stride;
+  bo->format = data->format;
+  bo->bpp = format_bpp(data->format);
+  bo->fd = fcntl(data->fd, F_DUPFD_CLOEXEC, 0);
+
+  return bo;
+}
+
+void
+gbm_bo_destroy(struct gbm_bo *bo)
+{
+  bo_fini(bo);
+  free(bo);
+}
+
+struct gbm_surface *
+gbm_surface_create(struct gbm_device *gbm, uint32_t width, uint32_t height,
+                   uint32_t format, uint32_t flags)
+{
+  struct gbm_surface *surface = calloc(1, sizeof(*surface));
+  int i;
+
+  surface->gbm = gbm;
+  surface->width = width;
+  surface->height = height;
+  surface->format = format;
+
+  for (i = 0; i < STUB_SURFACE_BUFFERS; i++)
+    surface->bos[i].fd = -1;
+
+  return surface;
+}
+
+struct gbm_surface *
+gbm_surface_create_with_modifiers(struct gbm_device *gbm, uint32_t width,
+                                  uint32_t height, uint32_t format,
+                                  const uint64_t *modifiers,
+                                  const unsigned int count)
+{
+  return gbm_surface_create(gbm, width, height, format, 0);
+}
+
+void
+gbm_surface_destroy(struct gbm_surface *surface)
+{
+  int i;
+
+  for (i = 0; i < STUB_SURFACE_BUFFERS; i++)
+    bo_fini(&surface->bos[i]);
+
+  free(surface);
+}
+
+int
+stub_gbm_surface_swap(struct gbm_surface *surface)
+{
+  int i;
+
+  for (i = 0; i < STUB_SURFACE_BUFFERS; i++)
+  {
+    struct gbm_bo *bo = &surface->bos[i];
+
+    if (bo->locked)
+      continue;
+
+    /* buffers are allocated on first use, as in mesa */
+    if (bo->fd == -1 && !bo_init(bo, surface->gbm, surface->width,
+                                 surface->height, surface->format))
+    {
+      return 0;
+    }
+
+    surface->front = bo;
+
+    return 1;
+  }
+
+  return 0;
+}
+
+struct gbm_bo *
+gbm_surface_lock_front_buffer(struct gbm_surface *surface)
+{
+  struct gbm_bo *bo = surface->front;
+
+  if (!bo)
+    return NULL;
+
+  bo->locked = 1;
+  surface->front = NULL;
+
+  return bo;
+}
+
+void
+gbm_surface_release_buffer(struct gbm_surface *surface, struct gbm_bo *bo)
+{
+  bo->locked = 0;
+}
+
+int
+gbm_surface_has_free_buffers(struct gbm_surface *surface)
+{
+  int i;
+
+  for (i = 0; i < STUB_SURFACE_BUFFERS; i++)
+  {
+    if (!surface->bos[i].locked)
+      return 1;
+  }
+
+  return 0;
+}
+
+uint32_t
+gbm_bo_get_width(struct gbm_bo *bo)
+{
+  return bo->width;
+}
+
+uint32_t
+gbm_bo_get_height(struct gbm_bo *bo)
+{
+  return bo->height;
+}
+
+uint32_t
+gbm_bo_get_stride(struct gbm_bo *bo)
+{
+  return bo->stride;
+}
+
+uint32_t
+gbm_bo_get_format(struct gbm_bo *bo)
+{
+  return bo->format;
+}
+
+uint32_t
+gbm_bo_get_bpp(struct gbm_bo *bo)
+{
+  return bo->bpp;
+}
+
+struct gbm_device *
+gbm_bo_get_device(struct gbm_bo *bo)
+{
+  return bo->gbm;
+}
+
+union gbm_bo_handle
+gbm_bo_get_handle(struct gbm_bo *bo)
+{
+  union gbm_bo_handle handle;
+
+  handle.s32 = bo->fd;
+
+  return handle;
+}
+
+/* memfds are plain memory, so linear */
+uint64_t
+gbm_bo_get_modifier(struct gbm_bo *bo)
+{
+  return 0;
+}
+
+int
+gbm_bo_get_fd(struct gbm_bo *bo)
+{
+  return fcntl(bo->fd, F_DUPFD_CLOEXEC, 0);
+}
+
+void
+gbm_bo_set_user_data(struct gbm_bo *bo, void *data,
+                     void (*destroy_user_data)(struct gbm_bo *, void *))
+{
+  bo->user_data = data;
+  bo->destroy_user_data = destroy_user_data;
+}
+
+void *
+gbm_bo_get_user_data(struct gbm_bo *bo)
+{
+  return bo->user_data;
+}
+
+void *
+gbm_bo_map(struct gbm_bo *bo, uint32_t x, uint32_t y, uint32_t width,
+           uint32_t height, uint32_t flags, uint32_t *stride, void **map_data)
+{
+  size_t size = (size_t)bo->stride * bo->height;
+  uint8_t *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      bo->fd, 0);
+
+  if (map == MAP_FAILED)
+    return NULL;
+
+  *map_data = map;
+  *stride = bo->stride;
+
+  return map + y * bo->stride + x * bo->bpp / 8;
+}
+
+void
+gbm_bo_unmap(struct gbm_bo *bo, void *map_data)
+{
+  munmap(map_data, (size_t)bo->stride * bo->height);
+}
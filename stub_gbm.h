@@ -0,0 +1,32 @@
+/*
+ * stub_gbm.h
+ *
+ * Copyright (C) 2020 Ivaylo Dimitrov <ivo.g.dimitrov.75@gmail.com>
+ *
+ * This library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library. If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef STUB_GBM_H
+#define STUB_GBM_H
+
+#include <gbm.h>
+
+/*
+ * What the driver does in eglSwapBuffers: a free buffer gets "rendered" and
+ * becomes the front one. Returns 0 if all the buffers are locked.
+ */
+int
+stub_gbm_surface_swap(struct gbm_surface *surface);
+
+#endif // STUB_GBM_H
@@ -26,6 +26,7 @@
 #include <fcntl.h>
 
 #include "xcb_dri3.h"
+#include "egl_log.h"
 
 static Bool
 xcb_check_dri3_ext(xcb_connection_t *xcb_conn, xcb_screen_t *screen)
@@ -37,7 +38,7 @@ xcb_check_dri3_ext(xcb_connection_t *xcb_conn, xcb_screen_t *screen)
 
   if (!(extension && extension->present))
   {
-    fprintf(stderr, "No DRI3 support\n");
+    LOG_WARN(DISPLAY, "No DRI3 support");
     return False;
   }
 
@@ -49,11 +50,12 @@ xcb_check_dri3_ext(xcb_connection_t *xcb_conn, xcb_screen_t *screen)
 
   if (!reply)
   {
-    fprintf(stderr, "xcb_dri3_query_version failed\n");
+    LOG_ERROR(DISPLAY, "xcb_dri3_query_version failed");
     return False;
   }
 
-  printf("DRI3 %u.%u\n", reply->major_version, reply->minor_version);
+  LOG_INFO(DISPLAY, "DRI3 %u.%u", reply->major_version,
+           reply->minor_version);
 
   free(reply);
 
@@ -68,7 +70,7 @@ xcb_dri3_open_dri3(xcb_connection_t *xcb_conn, xcb_screen_t *screen)
 
   if (!reply)
   {
-    fprintf(stderr, "dri3 open failed\n");
+    LOG_ERROR(DISPLAY, "dri3 open failed");
     return -1;
   }
 
@@ -76,7 +78,7 @@ xcb_dri3_open_dri3(xcb_connection_t *xcb_conn, xcb_screen_t *screen)
 
   if (nfds != 1)
   {
-    fprintf(stderr, "bad number of fds\n");
+    LOG_ERROR(DISPLAY, "bad number of fds");
     return -1;
   }
 
@@ -101,7 +103,7 @@ xcb_check_present_ext(xcb_connection_t *xcb_conn, xcb_screen_t *screen)
 
   if (!(extension && extension->present))
   {
-    fprintf(stderr, "No present extension\n");
+    LOG_WARN(DISPLAY, "No present extension");
     return False;
   }
 
@@ -113,7 +115,7 @@ xcb_check_present_ext(xcb_connection_t *xcb_conn, xcb_screen_t *screen)
 
   if (!reply)
   {
-    fprintf(stderr, "xcb_present_query_version failed\n");
+    LOG_ERROR(DISPLAY, "xcb_present_query_version failed");
     return False;
   }
 
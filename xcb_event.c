@@ -20,6 +20,7 @@
 #include <stdio.h>
 
 #include "xcb_event.h"
+#include "egl_log.h"
 
 xcb_special_event_t *
 xcb_event_init_special_event_queue(xcb_connection_t *c, xcb_window_t window,
@@ -41,7 +42,7 @@ xcb_event_init_special_event_queue(xcb_connection_t *c, xcb_window_t window,
 
   if (error)
   {
-    fprintf(stderr, "req xge failed\n");
+    LOG_ERROR(PRESENT, "req xge failed");
     return NULL;
   }
 
@@ -49,7 +50,7 @@ xcb_event_init_special_event_queue(xcb_connection_t *c, xcb_window_t window,
                                             special_ev_stamp);
 
   if (!special_ev)
-    fprintf(stderr, "no special ev\n");
+    LOG_ERROR(PRESENT, "no special ev");
 
   return special_ev;
 }